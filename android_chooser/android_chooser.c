@@ -41,23 +41,12 @@ FILE * logfile;
 
 #include "mimetypes.h"
 #include "utils.h"
+#include "uevent.h"
+#include "decompress.h"
 #include "mountpoints.h"
+#include "trace.h"
 #include "android_chooser.h"
 
-/* make /dev from /sys */
-void mdev(void)
-{
-	pid_t pid;
-	if(!(pid = fork()))
-	{
-		char *mdev_argv[] = MDEV_ARGS;
-		chdir(WORKING_DIR);
-		chroot(WORKING_DIR);
-		execv(BUSYBOX,mdev_argv);
-	}
-	waitpid(pid,NULL,0);
-}
-
 /* substitute '\n' with '\0' */
 void fgets_fix(char *string)
 {
@@ -176,8 +165,8 @@ const char *find_android_fstab(void)
 
 source_type find_file_type(char *file, struct stat info)
 {
-		//char magic[MAX_MAGIC_LEN];
-		//int fd,len;
+		const struct decompressor *d;
+		int fd;
 		
 		errno = EINVAL;
 		if(S_ISDIR(info.st_mode))
@@ -186,42 +175,21 @@ source_type find_file_type(char *file, struct stat info)
 				return BLKDEV;
 		if(!S_ISREG(info.st_mode))
 				return NONE;
-		/* we have a regular file, it can be one of the following:
-		 * - filesystem image file
-		 * - compressed cpio archive
-		 * - cpio archive
+		/* we have a regular file, it can be a filesystem image
+		 * or a compressed image that we cannot loop mount.
 		 */
-		/*
 		if((fd = open(file,O_RDONLY)) < 0)
-		 		return NONE;
-		if(read(fd,magic,MAX_MAGIC_LEN) != MAX_MAGIC_LEN)
-		{
-				close(fd);
 				return NONE;
-		}
+		d = decompress_probe_fd(fd);
 		close(fd);
-		len = strlen(GZIP_MAGIC);
-		if(!strncmp(magic,GZIP_MAGIC,len))
-		{
-				if(read_first_bytes_of_archive(file,magic,MAX_MAGIC_LEN))
-				{
-						// TODO: gzip have a custom error handler, so errno doesn't contains the real error in many cases
-						fprintf(logfile,"read_first_bytes_of_archive \"%s\" - %s",file,strerror(errno));
-						return NONE;
-				}
-				len = strlen(CPIO_MAGIC);
-				if(!strncmp(magic,CPIO_MAGIC,len) || !strncmp(magic,CPIO_MAGIC_SVR4,len) || !strncmp(magic,CPIO_MAGIC_CRC,len))
-						return CPIO_ARCHIVE;
-				// FIXME: we can support more compressed files types...but there is many troubles in mounting compressed fs images
+		if(!d)
 				return NONE;
-		}
-		else if (!strncmp(magic,CPIO_MAGIC,(len = strlen(CPIO_MAGIC))) ||
-								!strncmp(magic,CPIO_MAGIC_SVR4,len) ||
-								!strncmp(magic,CPIO_MAGIC_CRC,len) )
+		if(d->magic)
 		{
-				return CPIO_ARCHIVE;
+				fprintf(logfile,"\"%s\" is compressed with %s\n",file,d->name);
+				errno = EOPNOTSUPP;
+				return NONE;
 		}
-		*/
 		return IMAGE_FILE;
 }
 
@@ -426,6 +394,7 @@ mountpoint *loop_binder(mountpoint *list)
 			if(current->s_type == IMAGE_FILE)
 			{
 				snprintf(buffer,MAX_LINE,"dev/loop%d",loop_no);
+				uevent_coldplug("sys",buffer);
 				if((ret = set_loop(buffer,current->blkdev,&(current->blkdev_fd))) == 2)
 					done = 0;
 				else if(ret == 1) // fatal error, remove this mountpoint
@@ -592,14 +561,12 @@ int main(int argc, char **argv)
 			*fstab_path,	// path to our fstab file
             *blkdev,        // block device to mount DATADIR
 			*init_argv[] = { "/init", NULL}; // init argv
-	time_t timeout;
 	const char *android_fstab;
-	//int i; // general purpose integer
+	int i,phase; // general purpose integer, from trace_begin
 	//pid_t udev_pid;			// the pid of android_udev process
 	mountpoint *list = NULL;
 
 	android_fstab = line = start = initrd_path = fstab_path = blkdev = NULL;
-	//i=0;
 	if(chdir(WORKING_DIR) || (logfile = fopen(LOG,"w")) == NULL)
 	{
 		exit(EXIT_FAILURE);
@@ -629,33 +596,35 @@ int main(int argc, char **argv)
 		EXIT_ERROR("unable to find \"%s\" in \"%s\"\n",CMDLINE_OPTION,line);
 	}
 	start+=CMDLINE_OPTION_LEN;
-	if(parser(start,&blkdev,&initrd_path,&fstab_path))
+	phase = trace_begin("parsing");
+	i = parser(start,&blkdev,&initrd_path,&fstab_path);
+	trace_end(phase);
+	if(i)
 	{
 		free(line);
 		EXIT_ERRNO("cmdline parsing failed");
 	}
 	free(line);
-	if(mount("sysfs","sys","sysfs",MS_RELATIME,""))
+	phase = trace_begin("sysfs mount");
+	i = mount("sysfs","sys","sysfs",MS_RELATIME,"");
+	trace_end(phase);
+	if(i)
 	{
 		free(blkdev);
 		free(initrd_path);
 		free(fstab_path);
 		EXIT_ERRNO("unable to mount /sys");
 	}
-	mdev();
 	// make sure this was made
-	if(access(blkdev, R_OK))
-	{
-		timeout = time(NULL) + TIMEOUT;
-		do
-		{
-			usleep(100000); // 100 ms
-			mdev();
-		}
-		while(access(blkdev, R_OK) && time(NULL) < timeout);
-	}
+	phase = trace_begin("device wait");
+	if(uevent_wait_for_device("sys",blkdev,TIMEOUT))
+		fprintf(logfile,"waiting for \"/%s\" - %s\n",blkdev,strerror(errno));
+	trace_end(phase);
 	//mount blkdev on DATADIR
-	if(mount(blkdev,DATADIR,"ext4",0,""))
+	phase = trace_begin("/data mount");
+	i = mount(blkdev,DATADIR,"ext4",0,"");
+	trace_end(phase);
+	if(i)
 	{
 		EXIT_ERRNO("unable to mount \"/%s\" on %s",blkdev,DATADIR);
 		free(blkdev);
@@ -689,7 +658,10 @@ int main(int argc, char **argv)
 		EXIT_ERRNO("cannot remove /bin symlink");
 	}
 	//parse fstab
-	if(fstab_parser(fstab_path,&list))
+	phase = trace_begin("fstab parsing");
+	i = fstab_parser(fstab_path,&list);
+	trace_end(phase);
+	if(i)
 	{
 		free(fstab_path);
 		EXIT_ERRNO("fstab_parser");
@@ -698,7 +670,10 @@ int main(int argc, char **argv)
 	android_fstab = find_android_fstab();
 	if((list = check_list(list)) == NULL)
 		EXIT_ERRNO("check_list");
-	if((list = loop_binder(list)) == NULL)
+	phase = trace_begin("loop_binder");
+	list = loop_binder(list);
+	trace_end(phase);
+	if(list == NULL)
 		EXIT_ERRNO("loop_binder");
 #ifdef DEBUG
 	mountpoint *tmp;
@@ -708,8 +683,13 @@ int main(int argc, char **argv)
 				tmp->mountpoint,tmp->blkdev,tmp->filesystem,
 				(int)tmp->options,tmp->processed,tmp->blkdev_fd,(int)tmp->s_type);
 #endif
-	if(change_android_fstab(list,android_fstab))
+	phase = trace_begin("change_android_fstab");
+	i = change_android_fstab(list,android_fstab);
+	trace_end(phase);
+	if(i)
 		EXIT_ERRNO("change_android_fstab");
+	if((i = trace_open(TRACE_LOG,0)) >= 0 && trace_dump(i,"android_chooser"))
+		fprintf(logfile,"cannot write \"%s\" - %s\n",TRACE_LOG,strerror(errno));
 	fclose(logfile);
 	free_list(list);
 	chdir("/");
@@ -3,6 +3,8 @@
 #define LOG "/android_chooser.log"
 #define PERSISTENT_LOG "/.data/android_chooser.log"
 #define FSTAB_PERSISTENT "/.data/ac_fstab"
+// where we append our boot phases, on the DATADIR partition
+#define TRACE_LOG DATADIR TRACE_FILE
 #define BUSYBOX "/bin/busybox"
 #define MAX_LINE 255
 #define TIMEOUT 5 /* time to wait for external block devices ( USB stick ) */
@@ -20,8 +22,6 @@
 //#define ADB
 #define DEBUG
 
-#define MDEV_ARGS { "/bin/mdev","-s",NULL }
-
 #define COMMAND_LINE_SIZE 1024
 //our option from /proc/cmdline
 #define CMDLINE_OPTION "newandroid="
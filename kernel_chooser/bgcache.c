@@ -0,0 +1,349 @@
+/* backgrounds already in the framebuffer format, compressed.
+ * decoding a BMP every boot means reading megabytes and converting
+ * every pixel, we do it once and keep the result on /data:
+ * later boots only decompress it in place.
+ * the default background in the initramfs uses the same format,
+ * made at build time by "make bgcache" in 32 bit 0xXXRRGGBB pixels,
+ * it is converted when the screen wants something else.
+ * pictures of another size are scaled to cover the screen, the
+ * parts that don't fit are cut equally from both sides.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "bgcache.h"
+#include "bmp.h"
+#include "scale.h"
+
+// the pixels are exactly what the screen wants
+static int same_format(const struct bg_header *h, const struct fb_var_screeninfo *v, long line_length)
+{
+	return h->width == v->xres && h->height == v->yres && h->line_length == line_length &&
+		h->bits_per_pixel == v->bits_per_pixel &&
+		h->red_offset == v->red.offset && h->red_length == v->red.length &&
+		h->green_offset == v->green.offset && h->green_length == v->green.length &&
+		h->blue_offset == v->blue.offset && h->blue_length == v->blue.length;
+}
+
+// the pixels are 0xXXRRGGBB, bmp_convert_row can read them
+static int is_xrgb(const struct bg_header *h)
+{
+	return h->bits_per_pixel == 32 && h->line_length >= h->width * 4 &&
+		h->red_offset == 16 && h->red_length == 8 &&
+		h->green_offset == 8 && h->green_length == 8 &&
+		h->blue_offset == 0 && h->blue_length == 8;
+}
+
+/** decompress the pixels after h
+ * @dst: where they go, line_length*height bytes
+ * returns 0 on success, -1 on error.
+ */
+static int decompress(const struct bg_header *h, uint8_t *dst)
+{
+	const uint8_t *src = (const uint8_t *)(h + 1);
+	size_t raw = (size_t)h->line_length * h->height;
+	uLongf len;
+
+	switch(h->compression)
+	{
+		case BG_ZLIB:
+			len = raw;
+			if(uncompress(dst,&len,src,h->data_size) == Z_OK && len == raw)
+				return 0;
+			break;
+#ifdef HAVE_LZ4
+		case BG_LZ4:
+			if(LZ4_decompress_safe((const char *)src,(char *)dst,h->data_size,raw) == raw)
+				return 0;
+			break;
+#endif
+		default:
+			errno = ENOTSUP;
+			return -1;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+/** describe 0xXXRRGGBB pixels like the framebuffer does */
+void bg_xrgb_format(struct fb_var_screeninfo *v, int width, int height)
+{
+	memset(v,0,sizeof(*v));
+	v->xres = width;
+	v->yres = height;
+	v->bits_per_pixel = 32;
+	v->red.offset = 16;
+	v->green.offset = 8;
+	v->red.length = v->green.length = v->blue.length = 8;
+}
+
+/** bring 0xXXRRGGBB pixels to the screen, scaling them if they are not as big
+ * @pixels, @width, @height, @stride: the picture, stride is in bytes
+ * @v: the screen
+ * @line_length: bytes in a row of the screen
+ * @dst: line_length*v->yres bytes
+ * returns 0 on success, -1 on error.
+ */
+int bg_from_xrgb(uint8_t *pixels, int width, int height, size_t stride, const struct fb_var_screeninfo *v, long line_length, uint8_t *dst)
+{
+	bmp image;
+	uint8_t *scaled;
+	int x,y,w,h;
+
+	if(width == v->xres && height == v->yres)
+	{
+		bmp_pixels(&image,pixels,width,height,stride);
+		for(y=0;y<height;y++)
+			bmp_convert_row(&image,v,dst + y*line_length,y,width);
+		return 0;
+	}
+	// the biggest part with the shape of the screen
+	w = width;
+	h = (int64_t)width * v->yres / v->xres;
+	if(h > height)
+	{
+		h = height;
+		w = (int64_t)height * v->xres / v->yres;
+	}
+	if(w < 1)
+		w = 1;
+	if(h < 1)
+		h = 1;
+	x = (width - w)/2;
+	y = (height - h)/2;
+	if(!(scaled = malloc((size_t)v->xres * v->yres * 4)))
+		return -1;
+	if(scale_xrgb(pixels + y*stride + x*4,w,h,stride,scaled,v->xres,v->yres,v->xres * 4))
+	{
+		free(scaled);
+		return -1;
+	}
+	bmp_pixels(&image,scaled,v->xres,v->yres,v->xres * 4);
+	for(y=0;y<v->yres;y++)
+		bmp_convert_row(&image,v,dst + y*line_length,y,v->xres);
+	free(scaled);
+	return 0;
+}
+
+/** read a background into dst
+ * @file: the one to read
+ * @src: the picture it must have been made from, NULL to take it anyway
+ * @v: the screen
+ * @line_length: bytes in a row of the screen
+ * @dst: line_length*v->yres bytes
+ * returns 0 if it was ready for the screen, 1 if it has been converted,
+ * -1 on error ( ESTALE if it's not for src or for this screen ).
+ */
+int bg_load(const char *file, const struct stat *src, const struct fb_var_screeninfo *v, long line_length, uint8_t *dst)
+{
+	int fd,err,ret;
+	struct stat st;
+	uint8_t *map,*pixels;
+	const struct bg_header *h;
+
+	if((fd = open(file,O_RDONLY|O_CLOEXEC)) < 0)
+		return -1;
+	if(fstat(fd,&st))
+	{
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	if(st.st_size < sizeof(struct bg_header))
+	{
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	map = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	err = errno;
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		errno = err;
+		return -1;
+	}
+	madvise(map,st.st_size,MADV_WILLNEED);
+	h = (const struct bg_header *)map;
+	ret = -1;
+	err = EINVAL;
+	if(memcmp(h->magic,BG_MAGIC,4) || h->version != BG_VERSION ||
+		h->data_size > st.st_size - sizeof(struct bg_header))
+		goto out;
+	err = ESTALE;
+	if(src && (h->src_size != src->st_size || h->src_mtime != src->st_mtime))
+		goto out;
+	if(same_format(h,v,line_length))
+	{
+		// straight on the screen copy
+		err = (decompress(h,dst) ? errno : 0);
+		ret = (err ? -1 : 0);
+		goto out;
+	}
+	// only the portable format can go to another screen
+	if(!is_xrgb(h))
+		goto out;
+	if(!(pixels = malloc((size_t)h->line_length * h->height)))
+	{
+		err = errno;
+		goto out;
+	}
+	if(decompress(h,pixels) || bg_from_xrgb(pixels,h->width,h->height,h->line_length,v,line_length,dst))
+		err = errno;
+	else
+	{
+		err = 0;
+		ret = 1;
+	}
+	free(pixels);
+	out:
+	munmap(map,st.st_size);
+	errno = err;
+	return ret;
+}
+
+/** compress a screen copy in file, replacing it at once
+ * @src: the picture it has been made from, can be NULL
+ * @v: the screen
+ * @line_length: bytes in a row of the screen
+ * @pixels: line_length*v->yres bytes
+ * returns 0 on success, -1 on error.
+ */
+int bg_store(const char *file, const struct stat *src, const struct fb_var_screeninfo *v, long line_length, const uint8_t *pixels)
+{
+	struct bg_header *h;
+	size_t raw,bound;
+	char tmp[256];
+	int fd,err,ret;
+	ssize_t len;
+#ifndef HAVE_LZ4
+	uLongf zlen;
+#endif
+
+	raw = (size_t)line_length * v->yres;
+#ifdef HAVE_LZ4
+	// it decompresses many times faster than zlib
+	bound = LZ4_compressBound(raw);
+#else
+	bound = compressBound(raw);
+#endif
+	if(!(h = calloc(1,sizeof(struct bg_header) + bound)))
+		return -1;
+	memcpy(h->magic,BG_MAGIC,4);
+	h->version = BG_VERSION;
+#ifdef HAVE_LZ4
+	h->compression = BG_LZ4;
+	len = LZ4_compress_default((const char *)pixels,(char *)(h + 1),raw,bound);
+#else
+	h->compression = BG_ZLIB;
+	zlen = bound;
+	len = (compress2((Bytef *)(h + 1),&zlen,pixels,raw,Z_DEFAULT_COMPRESSION) == Z_OK ? zlen : 0);
+#endif
+	if(len <= 0)
+	{
+		free(h);
+		errno = EINVAL;
+		return -1;
+	}
+	h->data_size = len;
+	if(src)
+	{
+		h->src_size = src->st_size;
+		h->src_mtime = src->st_mtime;
+	}
+	h->width = v->xres;
+	h->height = v->yres;
+	h->line_length = line_length;
+	h->bits_per_pixel = v->bits_per_pixel;
+	h->red_offset = v->red.offset;
+	h->red_length = v->red.length;
+	h->green_offset = v->green.offset;
+	h->green_length = v->green.length;
+	h->blue_offset = v->blue.offset;
+	h->blue_length = v->blue.length;
+
+	// a half written file must not look like a good one
+	snprintf(tmp,sizeof(tmp),"%s.tmp",file);
+	if((fd = open(tmp,O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644)) < 0)
+	{
+		err = errno;
+		free(h);
+		errno = err;
+		return -1;
+	}
+	len += sizeof(struct bg_header);
+	ret = (write(fd,h,len) == len ? 0 : -1);
+	err = errno;
+	if(close(fd) && !ret)
+	{
+		ret = -1;
+		err = errno;
+	}
+	if(!ret && rename(tmp,file))
+	{
+		ret = -1;
+		err = errno;
+	}
+	if(ret)
+		unlink(tmp);
+	free(h);
+	errno = err;
+	return ret;
+}
+
+#ifdef TOOL
+
+/* make the default background for the initramfs:
+ * bgcache picture.bmp background.kbg
+ */
+int main(int argc, char **argv)
+{
+	bmp image;
+	struct fb_var_screeninfo v;
+	uint8_t *pixels;
+	long line_length;
+	int row,y;
+
+	if(argc != 3)
+	{
+		fprintf(stderr,"usage: %s picture.bmp background.kbg\n",argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(bmp_open(argv[1],&image))
+	{
+		fprintf(stderr,"%s: %s\n",argv[1],strerror(errno));
+		return EXIT_FAILURE;
+	}
+	bg_xrgb_format(&v,image.width,image.height);
+	line_length = image.width * 4;
+	if(!(pixels = calloc(image.height,line_length)))
+	{
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	for(row=0;row<image.height;row++)
+	{
+		y = (image.top_down ? row : image.height - 1 - row);
+		bmp_convert_row(&image,&v,pixels + y*line_length,row,image.width);
+	}
+	bmp_close(&image);
+	if(bg_store(argv[2],NULL,&v,line_length,pixels))
+	{
+		fprintf(stderr,"%s: %s\n",argv[2],strerror(errno));
+		return EXIT_FAILURE;
+	}
+	free(pixels);
+	return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef _BGCACHE_H
+#define _BGCACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <linux/fb.h>
+
+#define BG_MAGIC "KCBG"
+#define BG_VERSION 1
+
+// how the pixels are compressed
+#define BG_ZLIB 0
+#define BG_LZ4  1
+
+/* a background ready to be copied on the framebuffer:
+ * this header, then line_length*height bytes of compressed pixels.
+ * numbers are in the byte order of who wrote it, little endian for us.
+ */
+struct bg_header
+{
+	char magic[4];
+	uint32_t version,
+					 compression,
+					 data_size; // compressed bytes after the header
+	// the picture it has been made from, 0 if there is none
+	uint64_t src_size;
+	int64_t src_mtime;
+	// the screen it is for
+	uint32_t width,
+					 height,
+					 line_length,
+					 bits_per_pixel,
+					 red_offset, red_length,
+					 green_offset, green_length,
+					 blue_offset, blue_length;
+};
+
+void bg_xrgb_format(struct fb_var_screeninfo *, int, int);
+int bg_from_xrgb(uint8_t *, int, int, size_t, const struct fb_var_screeninfo *, long, uint8_t *);
+int bg_load(const char *, const struct stat *, const struct fb_var_screeninfo *, long, uint8_t *);
+int bg_store(const char *, const struct stat *, const struct fb_var_screeninfo *, long, const uint8_t *);
+
+#endif
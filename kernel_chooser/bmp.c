@@ -0,0 +1,709 @@
+/* read BMP files straight from a memory mapping and convert their rows
+ * to the framebuffer format.
+ * 24 and 32 bit files going to a 32 bit framebuffer are the common case,
+ * they have vectorized converters, chosen at the first use:
+ *  - NEON ( NEON=1, the default when building for ARM, see utils/simd.mk )
+ *  - SSSE3 ( for the tests on the host )
+ *  - plain C
+ * everything else ( 16 bit files, 16/24 bit framebuffers )
+ * goes through a slower per pixel conversion.
+ * "make bmp_test" checks that they all draw the same thing.
+ */
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BMP_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define BMP_NEON
+#include <arm_neon.h>
+#endif
+
+#include "bmp.h"
+
+// byte order of 32 bit framebuffer pixels that we convert fast
+#define ORDER_OTHER -1
+#define ORDER_BGRX   0 /* the same of the file */
+#define ORDER_RGBX   1
+
+static uint32_t le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/** map file and check that we can read it
+ * returns 0 on success, -1 on error ( EINVAL if it's not a BMP we understand ).
+ */
+int bmp_open(const char *file, bmp *b)
+{
+	struct stat st;
+	uint32_t offset,header,compression;
+	int32_t height;
+	int fd,i,err;
+
+	memset(b,0,sizeof(bmp));
+	if((fd = open(file,O_RDONLY|O_CLOEXEC)) < 0)
+		return -1;
+	if(fstat(fd,&st))
+	{
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	if(st.st_size < 54)
+	{
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	b->size = st.st_size;
+	b->map = mmap(NULL,b->size,PROT_READ,MAP_PRIVATE,fd,0);
+	err = errno;
+	close(fd);
+	if(b->map == MAP_FAILED)
+	{
+		b->map = NULL;
+		errno = err;
+		return -1;
+	}
+	// we read it once, from the first row to the last
+	madvise(b->map,b->size,MADV_SEQUENTIAL);
+	madvise(b->map,b->size,MADV_WILLNEED);
+
+	offset = le32(b->map + 10);
+	header = le32(b->map + 14);
+	b->width = (int32_t)le32(b->map + 18);
+	height = (int32_t)le32(b->map + 22);
+	b->depth = le16(b->map + 28);
+	compression = le32(b->map + 30);
+	// negative height means top-down rows
+	b->top_down = (height < 0);
+	b->height = (height < 0 ? -height : height);
+
+	if(b->map[0] != 'B' || b->map[1] != 'M' || header < 40 || b->width <= 0 || b->height <= 0)
+		goto invalid;
+	if(compression == BI_BITFIELDS && (b->depth == 16 || b->depth == 32))
+	{
+		// right after the 40 bytes header, or inside the newer ones
+		if(b->size < 66)
+			goto invalid;
+		for(i=0;i<3;i++)
+			b->masks[i] = le32(b->map + 54 + i*4);
+	}
+	else if(compression != BI_RGB)
+		goto invalid;
+	else if(b->depth == 16)
+	{
+		b->masks[0] = 0x7C00;
+		b->masks[1] = 0x03E0;
+		b->masks[2] = 0x001F;
+	}
+	else if(b->depth == 32)
+	{
+		b->masks[0] = 0xFF0000;
+		b->masks[1] = 0x00FF00;
+		b->masks[2] = 0x0000FF;
+	}
+	else if(b->depth != 24)
+		goto invalid;
+	if(b->depth != 24)
+		for(i=0;i<3;i++)
+		{
+			if(!b->masks[i])
+				goto invalid;
+			b->shifts[i] = __builtin_ctz(b->masks[i]);
+			b->bits[i] = __builtin_popcount(b->masks[i]);
+		}
+
+	b->stride = (((size_t)b->depth * b->width + 31) / 32) * 4; // rows are padded to 4 bytes
+	// stride*height can wrap on 32 bit with a made up header
+	if(offset > b->size || (size_t)b->height > SIZE_MAX / b->stride ||
+		b->stride * b->height > b->size - offset)
+		goto invalid;
+	b->pixels = b->map + offset;
+	return 0;
+
+	invalid:
+	bmp_close(b);
+	errno = EINVAL;
+	return -1;
+}
+
+void bmp_close(bmp *b)
+{
+	if(b->map)
+		munmap(b->map,b->size);
+	b->map = NULL;
+}
+
+/** describe 32 bit pixels in memory, 0xXXRRGGBB, as a top-down BMP
+ * so that bmp_convert_row can read them. there is nothing to close.
+ * @stride: bytes from a row to the next one
+ */
+void bmp_pixels(bmp *b, uint8_t *pixels, int width, int height, size_t stride)
+{
+	int i;
+
+	memset(b,0,sizeof(*b));
+	b->width = width;
+	b->height = height;
+	b->depth = 32;
+	b->top_down = 1;
+	b->stride = stride;
+	b->pixels = pixels;
+	b->masks[0] = 0xFF0000;
+	b->masks[1] = 0x00FF00;
+	b->masks[2] = 0x0000FF;
+	for(i=0;i<3;i++)
+	{
+		b->shifts[i] = __builtin_ctz(b->masks[i]);
+		b->bits[i] = __builtin_popcount(b->masks[i]);
+	}
+}
+
+static void rgb24_c(uint8_t *dst, const uint8_t *src, int n, int swap)
+{
+	int first = (swap ? 2 : 0),
+			third = (swap ? 0 : 2);
+
+	for(;n>0;n--,src+=3,dst+=4)
+	{
+		dst[0] = src[first];
+		dst[1] = src[1];
+		dst[2] = src[third];
+		dst[3] = 0;
+	}
+}
+
+static void rgb32_c(uint8_t *dst, const uint8_t *src, int n, int swap)
+{
+	int first = (swap ? 2 : 0),
+			third = (swap ? 0 : 2);
+
+	for(;n>0;n--,src+=4,dst+=4)
+	{
+		dst[0] = src[first];
+		dst[1] = src[1];
+		dst[2] = src[third];
+		dst[3] = 0;
+	}
+}
+
+#ifdef BMP_NEON
+
+// 16 pixels at a time, the loads split the channels for us
+static void rgb24_neon(uint8_t *dst, const uint8_t *src, int n, int swap)
+{
+	uint8x16x3_t in;
+	uint8x16x4_t out;
+
+	out.val[3] = vdupq_n_u8(0);
+	for(;n>=16;n-=16,src+=48,dst+=64)
+	{
+		in = vld3q_u8(src);
+		out.val[0] = (swap ? in.val[2] : in.val[0]);
+		out.val[1] = in.val[1];
+		out.val[2] = (swap ? in.val[0] : in.val[2]);
+		vst4q_u8(dst,out);
+	}
+	rgb24_c(dst,src,n,swap);
+}
+
+static void rgb32_neon(uint8_t *dst, const uint8_t *src, int n, int swap)
+{
+	uint8x16x4_t in,out;
+
+	out.val[3] = vdupq_n_u8(0);
+	for(;n>=16;n-=16,src+=64,dst+=64)
+	{
+		in = vld4q_u8(src);
+		out.val[0] = (swap ? in.val[2] : in.val[0]);
+		out.val[1] = in.val[1];
+		out.val[2] = (swap ? in.val[0] : in.val[2]);
+		vst4q_u8(dst,out);
+	}
+	rgb32_c(dst,src,n,swap);
+}
+
+#endif /* BMP_NEON */
+
+#ifdef BMP_X86
+
+/* pshufb masks that spread 4 packed pixels on 4 words, -1 clears the byte.
+ * [swap][pixels start at byte 0 or 4 of the vector]
+ */
+static const int8_t shuffle24[2][2][16] =
+{
+	{
+		{ 0, 1, 2,-1, 3, 4, 5,-1, 6, 7, 8,-1, 9,10,11,-1 },
+		{ 4, 5, 6,-1, 7, 8, 9,-1,10,11,12,-1,13,14,15,-1 }
+	},
+	{
+		{ 2, 1, 0,-1, 5, 4, 3,-1, 8, 7, 6,-1,11,10, 9,-1 },
+		{ 6, 5, 4,-1, 9, 8, 7,-1,12,11,10,-1,15,14,13,-1 }
+	}
+};
+
+static const int8_t shuffle32[2][16] =
+{
+	{ 0, 1, 2,-1, 4, 5, 6,-1, 8, 9,10,-1,12,13,14,-1 },
+	{ 2, 1, 0,-1, 6, 5, 4,-1,10, 9, 8,-1,14,13,12,-1 }
+};
+
+/* 16 pixels ( 48 bytes ) at a time.
+ * the last load starts at byte 32, not 36, so we never read past them.
+ */
+__attribute__((target("ssse3")))
+static void rgb24_ssse3(uint8_t *dst, const uint8_t *src, int n, int swap)
+{
+	__m128i first,last;
+
+	first = _mm_loadu_si128((const __m128i *)shuffle24[swap != 0][0]);
+	last = _mm_loadu_si128((const __m128i *)shuffle24[swap != 0][1]);
+	for(;n>=16;n-=16,src+=48,dst+=64)
+	{
+		_mm_storeu_si128((__m128i *)dst,_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src),first));
+		_mm_storeu_si128((__m128i *)(dst + 16),_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 12)),first));
+		_mm_storeu_si128((__m128i *)(dst + 32),_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 24)),first));
+		_mm_storeu_si128((__m128i *)(dst + 48),_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 32)),last));
+	}
+	rgb24_c(dst,src,n,swap);
+}
+
+__attribute__((target("ssse3")))
+static void rgb32_ssse3(uint8_t *dst, const uint8_t *src, int n, int swap)
+{
+	__m128i mask;
+
+	mask = _mm_loadu_si128((const __m128i *)shuffle32[swap != 0]);
+	for(;n>=4;n-=4,src+=16,dst+=16)
+		_mm_storeu_si128((__m128i *)dst,_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src),mask));
+	rgb32_c(dst,src,n,swap);
+}
+
+static int has_ssse3(void)
+{
+	unsigned int a,b,c,d;
+
+	return __get_cpuid(1,&a,&b,&c,&d) && (c & bit_SSSE3);
+}
+
+#endif /* BMP_X86 */
+
+static int always(void)
+{
+	return 1;
+}
+
+struct bmp_backend
+{
+	const char *name;
+	int (*available)(void);
+	// n pixels from the file to ORDER_BGRX or ORDER_RGBX ( swap )
+	void (*rgb24)(uint8_t *, const uint8_t *, int, int);
+	void (*rgb32)(uint8_t *, const uint8_t *, int, int);
+};
+
+// the fastest first, "c" must be the last one
+static const struct bmp_backend backends[] =
+{
+#ifdef BMP_NEON
+	{ "neon", always, rgb24_neon, rgb32_neon },
+#endif
+#ifdef BMP_X86
+	{ "ssse3", has_ssse3, rgb24_ssse3, rgb32_ssse3 },
+#endif
+	{ "c", always, rgb24_c, rgb32_c }
+};
+
+#define BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+static const struct bmp_backend *backend = NULL;
+
+static const struct bmp_backend *select_backend(void)
+{
+	const struct bmp_backend *b;
+
+	for(b=backends;!b->available();b++);
+	return b;
+}
+
+/* the name of the backend in use */
+const char *bmp_backend(void)
+{
+	if(!backend)
+		backend = select_backend();
+	return backend->name;
+}
+
+/* force a backend, returns -1 if the cpu cannot run it */
+int bmp_set_backend(const char *name)
+{
+	unsigned int i;
+
+	for(i=0;i<BACKENDS;i++)
+		if(!strcmp(backends[i].name,name) && backends[i].available())
+		{
+			backend = backends + i;
+			return 0;
+		}
+	return -1;
+}
+
+static int fb_order(const struct fb_var_screeninfo *v)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	if(v->bits_per_pixel != 32 || v->red.length != 8 || v->green.length != 8 ||
+		v->blue.length != 8 || v->green.offset != 8)
+		return ORDER_OTHER;
+	if(v->red.offset == 16 && v->blue.offset == 0)
+		return ORDER_BGRX;
+	if(v->red.offset == 0 && v->blue.offset == 16)
+		return ORDER_RGBX;
+#endif
+	return ORDER_OTHER;
+}
+
+// a channel read with mask i, scaled to 8 bits
+static uint32_t expand(const bmp *b, uint32_t pixel, int i)
+{
+	uint32_t c = (pixel & b->masks[i]) >> b->shifts[i];
+
+	if(b->bits[i] >= 8)
+		return c >> (b->bits[i] - 8);
+	return c * 255 / ((1U << b->bits[i]) - 1);
+}
+
+static void generic_row(const bmp *b, const struct fb_var_screeninfo *v, uint8_t *dst, const uint8_t *src, int n)
+{
+	uint32_t pixel,r,g,bl;
+	uint16_t half;
+	int bytes = b->depth / 8;
+
+	for(;n>0;n--,src+=bytes)
+	{
+		if(b->depth == 24)
+		{
+			r = src[2];
+			g = src[1];
+			bl = src[0];
+		}
+		else
+		{
+			pixel = (b->depth == 16 ? le16(src) : le32(src));
+			r = expand(b,pixel,0);
+			g = expand(b,pixel,1);
+			bl = expand(b,pixel,2);
+		}
+		pixel = channel(r,&(v->red)) | channel(g,&(v->green)) | channel(bl,&(v->blue));
+		switch(v->bits_per_pixel)
+		{
+			case 32:
+				memcpy(dst,&pixel,4);
+				dst += 4;
+				break;
+			case 24:
+				dst[0] = pixel;
+				dst[1] = pixel >> 8;
+				dst[2] = pixel >> 16;
+				dst += 3;
+				break;
+			case 16:
+				half = pixel;
+				memcpy(dst,&half,2);
+				dst += 2;
+				break;
+			default:
+				return;
+		}
+	}
+}
+
+/** convert a row of b to the format described by v
+ * @dst: where the first pixel goes
+ * @row: in file order, 0 is the bottom one unless b->top_down
+ * @width: pixels to convert, at most b->width
+ */
+void bmp_convert_row(const bmp *b, const struct fb_var_screeninfo *v, uint8_t *dst, int row, int width)
+{
+	const uint8_t *src = b->pixels + b->stride * row;
+	int order = fb_order(v);
+
+	if(!backend)
+		backend = select_backend();
+	if(width > b->width)
+		width = b->width;
+	if(order != ORDER_OTHER && b->depth == 24)
+		backend->rgb24(dst,src,width,order == ORDER_RGBX);
+	else if(order != ORDER_OTHER && b->depth == 32 &&
+		b->masks[0] == 0xFF0000 && b->masks[1] == 0x00FF00 && b->masks[2] == 0x0000FF)
+		backend->rgb32(dst,src,width,order == ORDER_RGBX);
+	else
+		generic_row(b,v,dst,src,width);
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <time.h>
+
+#define TEST_FILE "/tmp/bmp_test.bmp"
+
+// a made up picture, so every pixel is different
+static void test_color(int x, int y, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+	*r = x * 7 + y;
+	*g = x ^ (y * 3);
+	*b = (x + y) * 5;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/* write a width x height picture as a depth bits BMP
+ * @bitfields: use BI_BITFIELDS with 565 ( 16 bits ) or BGRX ( 32 bits ) masks
+ */
+static int write_test_bmp(int width, int height, int depth, int top_down, int bitfields)
+{
+	uint8_t header[66],*row,r,g,b;
+	size_t stride;
+	uint32_t pixel;
+	int x,y,line,hsize;
+	FILE *fp;
+
+	stride = ((depth * width + 31) / 32) * 4;
+	hsize = (bitfields ? 66 : 54);
+	memset(header,0,sizeof(header));
+	header[0] = 'B';
+	header[1] = 'M';
+	put32(header + 2,hsize + stride * height);
+	put32(header + 10,hsize);
+	put32(header + 14,40);
+	put32(header + 18,width);
+	put32(header + 22,top_down ? -height : height);
+	header[26] = 1;
+	header[28] = depth;
+	put32(header + 30,bitfields ? BI_BITFIELDS : BI_RGB);
+	if(bitfields && depth == 16)
+	{
+		put32(header + 54,0xF800);
+		put32(header + 58,0x07E0);
+		put32(header + 62,0x001F);
+	}
+	else if(bitfields)
+	{
+		put32(header + 54,0xFF0000);
+		put32(header + 58,0x00FF00);
+		put32(header + 62,0x0000FF);
+	}
+	if(!(fp = fopen(TEST_FILE,"w")) || !(row = calloc(1,stride)))
+		return -1;
+	fwrite(header,hsize,1,fp);
+	for(line=0;line<height;line++)
+	{
+		y = (top_down ? line : height - 1 - line);
+		for(x=0;x<width;x++)
+		{
+			test_color(x,y,&r,&g,&b);
+			if(depth == 24)
+			{
+				row[x*3] = b;
+				row[x*3+1] = g;
+				row[x*3+2] = r;
+			}
+			else if(depth == 32)
+				put32(row + x*4,(r << 16) | (g << 8) | b | 0xAA000000); // junk in the unused byte
+			else
+			{
+				if(bitfields)
+					pixel = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+				else
+					pixel = ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+				row[x*2] = pixel;
+				row[x*2+1] = pixel >> 8;
+			}
+		}
+		fwrite(row,stride,1,fp);
+	}
+	free(row);
+	return fclose(fp);
+}
+
+static void set_format(struct fb_var_screeninfo *v, int bpp, int roff, int rlen, int goff, int glen, int boff, int blen)
+{
+	memset(v,0,sizeof(*v));
+	v->bits_per_pixel = bpp;
+	v->red.offset = roff;
+	v->red.length = rlen;
+	v->green.offset = goff;
+	v->green.length = glen;
+	v->blue.offset = boff;
+	v->blue.length = blen;
+}
+
+// draw TEST_FILE top side up in dst
+static int draw(const struct fb_var_screeninfo *v, uint8_t *dst, size_t line_length, int *width, int *height)
+{
+	bmp b;
+	int row,y;
+
+	if(bmp_open(TEST_FILE,&b))
+		return -1;
+	for(row=0;row<b.height;row++)
+	{
+		y = (b.top_down ? row : b.height - 1 - row);
+		bmp_convert_row(&b,v,dst + y * line_length,row,b.width);
+	}
+	*width = b.width;
+	*height = b.height;
+	bmp_close(&b);
+	return 0;
+}
+
+// what a channel becomes when stored with less bits
+static uint8_t quantize(uint8_t c, int bits)
+{
+	return (c >> (8 - bits)) * 255 / ((1 << bits) - 1);
+}
+
+/* check the picture drawn from a file
+ * @rgb565: it was a 16 bits file with 565 masks
+ */
+static int check_picture(const struct fb_var_screeninfo *v, const uint8_t *dst, size_t line_length,
+	int width, int height, int depth, int rgb565)
+{
+	uint32_t pixel,want;
+	uint8_t r,g,b;
+	int x,y;
+
+	for(y=0;y<height;y++)
+		for(x=0;x<width;x++)
+		{
+			test_color(x,y,&r,&g,&b);
+			if(depth == 16)
+			{
+				r = quantize(r,5);
+				g = quantize(g,rgb565 ? 6 : 5);
+				b = quantize(b,5);
+			}
+			want = channel(r,&(v->red)) | channel(g,&(v->green)) | channel(b,&(v->blue));
+			pixel = 0;
+			memcpy(&pixel,dst + y * line_length + x * (v->bits_per_pixel / 8),v->bits_per_pixel / 8);
+			if(pixel != want)
+			{
+				printf("pixel %d,%d is %08x instead of %08x\n",x,y,pixel,want);
+				return -1;
+			}
+		}
+	return 0;
+}
+
+int main(void)
+{
+	struct fb_var_screeninfo formats[4];
+	const char *names[] = { "bgrx", "rgbx", "rgb565", "bgr24" };
+	// odd sizes, so the tails and the padding get tested too
+	int sizes[][2] = { { 1, 1 }, { 15, 3 }, { 16, 2 }, { 37, 5 }, { 1280, 4 } };
+	uint8_t *screen;
+	size_t line_length;
+	int i,f,s,depth,top_down,width,height,failed;
+	unsigned int k;
+	clock_t start;
+	bmp b;
+
+	set_format(formats,32,16,8,8,8,0,8);
+	set_format(formats + 1,32,0,8,8,8,16,8);
+	set_format(formats + 2,16,11,5,5,6,0,5);
+	set_format(formats + 3,24,16,8,8,8,0,8);
+	line_length = 1280 * 4;
+	screen = malloc(line_length * 800);
+	failed = 0;
+
+	for(k=0;k<BACKENDS;k++)
+	{
+		if(!backends[k].available())
+		{
+			printf("%s: not supported by this cpu\n",backends[k].name);
+			continue;
+		}
+		backend = backends + k;
+		for(s=0;s<5;s++)
+			for(depth=16;depth<=32;depth+=8)
+				for(top_down=0;top_down<2;top_down++)
+					for(i=0;i<(depth == 24 ? 1 : 2);i++)
+						for(f=0;f<4;f++)
+						{
+							if(write_test_bmp(sizes[s][0],sizes[s][1],depth,top_down,i))
+							{
+								perror(TEST_FILE);
+								return EXIT_FAILURE;
+							}
+							memset(screen,0,line_length * sizes[s][1]);
+							if(draw(formats + f,screen,line_length,&width,&height))
+							{
+								printf("%s: cannot read a %dx%d %d bits BMP\n",backend->name,sizes[s][0],sizes[s][1],depth);
+								failed = 1;
+								continue;
+							}
+							if(check_picture(formats + f,screen,line_length,width,height,depth,i))
+							{
+								printf("%s: %dx%d %d bits %s%s to %s is wrong\n",backend->name,width,height,depth,
+									top_down ? "top-down " : "",i ? "bitfields" : "rgb",names[f]);
+								failed = 1;
+							}
+						}
+		printf("%s: %s\n",backend->name,failed ? "FAILED" : "passed");
+	}
+
+	// how long a 1280x800 background takes
+	write_test_bmp(1280,800,24,0,0);
+	bmp_open(TEST_FILE,&b);
+	for(k=0;k<BACKENDS;k++)
+	{
+		if(!backends[k].available())
+			continue;
+		backend = backends + k;
+		for(f=0;f<2;f++)
+		{
+			start = clock();
+			for(i=0;i<20;i++)
+				for(s=0;s<b.height;s++)
+					bmp_convert_row(&b,formats + f,screen + s * line_length,s,b.width);
+			printf("%s: 1280x800 24 bits to %s in %.2f ms\n",backend->name,names[f],
+				(double)(clock() - start) * 1000 / CLOCKS_PER_SEC / 20);
+		}
+	}
+	backend = backends + BACKENDS - 1;
+	start = clock();
+	for(i=0;i<20;i++)
+		for(s=0;s<b.height;s++)
+			generic_row(&b,formats,screen + s * line_length,b.pixels + b.stride * s,b.width);
+	printf("per pixel: 1280x800 24 bits to bgrx in %.2f ms\n",(double)(clock() - start) * 1000 / CLOCKS_PER_SEC / 20);
+	bmp_close(&b);
+	unlink(TEST_FILE);
+	free(screen);
+	return (failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+#endif /* TEST */
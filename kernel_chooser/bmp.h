@@ -0,0 +1,44 @@
+#ifndef _BMP_H
+#define _BMP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <linux/fb.h>
+
+// compression methods we can read
+#define BI_RGB       0
+#define BI_BITFIELDS 3
+
+// a BMP file mapped in memory
+typedef struct _bmp
+{
+	uint8_t *map;
+	size_t size;
+	int width,
+			height, // always positive, see top_down
+			depth, // 16, 24 or 32 bits per pixel
+			top_down; // the first row in the file is the top one
+	size_t stride; // bytes from a row to the next one, with the padding
+	uint8_t *pixels; // the first row in the file
+	// red, green and blue for 16 and 32 bits
+	uint32_t masks[3];
+	int shifts[3],
+			bits[3];
+} bmp;
+
+// an 8 bits channel in the framebuffer field f
+static inline uint32_t channel(uint32_t c, const struct fb_bitfield *f)
+{
+	if(f->length >= 8)
+		return c << (f->offset + f->length - 8);
+	return (c >> (8 - f->length)) << f->offset;
+}
+
+int bmp_open(const char *, bmp *);
+void bmp_close(bmp *);
+void bmp_pixels(bmp *, uint8_t *, int, int, size_t);
+void bmp_convert_row(const bmp *, const struct fb_var_screeninfo *, uint8_t *, int, int);
+const char *bmp_backend(void);
+int bmp_set_backend(const char *);
+
+#endif
@@ -1,3 +1,5 @@
+#include <stdint.h>
+
 /* taken from http://www.termsys.demon.co.uk/vtansi.htm */
 #define VT_RESET			0
 #define VT_BRIGHT			1
@@ -34,6 +36,7 @@
 #define COLOR_MENU_TEXT 5
 #define COLOR_MENU_TITLE 6
 #define COLOR_POPUP 7
+#define COLOR_MENU_CURRENT 8
 
 // print helpers
 #define FATAL(x,args...)	{nc_error(x,##args);fatal_error=1;}
@@ -51,6 +54,9 @@
 #define MAX_LINE 255
 #define COMMAND_LINE_SIZE    1024
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+#ifndef TIMEOUT_BOOT_MS
+#define TIMEOUT_BOOT_MS 10000 /* time to wait for the user to press a key, see BOOT_TIMEOUT in the Makefile */
+#endif
 
 extern int fatal_error;
 
@@ -60,7 +66,12 @@ void nc_error(char *,...);
 void nc_status(char *);
 
 /* from fbGUI.c */
-void fb_init(void);
+int fb_init(void);
 void fb_destroy(void);
+void fb_load_background(void);
 void fb_background(void);
-void fb_crefresh(int,int,int,int);
\ No newline at end of file
+void fb_redraw(void);
+void fb_flush(void);
+void fb_release(void);
+void fb_size(int *, int *);
+void fb_draw_glyph(int,int,int,int,const uint8_t *,uint32_t,uint32_t,int);
@@ -0,0 +1,207 @@
+/* the main loop: everything kernel_chooser waits for is a file descriptor.
+ * the keys, the countdown, the kernel uevents, the threads that load
+ * the kernel and our children all wake up the same epoll_wait,
+ * so nothing has to sleep or poll while the others are waiting.
+ * timers are timerfds, threads tell us they have finished with an eventfd
+ * and signals come from a signalfd.
+ */
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+
+#include "events.h"
+
+static int epfd = -1;
+// the signals that ev_signals reads, blocked everywhere but in our children
+static sigset_t blocked;
+static sigset_t unblocked; // the mask we had before
+
+// children don't know about our signalfd, give them the signals back
+static void child_unblock(void)
+{
+	sigprocmask(SIG_SETMASK,&unblocked,NULL);
+}
+
+/** deliver sig only to ev_signals
+ * NOTE: call it before starting any thread, they take our mask
+ */
+void ev_block(int sig)
+{
+	static int atfork;
+
+	if(!atfork)
+	{
+		pthread_sigmask(SIG_BLOCK,NULL,&unblocked);
+		sigemptyset(&blocked);
+		pthread_atfork(NULL,NULL,child_unblock);
+		atfork = 1;
+	}
+	sigaddset(&blocked,sig);
+	pthread_sigmask(SIG_BLOCK,&blocked,NULL);
+}
+
+/** create the epoll instance
+ * returns 0 on success, -1 on error.
+ */
+int ev_init(void)
+{
+	if(epfd >= 0)
+		return 0;
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	return (epfd < 0 ? -1 : 0);
+}
+
+/** watch s->fd, s->handler is called when it's readable
+ * returns 0 on success, -1 on error.
+ */
+int ev_add(ev_source *s)
+{
+	struct epoll_event e;
+
+	memset(&e,0,sizeof(e));
+	e.events = EPOLLIN;
+	e.data.ptr = s;
+	if(!epoll_ctl(epfd,EPOLL_CTL_ADD,s->fd,&e))
+		return 0;
+	// already there
+	if(errno == EEXIST && !epoll_ctl(epfd,EPOLL_CTL_MOD,s->fd,&e))
+		return 0;
+	return -1;
+}
+
+/** stop watching s and close it */
+void ev_del(ev_source *s)
+{
+	if(s->fd < 0)
+		return;
+	epoll_ctl(epfd,EPOLL_CTL_DEL,s->fd,NULL);
+	close(s->fd);
+	s->fd = -1;
+}
+
+/** wait for the sources and call the handlers of the ready ones
+ * @timeout: milliseconds, -1 to wait forever
+ * returns how many handlers have been called, -1 on error.
+ */
+int ev_wait(int timeout)
+{
+	struct epoll_event events[EV_BATCH];
+	ev_source *s;
+	int i,n;
+
+	if((n = epoll_wait(epfd,events,EV_BATCH,timeout)) < 0)
+		return (errno == EINTR ? 0 : -1);
+	for(i=0;i<n;i++)
+	{
+		s = events[i].data.ptr;
+		// a handler before this one can have closed it
+		if(s->fd >= 0)
+			s->handler(s,events[i].events);
+	}
+	return n;
+}
+
+/** arm a timer, the timerfd is made and watched the first time
+ * @first: milliseconds until it fires, 0 stops it
+ * @interval: milliseconds between the next ones, 0 to fire once
+ * returns 0 on success, -1 on error.
+ */
+int ev_timer(ev_source *s, int first, int interval)
+{
+	struct itimerspec its;
+
+	if(s->fd < 0)
+	{
+		if(!first)
+			return 0;
+		if((s->fd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK|TFD_CLOEXEC)) < 0)
+			return -1;
+		if(ev_add(s))
+		{
+			close(s->fd);
+			s->fd = -1;
+			return -1;
+		}
+	}
+	its.it_value.tv_sec = first / 1000;
+	its.it_value.tv_nsec = (first % 1000) * 1000000L;
+	its.it_interval.tv_sec = interval / 1000;
+	its.it_interval.tv_nsec = (interval % 1000) * 1000000L;
+	if(timerfd_settime(s->fd,0,&its,NULL))
+		return -1;
+	// what fired before it was stopped doesn't count
+	if(!first)
+		ev_read(s);
+	return 0;
+}
+
+/** make s something other threads can wake up with ev_notify
+ * returns 0 on success, -1 on error.
+ */
+int ev_notifier(ev_source *s)
+{
+	if((s->fd = eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC)) < 0)
+		return -1;
+	if(ev_add(s))
+	{
+		close(s->fd);
+		s->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/** wake up the main loop, it can be called from any thread
+ * returns 0 on success, -1 on error.
+ */
+int ev_notify(ev_source *s)
+{
+	uint64_t one = 1;
+
+	return (write(s->fd,&one,sizeof(one)) == sizeof(one) ? 0 : -1);
+}
+
+/** make s receive the signals given to ev_block
+ * returns 0 on success, -1 on error.
+ */
+int ev_signals(ev_source *s)
+{
+	if((s->fd = signalfd(-1,&blocked,SFD_NONBLOCK|SFD_CLOEXEC)) < 0)
+		return -1;
+	if(ev_add(s))
+	{
+		close(s->fd);
+		s->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/** consume what s has for us
+ * returns how many times a timer fired, the sum of the ev_notify calls,
+ * how many signals came. 0 if there was nothing.
+ */
+uint64_t ev_read(ev_source *s)
+{
+	struct signalfd_siginfo si[4];
+	uint64_t n;
+	ssize_t len;
+
+	if(s->fd < 0)
+		return 0;
+	// a signalfd gives whole signalfd_siginfo, not counters
+	len = read(s->fd,si,sizeof(si));
+	if(len <= 0)
+		return 0;
+	if(len % sizeof(si[0]))
+	{
+		memcpy(&n,si,sizeof(n));
+		return n;
+	}
+	return len / sizeof(si[0]);
+}
@@ -0,0 +1,31 @@
+#ifndef _EVENTS_H
+#define _EVENTS_H
+
+#include <stdint.h>
+#include <signal.h>
+
+// how many ready sources ev_wait handles at once
+#define EV_BATCH 8
+
+/* something the main loop waits for, a file descriptor
+ * and the function that handles it when it's ready.
+ */
+typedef struct _ev_source
+{
+	int fd; // -1 if it's not watched
+	void (*handler)(struct _ev_source *, uint32_t); // gets the epoll events
+	void *arg;
+} ev_source;
+
+void ev_block(int);
+int ev_init(void);
+int ev_add(ev_source *);
+void ev_del(ev_source *);
+int ev_wait(int);
+int ev_timer(ev_source *, int, int);
+int ev_notifier(ev_source *);
+int ev_notify(ev_source *);
+int ev_signals(ev_source *);
+uint64_t ev_read(ev_source *);
+
+#endif
@@ -8,175 +8,599 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "common.h"
 #include "fbGUI.h"
+#include "bmp.h"
+#include "bgcache.h"
 
-long int screensize; // number of bytes in the screen pointer
+long int screensize; // number of bytes in a page ( what the screen shows )
+long int mapsize; // bytes mapped from the device, all the pages in yres_virtual
 fb_info fbinfo; // framebuffer information
 uint8_t *bkgdp; // pointer to a copy of the screen containing the background
 
-void fb_init()
+/* the background can be loaded by a startup task while
+ * the UI is coming up, this protects fbinfo and bkgdp until then.
+ * NOTE: never call FATAL with it held, nc_ui would wait for us.
+ */
+static pthread_mutex_t fb_lock = PTHREAD_MUTEX_INITIALIZER;
+static int fb_state; // 0: not tried yet, 1: mapped, -1: failed
+static int bkgd_tried;
+
+struct fb_rect
 {
-		fbinfo.fbfd = open(FBDEV, O_RDWR);
-		if (fbinfo.fbfd < 0) {
-			FATAL("cannot open framebuffer device (%s)\n", FBDEV);
-		}
-		if (ioctl(fbinfo.fbfd, FBIOGET_FSCREENINFO, &fbinfo.finfo)) {
-			FATAL("cannot get screen info\n");
-		}
-		if (ioctl(fbinfo.fbfd, FBIOGET_VSCREENINFO, &fbinfo.vinfo)) {
-			FATAL("cannot get variable screen info\n");
+	int x1,y1,x2,y2; // x2 and y2 are excluded
+};
+
+/* the regions to compose at the next fb_flush, in pixels.
+ * they never overlap, touching ones are merged.
+ */
+static struct fb_rect dirty[MAX_DIRTY];
+static int dirty_count;
+// what changed in the previous frame, the hidden page misses it ( FB_FLIP )
+static struct fb_rect last[MAX_DIRTY];
+static int last_count;
+static uint8_t *frame; // the composed screen, in memory
+// 32 bit pixels with 8 bit red, green and blue, see blend32
+static int fast_blend;
+
+/* fbcon draws in the page it shows when we start, the text page.
+ * pages[] are the other ones we can pan to, see FB_FLIP.
+ */
+static int fb_mode, text_y, page_y[2], shown, vsync;
+static uint8_t *text_page, *pages[2];
+
+/** look for pages that don't overlap the text page in yres_virtual */
+static void setup_pages(void)
+{
+	int bpp,y,count;
+
+	bpp = fbinfo.vinfo.bits_per_pixel/8;
+	text_y = fbinfo.vinfo.yoffset;
+	text_page = fbinfo.fbp + text_y*fbinfo.finfo.line_length + fbinfo.vinfo.xoffset*bpp;
+	shown = -1; // the text page
+	vsync = 1;
+	count = 0;
+	// without ypanstep the driver cannot pan
+	for(y=0;fbinfo.finfo.ypanstep && count < 2 &&
+		(y + fbinfo.vinfo.yres)*(long)fbinfo.finfo.line_length <= mapsize;y+=fbinfo.vinfo.yres)
+		if(!(y % fbinfo.finfo.ypanstep) && (y + fbinfo.vinfo.yres <= text_y || y >= text_y + fbinfo.vinfo.yres))
+		{
+			page_y[count] = y;
+			pages[count++] = fbinfo.fbp + y*fbinfo.finfo.line_length + fbinfo.vinfo.xoffset*bpp;
 		}
+	fb_mode = (count == 2 ? FB_FLIP : count == 1 ? FB_OVERLAY : FB_DIRECT);
+	DEBUG("framebuffer: %dx%d, %d pages, mode %d\n",fbinfo.vinfo.xres,fbinfo.vinfo.yres,count + 1,fb_mode);
+}
+
+static void wait_vsync(void)
+{
+	__u32 crtc = 0;
 
-		screensize = fbinfo.vinfo.xres * fbinfo.vinfo.yres * fbinfo.vinfo.bits_per_pixel / 8;
+	// not every driver has it, don't ask again
+	if(vsync && ioctl(fbinfo.fbfd, FBIO_WAITFORVSYNC, &crtc))
+		vsync = 0;
+}
+
+/** pan to page, -1 is the text page
+ * returns 0 on success, -1 on error.
+ */
+static int show_page(int page)
+{
+	struct fb_var_screeninfo var;
 
-		// map the device to memory
-		fbinfo.fbp = (uint8_t  *)mmap(0, screensize, PROT_READ | PROT_WRITE, MAP_SHARED, fbinfo.fbfd, 0);
-        if ((int)fbinfo.fbp == -1) {
-        	FATAL("failed to map framebuffer device to memory\n");
+	var = fbinfo.vinfo;
+	var.yoffset = (page < 0 ? text_y : page_y[page]);
+	wait_vsync();
+	if(ioctl(fbinfo.fbfd, FBIOPAN_DISPLAY, &var))
+		return -1;
+	shown = page;
+	return 0;
+}
+
+/** open and map the framebuffer, only the first time we are called
+ * returns 0 on success, -1 on error.
+ */
+int fb_init()
+{
+	int ret;
+
+	pthread_mutex_lock(&fb_lock);
+	if(!fb_state)
+	{
+		fb_state = -1;
+		fbinfo.fbfd = open(FBDEV, O_RDWR|O_CLOEXEC);
+		if (fbinfo.fbfd < 0)
+			ERROR("cannot open framebuffer device (%s)\n", FBDEV);
+		else if (ioctl(fbinfo.fbfd, FBIOGET_FSCREENINFO, &fbinfo.finfo))
+			ERROR("cannot get screen info\n");
+		else if (ioctl(fbinfo.fbfd, FBIOGET_VSCREENINFO, &fbinfo.vinfo))
+			ERROR("cannot get variable screen info\n");
+		else
+		{
+			screensize = fbinfo.finfo.line_length * fbinfo.vinfo.yres;
+			mapsize = fbinfo.finfo.line_length * fbinfo.vinfo.yres_virtual;
+			if(fbinfo.finfo.smem_len && mapsize > fbinfo.finfo.smem_len)
+				mapsize = fbinfo.finfo.smem_len;
+
+			// map the device to memory, all of it: we pan between its pages
+			fbinfo.fbp = (uint8_t  *)mmap(0, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fbinfo.fbfd, 0);
+			if (fbinfo.fbp == MAP_FAILED)
+			{
+				ERROR("failed to map framebuffer device to memory\n");
+				fbinfo.fbp = NULL;
+			}
+			else if((fbinfo.vinfo.yoffset + fbinfo.vinfo.yres) * (long)fbinfo.finfo.line_length > mapsize)
+			{
+				ERROR("the screen is out of the framebuffer memory\n");
+				munmap(fbinfo.fbp, mapsize);
+				fbinfo.fbp = NULL;
+			}
+			else if(!(frame = malloc(screensize)))
+			{
+				ERROR("malloc - %s\n",strerror(errno));
+				munmap(fbinfo.fbp, mapsize);
+				fbinfo.fbp = NULL;
+			}
+			else
+			{
+				setup_pages();
+				fast_blend = (fbinfo.vinfo.bits_per_pixel == 32 && fbinfo.vinfo.green.offset == 8 &&
+					fbinfo.vinfo.red.length == 8 && fbinfo.vinfo.green.length == 8 && fbinfo.vinfo.blue.length == 8 &&
+					fbinfo.vinfo.red.offset + fbinfo.vinfo.blue.offset == 16 && !(fbinfo.vinfo.red.offset % 16));
+				fb_state = 1;
+			}
 		}
+		if(fb_state < 0 && fbinfo.fbfd >= 0)
+			close(fbinfo.fbfd);
+	}
+	ret = (fb_state > 0 ? 0 : -1);
+	pthread_mutex_unlock(&fb_lock);
+	return ret;
 }
 
 void fb_destroy()
 {
-	munmap(fbinfo.fbp, screensize);
-	close(fbinfo.fbfd);
+	if(fb_state > 0)
+	{
+		// give the screen back to fbcon
+		if(shown >= 0)
+			show_page(-1);
+		munmap(fbinfo.fbp, mapsize);
+		close(fbinfo.fbfd);
+		free(frame);
+	}
 	if(bkgdp)
 		free(bkgdp);
 }
 
-void fb_background()
+/** a picture that is not as big as the screen goes through 0xXXRRGGBB pixels,
+ * to be scaled.
+ * @image: the picture
+ * @bg: a screen copy
+ * returns 0 on success, -1 on error.
+ */
+static int scale_background(const bmp *image, uint8_t *bg)
 {
-	int fd, start, rowsize;
-	int width, height, depth, x, y;
-	uint8_t *dest,*source;
-	pixel *pos;
-	struct stat bg_stat;
+	struct fb_var_screeninfo xrgb;
+	uint8_t *pixels;
+	int row,y,ret;
 
-	if((fd = open(BACKGROUND,O_RDONLY)) < 0)
+	if(!(pixels = malloc((size_t)image->width * image->height * 4)))
 	{
-		//only a warning, default to black background when not found
-		WARN("cannot open \"%s\" - %s\n",BACKGROUND,strerror(errno));
-		return;
+		ERROR("malloc - %s\n",strerror(errno));
+		return -1;
 	}
-	fstat(fd,&bg_stat); // this will not fail ( open succeded )
-	if(!(source = malloc(bg_stat.st_size)))
+	bg_xrgb_format(&xrgb,image->width,image->height);
+	for(row=0;row<image->height;row++)
 	{
-		FATAL("malloc - %s\n",strerror(errno));
-		return;
+		y = (image->top_down ? row : image->height - 1 - row);
+		bmp_convert_row(image,&xrgb,pixels + (size_t)y*image->width*4,row,image->width);
 	}
-	start = read(fd,source,bg_stat.st_size); // read it once! ( we need to optimize disk access )
-	close(fd);
-	memcpy(&start,(source + 10),4);
-	memcpy(&width,(source + 18),4);
-	memcpy(&height,(source + 22),4);
-	memcpy(&depth,(source + 28),2);
+	ret = bg_from_xrgb(pixels,image->width,image->height,image->width*4,&fbinfo.vinfo,fbinfo.finfo.line_length,bg);
+	if(ret)
+		ERROR("cannot scale \"%s\" - %s\n",BACKGROUND,strerror(errno));
+	free(pixels);
+	return ret;
+}
 
+/** decode the BMP in BACKGROUND
+ * @bg: a screen copy
+ * @screen: if not NULL the rows are copied there too, if we don't have to scale them
+ * returns 1 if the background has been drawn on screen, 0 if not, -1 on error.
+ */
+static int decode_background(uint8_t *bg, uint8_t *screen)
+{
+	bmp image;
+	int bpp, row, y, drawn;
+	long offset, rowsize;
 
-	//TODO: handle other formats
-	if (depth != BITMAP_DEPTH)
+	if(bmp_open(BACKGROUND,&image))
 	{
-		WARN("Background must be a %i bit .bmp file\n", BITMAP_DEPTH);
-		DEBUG("found a %d depth file\n",depth);
-		bkgdp = NULL; // this means that we don't have a background
-		//return; FIXME: on my background depth will be 196632, but without this check i can draw it fine.
+		//only a warning, default to black background when not found
+		if(errno == EINVAL)
+			WARN("\"%s\" must be an uncompressed 16, 24 or 32 bit .bmp file\n",BACKGROUND);
+		else
+			WARN("cannot open \"%s\" - %s\n",BACKGROUND,strerror(errno));
+		return -1;
 	}
-
-	rowsize = ((BITMAP_DEPTH*width+31)/32)*4; //round to multiple of 4
-	rowsize /= sizeof(pixel);
-	bkgdp = malloc (screensize);
-
-	if (!bkgdp)
+	DEBUG("background is %dx%d, %d bit\n",image.width,image.height,image.depth);
+	if(image.width != fbinfo.vinfo.xres || image.height != fbinfo.vinfo.yres)
 	{
-		FATAL("malloc - %s\n",strerror(errno));
-		free(source);
-		return;
+		drawn = scale_background(&image,bg);
+		bmp_close(&image);
+		return drawn;
+	}
+	bpp = fbinfo.vinfo.bits_per_pixel/8;
+	rowsize = image.width * bpp;
+	// walk the rows as they are in the file, the mapping is read sequentially
+	for(row=0;row<image.height;row++)
+	{
+		y = (image.top_down ? row : image.height - 1 - row);
+		offset = y*fbinfo.finfo.line_length;
+		if(offset + rowsize > screensize)
+			continue;
+		bmp_convert_row(&image,&fbinfo.vinfo,bg + offset,row,image.width);
+		// copy it on screen too, while it's hot in cache
+		if(screen)
+			memcpy(screen + offset,bg + offset,rowsize);
 	}
+	bmp_close(&image);
+	return (screen ? 1 : 0);
+}
 
+/** load the background into bkgdp, only the first time
+ * BACKGROUND is decoded and scaled once, then BACKGROUND_CACHE has it
+ * ready for this screen. without it we use DEFAULT_BACKGROUND,
+ * cached as well when it's not for this screen.
+ * @screen: if not NULL the rows of a decoded BMP are copied there too
+ * returns 1 if the background has been drawn on screen, 0 otherwise.
+ * NOTE: call it with fb_lock held
+ */
+static int load_background(uint8_t *screen)
+{
+	struct stat st;
+	int bpp, drawn, i;
+	uint8_t *bg;
 
-	dest = bkgdp + (fbinfo.vinfo.xoffset)*(fbinfo.vinfo.bits_per_pixel/8) + (fbinfo.vinfo.yoffset)*fbinfo.finfo.line_length;
-	pos = ((pixel *)(source + start)) + rowsize*height;
-	for (y=0; y<height; y++) {
-		for (x=0; x<width; x++) {
-			*dest = pos[x].r;
-			*(dest + 1) = pos[x].g;
-			*(dest + 2) = pos[x].b;
-			*(dest + 3) = 0; //alpha
-			dest += fbinfo.vinfo.bits_per_pixel/8; //4
+	if(bkgd_tried || fb_state <= 0)
+		return 0;
+	bkgd_tried = 1;
+	bpp = fbinfo.vinfo.bits_per_pixel/8;
+	if(bpp < 2 || bpp > 4)
+	{
+		WARN("cannot draw a background on a %d bit framebuffer\n",fbinfo.vinfo.bits_per_pixel);
+		return 0;
+	}
+	// bkgdp is published only when it's complete, what the picture doesn't cover is black
+	if(!(bg = calloc(1,screensize)))
+	{
+		ERROR("malloc - %s\n",strerror(errno));
+		return 0;
+	}
+	drawn = 0;
+	if(stat(BACKGROUND,&st))
+	{
+		if(errno != ENOENT)
+			WARN("cannot open \"%s\" - %s\n",BACKGROUND,strerror(errno));
+		// if it's not for this screen we converted it already
+		if(stat(DEFAULT_BACKGROUND,&st) ||
+			bg_load(BACKGROUND_CACHE,&st,&fbinfo.vinfo,fbinfo.finfo.line_length,bg) < 0)
+		{
+			i = bg_load(DEFAULT_BACKGROUND,NULL,&fbinfo.vinfo,fbinfo.finfo.line_length,bg);
+			if(i < 0)
+			{
+				WARN("cannot load \"%s\" - %s\n",DEFAULT_BACKGROUND,strerror(errno));
+				free(bg);
+				return 0;
+			}
+			if(i > 0 && bg_store(BACKGROUND_CACHE,&st,&fbinfo.vinfo,fbinfo.finfo.line_length,bg))
+				WARN("cannot write \"%s\" - %s\n",BACKGROUND_CACHE,strerror(errno));
 		}
-		pos -= rowsize;
 	}
-	free(source);
+	else if(bg_load(BACKGROUND_CACHE,&st,&fbinfo.vinfo,fbinfo.finfo.line_length,bg) < 0)
+	{
+		DEBUG("converting \"%s\" - %s\n",BACKGROUND,strerror(errno));
+		// a failed load can leave anything in it
+		memset(bg,0,screensize);
+		if((drawn = decode_background(bg,screen)) < 0)
+		{
+			free(bg);
+			return 0;
+		}
+		if(bg_store(BACKGROUND_CACHE,&st,&fbinfo.vinfo,fbinfo.finfo.line_length,bg))
+			WARN("cannot write \"%s\" - %s\n",BACKGROUND_CACHE,strerror(errno));
+	}
+	bkgdp = bg;
+	return drawn;
+}
 
-	memcpy(fbinfo.fbp, bkgdp, screensize); // copy the background to the screen
+/** load the background into bkgdp, only the first time we are called
+ * NOTE: fb_init must have succeeded
+ */
+void fb_load_background()
+{
+	pthread_mutex_lock(&fb_lock);
+	load_background(NULL);
+	pthread_mutex_unlock(&fb_lock);
 }
 
-pixel getpixel(uint8_t *src)
+/** everything on screen has to be shown again at the next fb_flush
+ * NOTE: we must hold nc_lock, or the UI is not up yet
+ */
+void fb_redraw(void)
 {
-	static pixel pix;
-	pix.r = *src;
-	pix.g = *(src + 1);
-	pix.b = *(src + 2);
-	return pix;
+	if(fb_state <= 0)
+		return;
+	fb_refresh(0, 0, fbinfo.vinfo.xres, fbinfo.vinfo.yres);
+	// somebody else may have drawn in the pages too
+	last[0] = dirty[0];
+	last_count = dirty_count;
 }
 
+/** start a new frame from the background, loading it if nobody did it yet.
+ * the first fb_flush shows it.
+ * NOTE: call it before the UI is up, it doesn't take nc_lock
+ */
+void fb_background()
+{
+	pthread_mutex_lock(&fb_lock);
+	if(fb_state > 0)
+	{
+		if(!load_background(frame))
+		{
+			if(bkgdp)
+				memcpy(frame, bkgdp, screensize);
+			else
+				memset(frame, 0, screensize);
+		}
+		dirty_count = 0;
+		fb_redraw();
+	}
+	pthread_mutex_unlock(&fb_lock);
+}
+
+/** mark a region of frame to be shown at the next fb_flush
+ * NOTE: we must hold nc_lock, like every nGUI drawing
+ */
 void fb_refresh(int x, int y, int w, int h)
 {
-	long int offset,area;
-	int bytes_per_pixel;
-	uint8_t *src,*dst,*pos,*send,*dend,*new_bg, black_pixel[] = {0,0,0,0};
+	int x2,y2,i;
 
-	// exit if we don't have a background
-	if(!bkgdp)
+	if(fb_state <= 0)
 		return;
+	x2 = x + w;
+	y2 = y + h;
+	if(x < 0)
+		x = 0;
+	if(y < 0)
+		y = 0;
+	if(x2 > fbinfo.vinfo.xres)
+		x2 = fbinfo.vinfo.xres;
+	if(y2 > fbinfo.vinfo.yres)
+		y2 = fbinfo.vinfo.yres;
+	if(x >= x2 || y >= y2)
+		return;
+	// swallow every region we touch, the bigger one can touch others
+	for(i=0;i<dirty_count;)
+		if(x <= dirty[i].x2 && dirty[i].x1 <= x2 && y <= dirty[i].y2 && dirty[i].y1 <= y2)
+		{
+			if(dirty[i].x1 < x)
+				x = dirty[i].x1;
+			if(dirty[i].y1 < y)
+				y = dirty[i].y1;
+			if(dirty[i].x2 > x2)
+				x2 = dirty[i].x2;
+			if(dirty[i].y2 > y2)
+				y2 = dirty[i].y2;
+			dirty[i] = dirty[--dirty_count];
+			i = 0;
+		}
+		else
+			i++;
+	// too many, one big region is still better than many passes
+	if(dirty_count == MAX_DIRTY)
+	{
+		for(i=0;i<dirty_count;i++)
+		{
+			if(dirty[i].x1 < x)
+				x = dirty[i].x1;
+			if(dirty[i].y1 < y)
+				y = dirty[i].y1;
+			if(dirty[i].x2 > x2)
+				x2 = dirty[i].x2;
+			if(dirty[i].y2 > y2)
+				y2 = dirty[i].y2;
+		}
+		dirty_count = 0;
+	}
+	dirty[dirty_count].x1 = x;
+	dirty[dirty_count].y1 = y;
+	dirty[dirty_count].x2 = x2;
+	dirty[dirty_count].y2 = y2;
+	dirty_count++;
+}
+
+// copy the regions in list from frame to page
+static void copy_regions(uint8_t *page, struct fb_rect *list, int count)
+{
+	long int offset,len;
+	int bytes_per_pixel,i,y;
 
 	bytes_per_pixel=(fbinfo.vinfo.bits_per_pixel/8);
+	for(i=0;i<count;i++)
+	{
+		len = (list[i].x2 - list[i].x1)*bytes_per_pixel;
+		offset = list[i].x1*bytes_per_pixel + list[i].y1*fbinfo.finfo.line_length;
+		// whole lines are one bulk copy
+		if(len == fbinfo.finfo.line_length)
+			memcpy(page + offset, frame + offset, len*(list[i].y2 - list[i].y1));
+		else
+			for(y=list[i].y1;y<list[i].y2;y++,offset+=fbinfo.finfo.line_length)
+				memcpy(page + offset, frame + offset, len);
+	}
+}
 
-	//convert pixels into bytes
-	w*=bytes_per_pixel;
+/* the driver refused to pan: draw on the text page from now on,
+ * starting with everything we composed so far.
+ */
+static void stop_panning(void)
+{
+	fb_mode = FB_DIRECT;
+	wait_vsync();
+	memcpy(text_page, frame, screensize);
+	if(shown >= 0)
+		show_page(-1);
+}
 
-	//compute affected area
-	area = (h*fbinfo.finfo.line_length);
-	//TODO: test this ( it works only if print out of the screen )
-	if(x+w>fbinfo.finfo.line_length) {
-		x=0;
-		w=fbinfo.finfo.line_length;
-	}
+// show the regions just composed in frame
+static void present(void)
+{
+	int target;
 
-	if(!(new_bg=malloc(area))) {
-		fatal_error=1; // we cannot print, or we will be called infinite times.
+	if(fb_mode == FB_OVERLAY)
+	{
+		wait_vsync();
+		copy_regions(pages[0], dirty, dirty_count);
+		if(shown != 0 && show_page(0))
+			stop_panning();
 		return;
 	}
-
-	offset = (x+fbinfo.vinfo.xoffset)*bytes_per_pixel + (y+fbinfo.vinfo.yoffset)*fbinfo.finfo.line_length;
-	// save our affected background into new_bg
-	memcpy(new_bg,fbinfo.fbp + offset,area);
-	src = bkgdp + offset;
-	dst = new_bg;
-	send = src + area;
-	dend = new_bg + area;
-
-	for(;src<send;) {
-		//walk the line unntil a black pixel is found
-		for(;src<send && memcmp(dst,black_pixel,bytes_per_pixel);src+=bytes_per_pixel,dst+=bytes_per_pixel);
-		//walk the line until a non-black pixel is found
-		for(pos=dst;pos<dend && !memcmp(pos,black_pixel,bytes_per_pixel);pos+=bytes_per_pixel);
-		if(pos>dst)
-		{
-			memcpy(dst,src,pos-dst);
-			src+=(pos-dst);
-			dst=pos;
-		}
+	// FB_FLIP: the hidden page lacks this frame and the previous one
+	target = (shown == 0 ? 1 : 0);
+	copy_regions(pages[target], last, last_count);
+	copy_regions(pages[target], dirty, dirty_count);
+	if(show_page(target))
+	{
+		stop_panning();
+		return;
 	}
+	memcpy(last, dirty, dirty_count*sizeof(struct fb_rect));
+	last_count = dirty_count;
+}
 
-	//write once
-	memcpy(fbinfo.fbp + offset,new_bg,area);
-	free(new_bg);
+/** show the regions marked by fb_refresh.
+ * FB_DIRECT copies them in the text page, the other modes
+ * show complete frames from the other pages.
+ * NOTE: we must hold nc_lock
+ */
+void fb_flush(void)
+{
+	if(fb_state <= 0 || !dirty_count)
+		return;
+	if(fb_mode == FB_DIRECT)
+		copy_regions(text_page, dirty, dirty_count);
+	else
+		present();
+	dirty_count = 0;
 }
 
-// wrapper to use row and col for text output
-void fb_crefresh(int col, int row, int width, int height)
+/** show the text page again, for who draws on the console after us ( the shell ) */
+void fb_release(void)
 {
-	fb_refresh(col*CHAR_WIDTH, row*CHAR_HEIGHT, width*CHAR_WIDTH, height*CHAR_HEIGHT);
+	if(fb_state > 0 && shown >= 0)
+		show_page(-1);
+}
+
+/** the size of the screen in pixels, 0x0 if we don't have it */
+void fb_size(int *width, int *height)
+{
+	*width = (fb_state > 0 ? fbinfo.vinfo.xres : 0);
+	*height = (fb_state > 0 ? fbinfo.vinfo.yres : 0);
+}
+
+/* mix two 0xRRGGBB colors, or two pixels with the same layout.
+ * @a: how much of src, 0 to 255
+ */
+static uint32_t blend32(uint32_t dst, uint32_t src, unsigned int a)
+{
+	uint32_t rb,g;
+
+	a += a >> 7; // 255 must be all src
+	rb = ((src & 0xff00ff) * a + (dst & 0xff00ff) * (256 - a)) >> 8;
+	g = ((src & 0x00ff00) * a + (dst & 0x00ff00) * (256 - a)) >> 8;
+	return (rb & 0xff00ff) | (g & 0x00ff00) | (dst & 0xff000000);
+}
+
+// the 8 bits channel in the framebuffer field f
+static uint32_t unchannel(uint32_t pixel, const struct fb_bitfield *f)
+{
+	uint32_t c = (pixel >> f->offset) & ((1U << f->length) - 1);
+
+	if(f->length >= 8)
+		return c >> (f->length - 8);
+	return c * 255 / ((1U << f->length) - 1);
+}
+
+// a 0xRRGGBB color as a framebuffer pixel
+static uint32_t to_pixel(uint32_t rgb)
+{
+	return channel(rgb >> 16 & 0xff, &fbinfo.vinfo.red) |
+		channel(rgb >> 8 & 0xff, &fbinfo.vinfo.green) |
+		channel(rgb & 0xff, &fbinfo.vinfo.blue);
+}
+
+static uint32_t to_rgb(uint32_t pixel)
+{
+	return unchannel(pixel, &fbinfo.vinfo.red) << 16 |
+		unchannel(pixel, &fbinfo.vinfo.green) << 8 |
+		unchannel(pixel, &fbinfo.vinfo.blue);
+}
+
+/** draw a glyph over the background in frame, fb_flush shows it
+ * @x, @y: where, in pixels
+ * @w, @h: size of the glyph
+ * @alpha: how much every pixel of the glyph covers, 0 to 255. NULL draws no text.
+ * @fg: color of the text, 0xRRGGBB
+ * @bg: color of the box behind the text, 0xRRGGBB
+ * @bg_alpha: how much bg covers the background, 0 to 255
+ * NOTE: we must hold nc_lock
+ */
+void fb_draw_glyph(int x, int y, int w, int h, const uint8_t *alpha, uint32_t fg, uint32_t bg, int bg_alpha)
+{
+	int bytes_per_pixel,i,j;
+	long int offset;
+	uint32_t color,pixel;
+
+	if(fb_state <= 0 || x < 0 || y < 0 || x + w > fbinfo.vinfo.xres || y + h > fbinfo.vinfo.yres)
+		return;
+	bytes_per_pixel=(fbinfo.vinfo.bits_per_pixel/8);
+	if(fast_blend)
+	{
+		// blend32 works on the pixels as they are
+		fg = to_pixel(fg);
+		bg = to_pixel(bg);
+	}
+	for(j=0;j<h;j++)
+	{
+		offset = x*bytes_per_pixel + (y+j)*fbinfo.finfo.line_length;
+		for(i=0;i<w;i++,offset+=bytes_per_pixel)
+		{
+			color = 0;
+			if(fast_blend)
+			{
+				if(bkgdp)
+					color = *(uint32_t *)(bkgdp + offset);
+			}
+			else if(bkgdp)
+			{
+				pixel = 0;
+				memcpy(&pixel, bkgdp + offset, bytes_per_pixel);
+				color = to_rgb(pixel);
+			}
+			if(bg_alpha)
+				color = blend32(color, bg, bg_alpha);
+			if(alpha && alpha[j*w + i])
+				color = blend32(color, fg, alpha[j*w + i]);
+			if(fast_blend)
+				*(uint32_t *)(frame + offset) = color;
+			else
+			{
+				pixel = to_pixel(color);
+				memcpy(frame + offset, &pixel, bytes_per_pixel);
+			}
+		}
+	}
+	fb_refresh(x, y, w, h);
 }
@@ -1,8 +1,17 @@
 #define FBDEV "/dev/fb0"
 #define BACKGROUND "/data/background.bmp" //can put on /data to allow the user to set their own background
-#define BITMAP_DEPTH 24
-#define CHAR_WIDTH 8
-#define CHAR_HEIGHT 16
+#define BACKGROUND_CACHE "/data/.background.cache" // BACKGROUND converted for this screen, see bgcache.c
+#define DEFAULT_BACKGROUND "/background.kbg" // in the initramfs, used without BACKGROUND
+// regions waiting for fb_flush, more than these are merged in one
+#define MAX_DIRTY 8
+
+/* how composed frames get on screen, the best one that yres_virtual allows.
+ * the page fbcon was showing ( the text page ) is given back to it when we leave,
+ * the others are ours.
+ */
+#define FB_DIRECT  0 /* no room to pan: we draw in the text page */
+#define FB_OVERLAY 1 /* one more page: we show it and copy there what changed */
+#define FB_FLIP    2 /* two more pages: draw the hidden one, then pan to it at vsync */
 
 //TODO: The struct was nice for passing to functions, but we are using a global variable.
 //      do we still need this?
@@ -14,12 +23,13 @@ typedef struct _fb_info
 	struct fb_fix_screeninfo finfo;
 } fb_info;
 
-typedef struct _pixel {
-	uint8_t b,g,r; // bmp lists colors backwards
-} pixel;
-
-void fb_init(void);
+int fb_init(void);
 void fb_destroy(void);
+void fb_load_background(void);
 void fb_background(void);
+void fb_redraw(void);
 void fb_refresh(int,int, int,int);
-void fb_crefresh(int,int, int,int);
\ No newline at end of file
+void fb_flush(void);
+void fb_release(void);
+void fb_size(int *, int *);
+void fb_draw_glyph(int,int, int,int, const uint8_t *, uint32_t, uint32_t, int);
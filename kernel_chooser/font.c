@@ -0,0 +1,168 @@
+/* bitmap fonts for the framebuffer UI.
+ * glyphs come from a PSF1 or PSF2 file ( the ones of kbd and busybox loadfont )
+ * or from the console itself, through KDFONTOP.
+ * they are expanded once in a cache of alpha values, one byte each,
+ * so drawing a cell never has to pick bits.
+ * glyphs are indexed by the byte we print, like the console does
+ * when it has no unicode map.
+ */
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/kd.h>
+
+#include "font.h"
+
+static uint32_t le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/** expand the glyphs bits in the cache
+ * @f: the font, with width, height and count already set
+ * @bits: the first glyph
+ * @rowsize: bytes in a row of a glyph
+ * @charsize: bytes from a glyph to the next one
+ * returns 0 on success, -1 on error.
+ */
+static int expand(font *f, const uint8_t *bits, int rowsize, int charsize)
+{
+	int c,x,y;
+	const uint8_t *row;
+	uint8_t *dst;
+
+	if(f->count > FONT_MAX_COUNT)
+		f->count = FONT_MAX_COUNT;
+	if(f->width < 1 || f->height < 1 || f->count < 1 ||
+		f->width > FONT_MAX_SIZE || f->height > FONT_MAX_SIZE)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if(!(f->glyphs = malloc(f->count * f->width * f->height)))
+		return -1;
+	dst = f->glyphs;
+	for(c=0;c<f->count;c++)
+		for(y=0;y<f->height;y++)
+		{
+			row = bits + c*charsize + y*rowsize;
+			for(x=0;x<f->width;x++)
+				*dst++ = (row[x/8] & (0x80 >> (x%8)) ? 255 : 0);
+		}
+	return 0;
+}
+
+/** load a PSF font
+ * @path: the file
+ * @f: where to put it
+ * returns 0 on success, -1 on error ( EINVAL if it's not a font we can read ).
+ */
+int font_open(const char *path, font *f)
+{
+	int fd,ret,rowsize;
+	struct stat st;
+	uint8_t *map;
+	uint32_t headersize,charsize;
+
+	if((fd = open(path,O_RDONLY|O_CLOEXEC)) < 0)
+		return -1;
+	if(fstat(fd,&st))
+	{
+		close(fd);
+		return -1;
+	}
+	if(st.st_size < 4)
+	{
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	map = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return -1;
+	ret = -1;
+	errno = EINVAL;
+	if((map[0] | map[1] << 8) == PSF1_MAGIC)
+	{
+		headersize = 4;
+		f->width = 8;
+		f->height = charsize = map[3];
+		f->count = (map[2] & PSF1_MODE512 ? 512 : 256);
+		rowsize = 1;
+	}
+	else if(st.st_size >= 32 && le32(map) == PSF2_MAGIC)
+	{
+		headersize = le32(map + 8);
+		f->count = le32(map + 16);
+		charsize = le32(map + 20);
+		f->height = le32(map + 24);
+		f->width = le32(map + 28);
+		rowsize = (f->width + 7)/8;
+		if((uint64_t)rowsize * f->height > charsize)
+			goto out;
+	}
+	else
+		goto out;
+	if(f->count > FONT_MAX_COUNT)
+		f->count = FONT_MAX_COUNT;
+	// the glyphs we use must be in the file
+	if(f->count < 1 || headersize + (uint64_t)f->count * charsize > st.st_size)
+		goto out;
+	ret = expand(f,map + headersize,rowsize,charsize);
+	out:
+	munmap(map,st.st_size);
+	return ret;
+}
+
+/** get the font the console is using
+ * @fd: the console
+ * @f: where to put it
+ * returns 0 on success, -1 on error.
+ */
+int font_console(int fd, font *f)
+{
+	struct console_font_op op;
+	uint8_t *data;
+	int ret,rowsize;
+
+	// the kernel pads every glyph to CONSOLE_FONT_MAX_SIZE rows
+	data = malloc(CONSOLE_FONT_MAX_COUNT * CONSOLE_FONT_MAX_SIZE * (CONSOLE_FONT_MAX_SIZE/8));
+	if(!data)
+		return -1;
+	memset(&op,0,sizeof(op));
+	op.op = KD_FONT_OP_GET;
+	op.width = op.height = CONSOLE_FONT_MAX_SIZE;
+	op.charcount = CONSOLE_FONT_MAX_COUNT;
+	op.data = data;
+	ret = -1;
+	if(!ioctl(fd,KDFONTOP,&op))
+	{
+		f->width = op.width;
+		f->height = op.height;
+		f->count = op.charcount;
+		rowsize = (op.width + 7)/8;
+		ret = expand(f,data,rowsize,rowsize*CONSOLE_FONT_MAX_SIZE);
+	}
+	free(data);
+	return ret;
+}
+
+void font_free(font *f)
+{
+	free(f->glyphs);
+	f->glyphs = NULL;
+}
+
+/** the alpha values of a glyph, '?' if the font doesn't have it */
+const uint8_t *font_glyph(const font *f, unsigned int c)
+{
+	if(c >= f->count)
+		c = ('?' < f->count ? '?' : 0);
+	return f->glyphs + c * f->width * f->height;
+}
@@ -0,0 +1,37 @@
+#ifndef _FONT_H
+#define _FONT_H
+
+#include <stdint.h>
+
+// can put on /data to use another font, otherwise we take the one of the console
+#define FONT_FILE "/data/font.psf"
+
+#define PSF1_MAGIC 0x0436
+#define PSF1_MODE512 0x01
+#define PSF2_MAGIC 0x864ab572
+
+// glyphs bigger than this are not a font we want
+#define FONT_MAX_SIZE 64
+// we draw bytes, more glyphs are never used
+#define FONT_MAX_COUNT 256
+// the one the kernel gives us is at most 32x32, with 512 glyphs
+#define CONSOLE_FONT_MAX_SIZE 32
+#define CONSOLE_FONT_MAX_COUNT 512
+
+/* a bitmap font, expanded in a glyph cache:
+ * every glyph is width*height alpha values, 0 to 255, one byte each.
+ */
+typedef struct _font
+{
+	int width,
+			height,
+			count;
+	uint8_t *glyphs;
+} font;
+
+int font_open(const char *, font *);
+int font_console(int, font *);
+void font_free(font *);
+const uint8_t *font_glyph(const font *, unsigned int);
+
+#endif
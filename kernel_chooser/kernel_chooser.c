@@ -21,7 +21,7 @@
  *
  * 1) read the contents of /data/.kernel.d/
  * 2) parse as "description \n blkdev:kernel:initrd \n cmdline"
- * 3) wait 10 seconds for the user to press a key.
+ * 3) wait 10 seconds for the user to press a key, while loading /data/.kernel.
  *    if no key is pressed, boot the default configuration in /data/.kernel
  *    if a key is pressed, display a menu for manual selection
  * 4) kexec hardboot into the new kernel
@@ -43,25 +43,50 @@
 #include <sys/reboot.h>
 #include <termios.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #include "common.h"
 #include "menu.h"
 #include "kernel_chooser.h"
+#include "uevent.h"
+#include "workers.h"
+#include "keys.h"
+#include "events.h"
+#include "trace.h"
 
 // if == 1 => someone called FATAL we have to exit
 int fatal_error;
 
-/* make /dev from /sys */
-void mdev(void)
+// the default entry is loaded while the user looks at the countdown
+struct
 {
-	pid_t pid;
-	if(!(pid = fork()))
-	{
-		char *mdev_argv[] = MDEV_ARGS;
-		execv(BUSYBOX,mdev_argv);
-	}
-	waitpid(pid,NULL,0);
-}
+	pthread_t thread;
+	menu_entry *item; // NULL if there is no preload
+	volatile int cancel;
+	int result,
+			state, // PRELOAD_*
+			phase; // the trace of the device wait
+} preload;
+
+/* everything we wait for comes through the event loop:
+ * the keys, the countdown, the devices, the preload and our children.
+ */
+struct
+{
+	ev_source console,
+						buttons[MAX_KEY_DEVICES], // evdev devices with BUTTONS
+						uevents,
+						countdown,
+						device_timeout, // the preload waits for its device
+						loaded, // the preload thread has finished
+						children; // SIGCHLD
+	int button_devices, // how many buttons are watched
+			mode, // what the keys do, MODE_*
+			countdown_left, // milliseconds
+			countdown_step, // until the next tick
+			choice; // MENU_NONE until someone chooses
+	pid_t screenshot; // the copy of the framebuffer, 0 if there is none
+} loop;
 
 /* substitute '\n' with '\0' */
 char *fgets_fix(char *string)
@@ -370,93 +395,549 @@ void try_take_console_control(void)
 	(void)take_console_control();
 }
 
-/** open console for the first time
+/** create nodes for the built-in devices we use
  *  NOTE: we need /sys mounted
  */
-int open_console(void)
+void make_static_nodes(void)
 {
+	const char *nodes[] = STATIC_NODES;
 	int i;
 
-	mdev();
-	if(access(CONSOLE,R_OK|W_OK))
-	{ // no console yet... wait until timeout
-		sleep(1);
-		for(i=1;access(CONSOLE,R_OK|W_OK) && i < TIMEOUT_BLKDEV;i++)
-		{
-			sleep(1);
-			mdev();
-		}
-		if(i==TIMEOUT_BLKDEV) // no console availbale ( user it's using an older kernel )
-		{
-			errno = ETIMEDOUT;
-			return -1;
-		}
-	}
-	if(take_console_control())
-		return -1;
-	return 0;
+	for(i=0;nodes[i];i++)
+		uevent_coldplug("/sys",nodes[i]);
+	// we read the buttons, and the keys held down, from evdev
+	keys_coldplug("/sys");
 }
 
+/** parse all the entries in DATA_DIR
+ * NOTE: it runs while other threads use relative paths, don't chdir
+ */
 int parse_data_directory(menu_entry **list)
 {
 	DIR *dir;
 	struct dirent *d;
+	char path[DATA_DIR_STRLEN + sizeof(d->d_name)];
 
-	if(chdir(DATA_DIR))
-	{
-		FATAL("cannot chdir to \"%s\" - %s\n",DATA_DIR,strerror(errno));
-		return -1;
-	}
-	if((dir = opendir(".")) == NULL)
+	if((dir = opendir(DATA_DIR)) == NULL)
 	{
-		ERROR("cannot open \"%s\" - %s\n",DATA_DIR,strerror(errno));
-		chdir("/");
+		FATAL("cannot open \"%s\" - %s\n",DATA_DIR,strerror(errno));
 		return -1;
 	}
 	while((d = readdir(dir)) != NULL)
 		if(d->d_type != DT_DIR)
 		{
-			if(parser(d->d_name,d->d_name,list))
+			snprintf(path,sizeof(path),DATA_DIR "%s",d->d_name);
+			if(parser(path,d->d_name,list) && fatal_error)
 			{
-				if(fatal_error)
-				{
-					closedir(dir);
-					chdir("/");
-					return -1;
-				}
-				continue;
+				closedir(dir);
+				return -1;
 			}
 		}
 	closedir(dir);
-	chdir("/");
 	return 0;
 }
 
-int wait_for_device(char *blkdev)
+/* the startup steps, as tasks for the workers.
+ * main waits only for what it needs, the rest
+ * runs while the user looks at the countdown.
+ */
+int mount_sysfs(task *t)
+{
+	/* if the initrd does not contain /sys, make it for them
+	 * we want to try as hard as we can to open the console
+	 * without the console we can not communicate to the user
+	 */
+	mkdir("/sys", 0700);
+	return mount("sysfs","/sys","sysfs",MS_RELATIME,"");
+}
+
+int create_static_nodes(task *t)
+{
+	make_static_nodes();
+	return 0;
+}
+
+int wait_for_console(task *t)
+{
+	// no console availbale ( user it's using an older kernel )
+	return uevent_wait_for_device("/sys",CONSOLE,TIMEOUT_BLKDEV);
+}
+
+int umount_sysfs(task *t)
+{
+	umount("/sys");
+	return 0;
+}
+
+/* take_console_control closes 0,1 and 2: the tasks running
+ * with it must not open files, or they will get those.
+ */
+int open_console(task *t)
+{
+	return take_console_control();
+}
+
+// required by kexec
+int mount_proc(task *t)
+{
+	return mount("proc","/proc","proc",MS_RELATIME,"");
+}
+
+int mount_data(task *t)
+{
+	return mount(DATA_DEV,"/data","ext4",0,"");
+}
+
+int parse_default(task *t)
+{
+	// it's fine to not have one
+	if(parser(DEFAULT_CONFIG,DEFAULT_CONFIG_NAME,t->arg) && fatal_error)
+		return -1;
+	return 0;
+}
+
+int parse_directory(task *t)
+{
+	return parse_data_directory(t->arg);
+}
+
+#if !defined(INSTANT_BOOT) && TIMEOUT_BOOT_MS > 0
+// the countdown will bring up the UI anyway, decode the background before it
+int load_background(task *t)
+{
+	if(fb_init())
+		return -1;
+	fb_load_background();
+	return 0;
+}
+#endif
+
+int startup_done(task *t)
+{
+	return 0;
+}
+
+menu_entry *dir_list; // entries from DATA_DIR, appended to the others when the menu is shown
+
+task sysfs_task = { "sysfs mount", mount_sysfs, NULL, { NULL } };
+task nodes_task = { "static nodes", create_static_nodes, NULL, { &sysfs_task, NULL } };
+task console_wait_task = { "console wait", wait_for_console, NULL, { &sysfs_task, NULL } };
+task sysfs_umount_task = { "sysfs umount", umount_sysfs, NULL, { &nodes_task, &console_wait_task, NULL } };
+task console_task = { "console", open_console, NULL, { &nodes_task, &console_wait_task, NULL } };
+task proc_task = { "/proc mount", mount_proc, NULL, { NULL } };
+task data_task = { "/data mount", mount_data, NULL, { &nodes_task, NULL } };
+// cmdline_parser is not thread safe, and entries ids must follow the menu order
+task parse_default_task = { "parse default", parse_default, NULL, { &data_task, &proc_task, &console_task, NULL } };
+task parse_dir_task = { "parse data directory", parse_directory, &dir_list, { &parse_default_task, NULL } };
+#if !defined(INSTANT_BOOT) && TIMEOUT_BOOT_MS > 0
+task background_task = { "load background", load_background, NULL, { &data_task, &console_task, NULL } };
+#endif
+// what main needs before looking at the default entry
+task startup_task = { "startup", startup_done, NULL, { &sysfs_umount_task, &console_task, &parse_default_task, NULL } };
+
+task *startup[] =
+{
+	&sysfs_task, &nodes_task, &console_wait_task, &sysfs_umount_task,
+	&console_task, &proc_task, &data_task, &parse_default_task, &parse_dir_task,
+#if !defined(INSTANT_BOOT) && TIMEOUT_BOOT_MS > 0
+	&background_task,
+#endif
+	&startup_task, NULL
+};
+
+/** make the node of blkdev, if the kernel already knows it
+ * NOTE: the uevents must be watched already, or we can lose the one of blkdev
+ * returns 1 if it's there, 0 if we have to wait for it.
+ */
+int device_ready(char *blkdev)
+{
+	int ret;
+
+	if(!access(blkdev,R_OK))
+		return 1;
+	if(mount("sysfs","/sys","sysfs",MS_RELATIME,""))
+		return 0;
+	ret = !uevent_coldplug("/sys",blkdev);
+	umount("/sys");
+	return ret;
+}
+
+/** mount item->blkdev on NEWROOT and load item kernel.
+ * @cancel: passed to k_load
+ * returns 0 on success, -1 on error.
+ */
+int load_entry(menu_entry *item, volatile int *cancel)
+{
+	int ret;
+
+	// mount blkdev on NEWROOT
+	if(mount(item->blkdev,NEWROOT,"ext4",0,""))
+	{
+		ERROR("unable to mount \"%s\" on %s - %s\n",item->blkdev,NEWROOT,strerror(errno));
+		return -1;
+	}
+	if((ret = k_load(item->kernel,item->initrd,item->cmdline,cancel)) && errno != ECANCELED)
+		ERROR("unable to load guest kernel\n");
+	umount(NEWROOT);
+	return ret;
+}
+
+/** show what the loading workers are doing */
+void show_job_progress(job *j, int event, off_t bytes)
+{
+	if(event == JOB_STARTED)
+		INFO("loading %s...\n",j->name);
+	else if(event == JOB_PROGRESS)
+		INFO("%s: %ld KB ready\n",j->name,(long)(bytes >> 10));
+}
+
+void *preload_thread(void *arg)
+{
+	preload.result = load_entry(preload.item,&preload.cancel);
+	// the main loop joins us
+	ev_notify(&loop.loaded);
+	return NULL;
+}
+
+/** the device of the preload is there, load it in background */
+void preload_run(void)
+{
+	int err;
+
+	preload.state = PRELOAD_RUNNING;
+	if((err = pthread_create(&preload.thread,NULL,preload_thread,NULL)))
+	{
+		WARN("cannot preload \"%s\" - %s\n",preload.item->name,strerror(err));
+		// the UI waits for it
+		preload.result = load_entry(preload.item,&preload.cancel);
+		preload.state = PRELOAD_DONE;
+	}
+}
+
+/** start loading item in background, as soon as its device is there */
+void preload_start(menu_entry *item)
+{
+	preload.cancel = 0;
+	preload.item = item;
+	preload.result = -1;
+	if(device_ready(item->blkdev))
+	{
+		preload_run();
+		return;
+	}
+	DEBUG("block device \"%s\" not found.\n",item->blkdev);
+	INFO("waiting for device...\n");
+	preload.state = PRELOAD_DEVICE;
+	preload.phase = trace_begin("device wait");
+	if(ev_timer(&loop.device_timeout,TIMEOUT_BLKDEV*1000,0))
+	{
+		ERROR("cannot wait for \"%s\" - %s\n",item->blkdev,strerror(errno));
+		trace_end(preload.phase);
+		preload.state = PRELOAD_DONE;
+	}
+}
+
+/** stop the preload and drop what it loaded */
+void preload_cancel(void)
+{
+	if(!preload.item)
+		return;
+	preload.cancel = 1;
+	switch(preload.state)
+	{
+		case PRELOAD_DEVICE:
+			ev_timer(&loop.device_timeout,0,0);
+			trace_end(preload.phase);
+			break;
+		case PRELOAD_RUNNING:
+			pthread_join(preload.thread,NULL);
+			// the loop must not join it again
+			ev_read(&loop.loaded);
+			if(!preload.result)
+				k_unload();
+			break;
+		case PRELOAD_DONE:
+			if(!preload.result)
+				k_unload();
+			break;
+	}
+	preload.item = NULL;
+	preload.state = PRELOAD_NONE;
+}
+
+// the device of the preload is there
+void device_found(void)
+{
+	ev_timer(&loop.device_timeout,0,0);
+	trace_end(preload.phase);
+	preload_run();
+}
+
+void device_timeout(ev_source *s, uint32_t events)
+{
+	ev_read(s);
+	if(preload.state != PRELOAD_DEVICE)
+		return;
+	trace_end(preload.phase);
+	ERROR("device \"%s\" not found\n",preload.item->blkdev);
+	preload.state = PRELOAD_DONE;
+}
+
+void preload_loaded(ev_source *s, uint32_t events)
+{
+	ev_read(s);
+	if(preload.state != PRELOAD_RUNNING)
+		return;
+	pthread_join(preload.thread,NULL);
+	preload.state = PRELOAD_DONE;
+}
+
+/** a key from the console or from the buttons */
+void key_pressed(int key)
+{
+	if(loop.choice != MENU_NONE)
+		return;
+	if(loop.mode == MODE_COUNTDOWN)
+	{
+		// it's a countdown no more
+		ev_timer(&loop.countdown,0,0);
+		nc_countdown(0);
+		loop.choice = MENU_PROMPT;
+	}
+	else if(loop.mode == MODE_MENU)
+		loop.choice = nc_key(key);
+}
+
+void console_ready(ev_source *s, uint32_t events)
+{
+	int key;
+
+	if((key = nc_read_key()) >= 0)
+		key_pressed(key);
+	else if(errno != EAGAIN)
+	{
+		WARN("cannot read the console - %s\n",strerror(errno));
+		ev_del(s);
+	}
+}
+
+void button_ready(ev_source *s, uint32_t events)
+{
+	int code;
+
+	while((code = keys_read(s->fd)) >= 0)
+		key_pressed(nc_button(code));
+	// unplugged
+	if(errno != EAGAIN)
+	{
+		ev_del(s);
+		nc_set_buttons(--loop.button_devices);
+	}
+}
+
+/** watch the buttons of the evdev device in fd */
+void watch_buttons(int fd)
 {
 	int i;
-	if(access(blkdev,R_OK) && !mount("sysfs","/sys","sysfs",MS_RELATIME,""))
+
+	for(i=0;i<MAX_KEY_DEVICES && loop.buttons[i].fd >= 0;i++);
+	if(i == MAX_KEY_DEVICES)
 	{
-		DEBUG("block device \"%s\" not found.\n",blkdev);
-		INFO("waiting for device...\n");
-		sleep(1);
-		mdev();
-		for(i=1;access(blkdev,R_OK) && i < TIMEOUT_BLKDEV;i++)
-		{
-			sleep(1);
-			mdev();
-		}
-		umount("/sys");
-		if(i==TIMEOUT_BLKDEV)
-			return -1;
+		close(fd);
+		return;
+	}
+	loop.buttons[i].fd = fd;
+	if(ev_add(&loop.buttons[i]))
+	{
+		close(fd);
+		loop.buttons[i].fd = -1;
+		return;
+	}
+	nc_set_buttons(++loop.button_devices);
+}
+
+void uevent_ready(ev_source *s, uint32_t events)
+{
+	char buffer[UEVENT_MSG_LEN+1],path[256];
+	struct uevent ev;
+	int fd;
+
+	if(uevent_read(s->fd,buffer,&ev) || !ev.devname || strcmp(ev.action,"add"))
+		return;
+	// the dock, or something else with our buttons
+	if(!strncmp(ev.devname,"input/event",11))
+	{
+		snprintf(path,sizeof(path),"/dev/%s",ev.devname);
+		if(!uevent_mknod(path,0,ev.major,ev.minor) && (fd = keys_open(path)) >= 0)
+			watch_buttons(fd);
+	}
+	else if(preload.state == PRELOAD_DEVICE && uevent_match(preload.item->blkdev,&ev) &&
+		!uevent_mknod(preload.item->blkdev,!strcmp(ev.subsystem,"block"),ev.major,ev.minor))
+		device_found();
+}
+
+void child_exited(ev_source *s, uint32_t events)
+{
+	int status;
+
+	ev_read(s);
+	// the others are waited for by who started them
+	if(!loop.screenshot || waitpid(loop.screenshot,&status,WNOHANG) <= 0)
+		return;
+	loop.screenshot = 0;
+	if(WIFEXITED(status) && !WEXITSTATUS(status))
+		DEBUG("Framebuffer saved to /data/fb0.dump\n");
+	else
+		ERROR("cannot save the framebuffer\n");
+}
+
+void countdown_tick(ev_source *s, uint32_t events)
+{
+	uint64_t ticks;
+
+	if(!(ticks = ev_read(s)))
+		return;
+	loop.countdown_left -= loop.countdown_step + (ticks - 1) * 1000;
+	loop.countdown_step = 1000;
+	if(loop.countdown_left > 0)
+	{
+		nc_countdown(loop.countdown_left);
+		return;
+	}
+	ev_timer(s,0,0);
+	if(loop.choice == MENU_NONE)
+		loop.choice = MENU_DEFAULT;
+}
+
+/** start the countdown, it brings up the UI
+ * it lasts TIMEOUT_BOOT_MS, it can be less than a second.
+ * returns 0 on success, -1 if there is no countdown.
+ */
+int countdown_start(void)
+{
+	if(TIMEOUT_BOOT_MS <= 0 || nc_countdown(TIMEOUT_BOOT_MS))
+		return -1;
+	loop.countdown_left = TIMEOUT_BOOT_MS;
+	/* the first tick takes the fraction of a second,
+	 * then we tick on whole seconds.
+	 */
+	if(!(loop.countdown_step = TIMEOUT_BOOT_MS % 1000))
+		loop.countdown_step = 1000;
+	if(ev_timer(&loop.countdown,loop.countdown_step,1000))
+	{
+		WARN("cannot start the countdown - %s\n",strerror(errno));
+		nc_countdown(0);
+		return -1;
+	}
+	loop.mode = MODE_COUNTDOWN;
+	return 0;
+}
+
+/** watch the console, the buttons, the uevents, the preload and our children
+ * NOTE: the console must be open
+ * returns 0 on success, -1 on error.
+ */
+int loop_start(void)
+{
+	int fds[MAX_KEY_DEVICES],i,n;
+
+	loop.console = (ev_source) { -1, console_ready, NULL };
+	loop.uevents = (ev_source) { -1, uevent_ready, NULL };
+	loop.countdown = (ev_source) { -1, countdown_tick, NULL };
+	loop.device_timeout = (ev_source) { -1, device_timeout, NULL };
+	loop.loaded = (ev_source) { -1, preload_loaded, NULL };
+	loop.children = (ev_source) { -1, child_exited, NULL };
+	for(i=0;i<MAX_KEY_DEVICES;i++)
+		loop.buttons[i] = (ev_source) { -1, button_ready, NULL };
+	loop.mode = MODE_IDLE;
+	loop.choice = MENU_NONE;
+	if(ev_init() || ev_notifier(&loop.loaded) || ev_signals(&loop.children))
+		return -1;
+	// the shell closes 0 and opens it again, keep our own
+	if((loop.console.fd = fcntl(0,F_DUPFD_CLOEXEC,3)) < 0)
+		return -1;
+	if(ev_add(&loop.console))
+	{
+		close(loop.console.fd);
+		loop.console.fd = -1;
+		return -1;
+	}
+	// without them we cannot see devices that come later, the dock and USB sticks
+	if((loop.uevents.fd = uevent_open()) < 0 || ev_add(&loop.uevents))
+	{
+		WARN("cannot watch the uevents - %s\n",strerror(errno));
+		if(loop.uevents.fd >= 0)
+			close(loop.uevents.fd);
+		loop.uevents.fd = -1;
 	}
+	n = keys_open_all(fds,MAX_KEY_DEVICES);
+	for(i=0;i<n;i++)
+		watch_buttons(fds[i]);
 	return 0;
 }
 
+/** run the loop until someone chooses
+ * returns the choice, MENU_FATAL_ERROR if the loop is broken.
+ */
+int wait_for_choice(void)
+{
+	loop.choice = MENU_NONE;
+	while(loop.choice == MENU_NONE)
+		if(ev_wait(-1) < 0)
+			return MENU_FATAL_ERROR;
+	return loop.choice;
+}
+
+/** load item, the UI keeps working meanwhile.
+ * the default entry could be already loaded, or still loading.
+ * returns 0 when it's loaded, -1 if it failed,
+ * 1 if someone chose something else meanwhile ( it's in loop.choice ).
+ */
+int load_chosen(menu_entry *item)
+{
+	if(preload.item != item)
+	{
+		preload_cancel();
+		preload_start(item);
+	}
+	loop.choice = MENU_NONE;
+	while(preload.state != PRELOAD_DONE)
+	{
+		if(ev_wait(-1) < 0)
+			loop.choice = MENU_FATAL_ERROR;
+		if(loop.choice != MENU_NONE)
+			return 1;
+	}
+	preload.item = NULL;
+	preload.state = PRELOAD_NONE;
+	return (preload.result ? -1 : 0);
+}
+
+/** append our phases to the trace file, if there is one.
+ * we start a new timeline, the stages after kexec continue it.
+ * @data_mounted: DATA_DEV is still mounted on /data
+ */
+void dump_trace(int data_mounted)
+{
+	int fd;
+
+	trace_instant(TRACE_KEXEC);
+	if(!data_mounted && mount(DATA_DEV,"/data","ext4",0,""))
+		return;
+	if((fd = trace_open(TRACE_LOG,TRACE_NEW_TIMELINE)) >= 0 && trace_dump(fd,"kernel_chooser"))
+		WARN("cannot write \"%s\" - %s\n",TRACE_LOG,strerror(errno));
+	if(!data_mounted)
+		umount("/data");
+}
+
 void cleanup(int data_dir_to_parse, menu_entry *list)
 {
 	if(data_dir_to_parse)
+	{
+		// it could still read from /data
+		task_wait(&parse_dir_task);
 		umount("/data");
+	}
 	else
 		nc_destroy_menu();
 	if (list)
@@ -474,7 +955,7 @@ void init_reboot(int magic)
 
 void reboot_recovery(void)
 {
-	FILE *misc = fopen("/dev/mmcblk0p3","w");
+	FILE *misc = fopen(MISC_DEV,"w");
 	if (misc) {
 		fprintf(misc,"boot-recovery");
 		fclose(misc);
@@ -483,11 +964,29 @@ void reboot_recovery(void)
 }
 
 #ifdef SHELL
+/* make /dev from /sys */
+void mdev(void)
+{
+	pid_t pid;
+	if(!(pid = fork()))
+	{
+		char *mdev_argv[] = MDEV_ARGS;
+		execv(BUSYBOX,mdev_argv);
+	}
+	waitpid(pid,NULL,0);
+}
+
 void shell(void)
 {
 	fflush(stdout);
 	char *sh_argv[] = SHELL_ARGS;
 	pid_t pid;
+	// we only made the nodes we need, give the user a full /dev
+	if(!mount("sysfs","/sys","sysfs",MS_RELATIME,""))
+	{
+		mdev();
+		umount("/sys");
+	}
 	if (!(pid = fork())) {
 		if(take_console_control())
 			exit(EXIT_FAILURE);
@@ -498,116 +997,147 @@ void shell(void)
 }
 #endif
 
-void screenshot()
+/** copy the framebuffer on /data, the loop runs meanwhile */
+void screenshot(void)
 {
-	nc_save();
 	pid_t pid;
-	if (!(pid = fork())) {
-		if(take_console_control())
-			exit(EXIT_FAILURE);
+
+	if(mount(DATA_DEV,"/data","ext4",0,""))
+	{
+		ERROR("mounting %s on \"/data\" - %s\n",DATA_DEV,strerror(errno));
+		return;
+	}
+	nc_save();
+	if((pid = fork()) < 0)
+		ERROR("fork - %s\n",strerror(errno));
+	else if(!pid)
+	{
 		execl("/bin/busybox","cp", "-p", "/dev/fb0", "/data/fb0.dump", NULL);
+		exit(EXIT_FAILURE);
+	}
+	else
+	{
+		// the keys are not for the menu until it's back
+		loop.mode = MODE_IDLE;
+		loop.screenshot = pid;
+		while(loop.screenshot && ev_wait(-1) >= 0);
 	}
-	waitpid(pid,NULL,0);
-	try_take_console_control();
 	nc_load();
+	umount("/data");
 }
 
 int main(int argc, char **argv, char **envp)
 {
-	int i,data_dir_to_parse;
+	int i,data_dir_to_parse,phase;
 	menu_entry *list=NULL,*item;
 
-	// errors before open_console are fatal
-	fatal_error = data_dir_to_parse = 1;
-
-	/* mount sys
-	 * if the initrd does not contain /sys, make it for them
-	 * we want to try as hard as we can to open the console
-	 * without the console we can not communicate to the user
+	fatal_error = 0;
+	data_dir_to_parse = 1;
+	// before the workers, or they get it
+	ev_block(SIGCHLD);
+	/* ncurses and the framebuffer are brought up by nc_ui
+	 * only when we show something, messages are kept until then.
 	 */
-	mkdir("/sys", 0700);
-	if(mount("sysfs","/sys","sysfs",MS_RELATIME,""))
-		goto error;
-	// open the console
-	if(open_console())
-	{
-		umount("/sys");
-		goto error;
-	}
-	umount("/sys");
-	if(nc_init())
-		goto error;
-
-	fb_init();
-
-	nc_status("mounting /proc");
-	// mount proc ( required by kexec )
-	if(mount("proc","/proc","proc",MS_RELATIME,""))
-	{
-		FATAL("cannot mount proc\n");
-		goto error;
-	}
-	nc_status("mounting /data");
-	// mount DATA_DEV partition into /data
-	if(mount(DATA_DEV,"/data","ext4",0,""))
-	{
-		FATAL("mounting %s on \"/data\" - %s\n",DATA_DEV,strerror(errno));
-		goto error;
-	}
-
-	fatal_error=0;
-
-	fb_background();
-	if(fatal_error)
+	job_set_progress_handler(show_job_progress);
+	parse_default_task.arg = &list;
+	tasks_start(startup);
+	i = task_wait(&startup_task);
+	tasks_trace_critical_path(&startup_task);
+	if(i)
 	{
-		FATAL("fatal error occourred in fb_background() - %s\n",strerror(errno));
+		// errors before we have /data are fatal
+		fatal_error = 1;
+		// without the console we can not communicate to the user
+		if(task_wait(&console_task))
+			goto error;
+		if(task_wait(&proc_task))
+		{
+			FATAL("cannot mount proc - %s\n",strerror(errno));
+			goto error;
+		}
+		if(task_wait(&data_task))
+		{
+			FATAL("mounting %s on \"/data\" - %s\n",DATA_DEV,strerror(errno));
+			goto error;
+		}
+		// the parser called FATAL
 		goto error;
 	}
-
-	// check for a default entry
-	if(parser(DEFAULT_CONFIG,DEFAULT_CONFIG_NAME,&list) && fatal_error)
+	if(loop_start())
 	{
-		umount("/data");
+		FATAL("cannot start the event loop - %s\n",strerror(errno));
 		goto error;
 	}
 
 	if(list)
 	{
 		INFO("found a default config\n");
-		if(nc_wait_for_keypress())
+		preload_start(list);
+		// i is 1 if the user wants the menu
+		i = -1;
+#ifdef INSTANT_BOOT
+		phase = trace_begin("key check");
+		i = keys_held();
+		trace_end(phase);
+#endif
+		// we cannot read the keys, do the countdown
+		if(i < 0)
 		{
-			i=MENU_DEFAULT;
-			goto skip_menu;
+			phase = trace_begin("countdown");
+			// without a countdown we boot at once
+			i = (countdown_start() ? MENU_DEFAULT : wait_for_choice());
+			trace_end(phase);
 		}
+		else
+			i = (i ? MENU_PROMPT : MENU_DEFAULT);
+		goto skip_menu;
 	}
 	else
 		INFO("no default config found\n");
 
 menu_prompt:
+	// the background is on /data, bring up the UI before leaving it
+	if(nc_ui())
+	{
+		fatal_error=1;
+		goto error;
+	}
 	if(data_dir_to_parse)
 	{
 		INFO("parsing data directory\n");
 		data_dir_to_parse=0;
-		if(parse_data_directory(&list))
+		// it's parsed while we wait for the user
+		phase = trace_begin("data directory wait");
+		i = task_wait(&parse_dir_task);
+		trace_end(phase);
+		if(list)
 		{
-			umount("/data");
-			goto error;
+			for(item=list;item->next;item=item->next);
+			item->next = dir_list;
 		}
+		else
+			list = dir_list;
+		dir_list = NULL;
 		umount("/data");
+		if(i)
+			goto error;
 		if(nc_compute_menu(list))
 			goto error;
 	}
-	i=nc_get_user_choice();
-	//take_console_control();
+	loop.mode = MODE_MENU;
+	nc_show_menu();
+	i = wait_for_choice();
 skip_menu:
 	DEBUG("user chose %d\n",i);
 	// decide what to do
 	switch (i)
 	{
 		case MENU_FATAL_ERROR:
-			FATAL("ncurses - %s\n",strerror(errno));
+			FATAL("cannot wait for events - %s\n",strerror(errno));
 			goto error;
 			break;
+		case MENU_PROMPT:
+			goto menu_prompt;
 		case MENU_DEFAULT:
 			if(!list)
 			{
@@ -627,6 +1157,7 @@ skip_menu:
 			goto error;
 #ifdef SHELL
 		case MENU_SHELL:
+			preload_cancel();
 			nc_save();
 			printf("\033[2J\033[H"); // clear the screen
 			shell();
@@ -634,14 +1165,7 @@ skip_menu:
 			goto menu_prompt;
 #endif
 		case MENU_SCREENSHOT:
-			if(mount(DATA_DEV,"/data","ext4",0,""))
-			{
-				ERROR("mounting %s on \"/data\" - %s\n",DATA_DEV,strerror(errno));
-				goto error;
-			}
 			screenshot();
-			DEBUG("Framebuffer saved to /data/fb0.dump\n");
-			umount("/data");
 			goto menu_prompt;
 		default: // parsed config
 			item=get_item_by_id(list,i);
@@ -651,24 +1175,17 @@ skip_menu:
 		WARN("invalid choice\n");
 		goto error;
 	}
-	if(wait_for_device(item->blkdev))
+	if((i = load_chosen(item)) > 0)
 	{
-		ERROR("device \"%s\" not found\n",item->blkdev);
-		goto error;
+		i = loop.choice;
+		goto skip_menu;
 	}
-	// mount blkdev on NEWROOT
-	if(mount(item->blkdev,NEWROOT,"ext4",0,""))
-	{
-		ERROR("unable to mount \"%s\" on %s - %s\n",item->blkdev,NEWROOT,strerror(errno));
-		goto error;
-	}
-	if(k_load(item->kernel,item->initrd,item->cmdline))
-	{
-		ERROR("unable to load guest kernel\n");
-		umount(NEWROOT);
+	if(i)
 		goto error;
-	}
-	umount(NEWROOT);
+	// it could still read from /data
+	if(data_dir_to_parse)
+		task_wait(&parse_dir_task);
+	dump_trace(data_dir_to_parse);
 	if(data_dir_to_parse)
 		umount("/data");
 	DEBUG("kernel = \"%s\"\n",item->kernel);
@@ -12,6 +12,12 @@
 
 // the device containing DATA_DIR
 #define DATA_DEV "/dev/mmcblk0p8"
+// where we append our boot phases, on DATA_DEV
+#define TRACE_LOG "/data/" TRACE_FILE
+// the misc partition, used to reboot into recovery
+#define MISC_DEV "/dev/mmcblk0p3"
+// built-in devices that we use, their nodes are made at startup
+#define STATIC_NODES { DATA_DEV, MISC_DEV, "/dev/fb0", NULL }
 // the directory contains all configs
 #define DATA_DIR "/data/.kernel.d/"
 #define DATA_DIR_STRLEN 16
@@ -23,19 +29,36 @@
 // maximum length for a boot entry name
 #define MAX_NAME 120
 
+// what the keys do
+#define MODE_IDLE      0 /* nothing, the UI is not ours */
+#define MODE_COUNTDOWN 1 /* any key stops the countdown and shows the menu */
+#define MODE_MENU      2 /* they move in the menu */
+
+// how far the preload is
+#define PRELOAD_NONE    0
+#define PRELOAD_DEVICE  1 /* waiting for its block device */
+#define PRELOAD_RUNNING 2
+#define PRELOAD_DONE    3
+
 // from kexec.c
-int k_load(char *,char *,char *);
+int k_load(char *,char *,char *,volatile int *);
+int k_unload(void);
 void k_exec(void);
 // from nGUI.c
 int nc_compute_menu(menu_entry *list);
 int nc_init(void);
+int nc_ui(void);
 void nc_destroy(void);
 void nc_save();
 void nc_load();
 void nc_wait_enter(void);
-int nc_get_user_choice();
+void nc_show_menu(void);
+int nc_key(int);
+int nc_read_key(void);
+int nc_button(int);
+void nc_set_buttons(int);
 void nc_print_header(void);
-int nc_wait_for_keypress(void);
+int nc_countdown(int);
 void nc_destroy_menu(void);
 // from nGUI.h
 /* our functions return integers
@@ -50,3 +73,5 @@ void nc_destroy_menu(void);
 #define MENU_SCREENSHOT		-5
 #define MENU_DEFAULT		-6
 #define MENU_FATAL_ERROR	-7
+#define MENU_NONE			-8 /* nothing chosen yet */
+#define MENU_PROMPT			-9 /* show the menu */
@@ -28,8 +28,10 @@
 #include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 #include <zlib.h>
 #include <syscall.h>
 #include <sys/syscall.h>
@@ -39,6 +41,8 @@
 
 #include "kexec.h"
 #include "common.h"
+#include "workers.h"
+#include "trace.h"
 
 unsigned long long mem_min, mem_max;
 
@@ -128,15 +132,152 @@ char *slurp_decompress_file(const char *filename, off_t *r_size)
 {
 	char *kernel_buf;
 
-	kernel_buf = zlib_decompress_file(filename, r_size);
-	if (!kernel_buf) {
-		kernel_buf = lzma_decompress_file(filename, r_size);
-		if (!kernel_buf)
-			return slurp_file(filename, r_size);
-	}
+	// one open and one look at the magic, see decompress.c
+	kernel_buf = decompress_file(filename, r_size);
+	if (!kernel_buf && filename)
+		ERROR("cannot read \"%s\" - %s\n", filename, strerror(errno));
 	return kernel_buf;
 }
 
+static void release_buffer(struct kexec_buffer *b)
+{
+	if(b->len)
+		munmap(b->buf, b->len);
+	else
+		free(b->buf);
+}
+
+/** make info responsible for buf, free_segments will release it.
+ * @len: the length of the mapping if buf is mmap'd, 0 if it's malloc'd
+ * on failure buf is released right away.
+ */
+static int own_buffer(struct kexec_info *info, void *buf, size_t len)
+{
+	struct kexec_buffer *tmp, b;
+
+	b.buf = buf;
+	b.len = len;
+	tmp = realloc(info->buffers, (info->nr_buffers + 1) * sizeof(struct kexec_buffer));
+	if (!tmp) {
+		ERROR("realloc - %s\n", strerror(errno));
+		release_buffer(&b);
+		return -1;
+	}
+	info->buffers = tmp;
+	info->buffers[info->nr_buffers++] = b;
+	return 0;
+}
+
+/** read a file that will become a segment, without copying it when we can.
+ * uncompressed files are mapped read-only and given to kexec_load as they are,
+ * so the kernel copies them straight from the page cache.
+ * @mem: where we describe how to release the buffer, see own_buffer
+ * @decompress: decompress the file if it's compressed
+ */
+static char *slurp_segment_file(struct kexec_buffer *mem, const char *filename, off_t *r_size, int decompress)
+{
+	const struct decompressor *d;
+	struct stat st;
+	char *buf;
+	int fd, phase;
+
+	d = NULL;
+	fd = open(filename, O_RDONLY | _O_BINARY);
+	if (fd < 0) {
+		ERROR("cannot open \"%s\" - %s\n", filename, strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &st) || (decompress && !(d = decompress_probe_fd(fd)))) {
+		ERROR("cannot read \"%s\" - %s\n", filename, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	if (d && d->magic) {
+		phase = trace_begin("decompression");
+		buf = decompress_fd(fd, r_size);
+		trace_end(phase);
+		if (!buf)
+			ERROR("cannot decompress \"%s\" - %s\n", filename, strerror(errno));
+		close(fd);
+		mem->buf = buf;
+		mem->len = 0;
+		return buf;
+	}
+	buf = MAP_FAILED;
+	if (S_ISREG(st.st_mode) && st.st_size > 0)
+		buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) {
+		// char devices and filesystems without mmap
+		buf = slurp_file(filename, r_size);
+		mem->buf = buf;
+		mem->len = 0;
+		return buf;
+	}
+	// start the readahead while we prepare the other segments
+	madvise(buf, st.st_size, MADV_WILLNEED);
+	*r_size = st.st_size;
+	mem->buf = buf;
+	mem->len = st.st_size;
+	return buf;
+}
+
+// a file loaded by a worker for k_segments_load
+struct segment_file {
+	const char *filename;
+	int decompress;
+	char *buf;
+	off_t size;
+	struct kexec_buffer mem;
+};
+
+static int segment_file_job(job *j)
+{
+	struct segment_file *f = j->arg;
+
+	if (!(f->buf = slurp_segment_file(&(f->mem), f->filename, &(f->size), f->decompress)))
+		return -1;
+	job_progress(j, JOB_PROGRESS, f->size);
+	return 0;
+}
+
+/** put [start,end) in the sorted RAM ranges, merged with the ones it touches
+ * returns the new number of ranges.
+ */
+static int add_ram_range(int ranges, unsigned long long start, unsigned long long end)
+{
+	int i, j;
+
+	/* the first one that doesn't end before start */
+	for (i = 0; i < ranges && memory_range[i].end < start; i++)
+		;
+	for (j = i; j < ranges && memory_range[j].start <= end; j++) {
+		if (memory_range[j].start < start)
+			start = memory_range[j].start;
+		if (memory_range[j].end > end)
+			end = memory_range[j].end;
+	}
+	if (i == j) {
+		if (ranges >= MAX_MEMORY_RANGES)
+			return ranges;
+		memmove(memory_range + i + 1, memory_range + i,
+			(ranges - i) * sizeof(memory_range[0]));
+		ranges++;
+	} else if (j > i + 1) {
+		memmove(memory_range + i + 1, memory_range + j,
+			(ranges - j) * sizeof(memory_range[0]));
+		ranges -= j - i - 1;
+	}
+	memory_range[i].start = start;
+	memory_range[i].end = end;
+	memory_range[i].type = RANGE_RAM;
+	return ranges;
+}
+
+/** read the RAM from /proc/iomem
+ * range gets it sorted by address, without overlaps and
+ * with adjacent ranges merged, ends are exclusive.
+ */
 int get_memory_ranges(struct memory_range **range, int *ranges)
 {
 	const char *iomem = "/proc/iomem";
@@ -151,33 +292,16 @@ int get_memory_ranges(struct memory_range **range, int *ranges)
 
 	while(fgets(line, sizeof(line), fp) != NULL) {
 		unsigned long long start, end;
-		char *str;
-		int type;
 		int consumed;
 		int count;
-		if (memory_ranges >= MAX_MEMORY_RANGES)
-			break;
 		count = sscanf(line, "%Lx-%Lx : %n",
 			&start, &end, &consumed);
 		if (count != 2)
 			continue;
-		str = line + consumed;
-		end = end + 1;
-
-		if (memcmp(str, "System RAM\n", 11) == 0) {
-			type = RANGE_RAM;
-		}
-		else if (memcmp(str, "reserved\n", 9) == 0) {
-			type = RANGE_RESERVED;
-		}
-		else {
+		/* nothing but RAM can hold a segment */
+		if (memcmp(line + consumed, "System RAM\n", 11))
 			continue;
-		}
-
-		memory_range[memory_ranges].start = start;
-		memory_range[memory_ranges].end = end;
-		memory_range[memory_ranges].type = type;
-		memory_ranges++;
+		memory_ranges = add_ram_range(memory_ranges, start, end + 1);
 	}
 	fclose(fp);
 	*range = memory_range;
@@ -185,14 +309,72 @@ int get_memory_ranges(struct memory_range **range, int *ranges)
 	return 0;
 }
 
+/* walks the free memory in address order: the RAM ranges minus the segments.
+ * both are sorted, so it takes one pass and no memory.
+ */
+struct free_walk {
+	struct kexec_info *info;
+	int range, seg;
+	unsigned long long pos;
+};
+
+static void free_walk_start(struct free_walk *w, struct kexec_info *info)
+{
+	w->info = info;
+	w->range = 0;
+	w->seg = 0;
+	w->pos = 0;
+}
+
+/** the next free area between mem_min and mem_max
+ * @start, @end: where it begins and ends, end is exclusive
+ * returns 1 if there is one, 0 when there are no more.
+ */
+static int free_walk_next(struct free_walk *w, unsigned long long *start, unsigned long long *end)
+{
+	struct kexec_info *info = w->info;
+	struct kexec_segment *seg;
+	unsigned long long rend, sstart;
+
+	while (w->range < info->memory_ranges) {
+		rend = info->memory_range[w->range].end;
+		if (w->pos < info->memory_range[w->range].start)
+			w->pos = info->memory_range[w->range].start;
+		/* skip the segments behind us */
+		while (w->seg < info->nr_segments) {
+			seg = info->segment + w->seg;
+			if ((unsigned long)seg->mem + seg->memsz > w->pos)
+				break;
+			w->seg++;
+		}
+		*start = w->pos;
+		if (w->seg < info->nr_segments &&
+		    (sstart = (unsigned long)info->segment[w->seg].mem) < rend) {
+			*end = sstart;
+			w->pos = sstart + info->segment[w->seg].memsz;
+			w->seg++;
+		} else {
+			*end = rend;
+			w->pos = rend;
+			w->range++;
+		}
+		if (*start < mem_min)
+			*start = mem_min;
+		if (*end > mem_max)
+			*end = mem_max;
+		if (*start < *end)
+			return 1;
+	}
+	return 0;
+}
+
 unsigned long locate_hole(struct kexec_info *info,
 	unsigned long hole_size, unsigned long hole_align,
 	unsigned long hole_min, unsigned long hole_max,
 	int hole_end)
 {
-	int i, j;
-	struct memory_range *mem_range;
-	int max_mem_ranges, mem_ranges;
+	struct free_walk w;
+	unsigned long long start, end;
 	unsigned long hole_base;
 
 	/* Set an intial invalid value for the hole base */
@@ -212,81 +394,29 @@ unsigned long locate_hole(struct kexec_info *info,
 		hole_align = getpagesize();
 	}
 
-	/* Compute the free memory ranges */
-	max_mem_ranges = info->memory_ranges + info->nr_segments;
-	mem_range = malloc(max_mem_ranges *sizeof(struct memory_range));
-	mem_ranges = 0;
-
-	if(!mem_range)
-		return hole_base;
-
-	/* Perform a merge on the 2 sorted lists of memory ranges  */
-	for (j = 0, i = 0; i < info->memory_ranges; i++) {
-		unsigned long long sstart, send;
-		unsigned long long mstart, mend;
-		mstart = info->memory_range[i].start;
-		mend = info->memory_range[i].end;
-		if (info->memory_range[i].type != RANGE_RAM)
-			continue;
-		while ((j < info->nr_segments) &&
-		       (((unsigned long)info->segment[j].mem) <= mend)) {
-			sstart = (unsigned long)info->segment[j].mem;
-			send = sstart + info->segment[j].memsz -1;
-			if (mstart < sstart) {
-				mem_range[mem_ranges].start = mstart;
-				mem_range[mem_ranges].end = sstart -1;
-				mem_range[mem_ranges].type = RANGE_RAM;
-				mem_ranges++;
-			}
-			mstart = send +1;
-			j++;
-		}
-		if (mstart < mend) {
-			mem_range[mem_ranges].start = mstart;
-			mem_range[mem_ranges].end = mend;
-			mem_range[mem_ranges].type = RANGE_RAM;
-			mem_ranges++;
-		}
-	}
-	/* Now find the end of the last memory_range I can use */
-	for (i = 0; i < mem_ranges; i++) {
-		unsigned long long start, end, size;
-		start = mem_range[i].start;
-		end   = mem_range[i].end;
+	free_walk_start(&w, info);
+	while (free_walk_next(&w, &start, &end)) {
 		/* First filter the range start and end values
-		 * through the lens of mem_min, mem_max and hole_align.
+		 * through the lens of hole_min, hole_max and hole_align.
 		 */
-		if (start < mem_min) {
-			start = mem_min;
-		}
 		if (start < hole_min) {
 			start = hole_min;
 		}
 		start = (start + hole_align - 1) &
 			~((unsigned long long)hole_align - 1);
-		if (end > mem_max) {
-			end = mem_max;
-		}
 		if (end > hole_max) {
 			end = hole_max;
 		}
-		/* Is this still a valid memory range? */
-		if ((start >= end) || (start >= mem_max) || (end <= mem_min)) {
-			continue;
-		}
 		/* Is there enough space left so we can use it? */
-		size = end - start;
-		if (size >= hole_size) {
-			if (hole_end > 0) {
-				hole_base = start;
-				break;
-			} else {
-				hole_base = (end - hole_size) &
-					~((unsigned long long)hole_align - 1);
-			}
+		if (start >= end || end - start < hole_size)
+			continue;
+		if (hole_end > 0) {
+			hole_base = start;
+			break;
 		}
+		hole_base = (end - hole_size) &
+			~((unsigned long long)hole_align - 1);
 	}
-	free(mem_range);
 	if (hole_base == ULONG_MAX) {
 		ERROR("could not find a free area of memory of %lx bytes...\n", hole_size);
 		return ULONG_MAX;
@@ -331,7 +461,7 @@ int add_segment_phys_virt(struct kexec_info *info,
 {
 	unsigned long last;
 	size_t size;
-	int pagesize;
+	int pagesize, i;
 
 	if (bufsz > memsz) {
 		bufsz = memsz;
@@ -372,10 +502,13 @@ int add_segment_phys_virt(struct kexec_info *info,
 		ERROR("realloc - %s\n",strerror(errno));
 		return -1;
 	}
-	info->segment[info->nr_segments].buf   = buf;
-	info->segment[info->nr_segments].bufsz = bufsz;
-	info->segment[info->nr_segments].mem   = (void *)base;
-	info->segment[info->nr_segments].memsz = memsz;
+	/* keep them sorted, the free memory walk relies on it */
+	for (i = info->nr_segments; i > 0 && info->segment[i - 1].mem > (void *)base; i--)
+		info->segment[i] = info->segment[i - 1];
+	info->segment[i].buf   = buf;
+	info->segment[i].bufsz = bufsz;
+	info->segment[i].mem   = (void *)base;
+	info->segment[i].memsz = memsz;
 	info->nr_segments++;
 	if (info->nr_segments > KEXEC_MAX_SEGMENTS) {
 		WARN("kernel segment limit reached. This will likely fail\n");
@@ -386,7 +519,7 @@ int add_segment_phys_virt(struct kexec_info *info,
 static
 int atag_arm_load(struct kexec_info *info, unsigned long base,
 	const char *command_line, off_t command_line_len,
-	const char *initrd, off_t initrd_len, off_t initrd_off)
+	const char *initrd, off_t initrd_len, unsigned long initrd_base)
 {
 	struct tag *saved_tags = atag_read_tags();
 	char *buf;
@@ -399,6 +532,8 @@ int atag_arm_load(struct kexec_info *info, unsigned long base,
 		ERROR("compiling ATAGs - %s\n",strerror(errno));
 		return -1;
 	}
+	if (own_buffer(info, buf, 0))
+		return -1;
 
 	memset(buf, 0xff, getpagesize());
 	params = (struct tag *)buf;
@@ -449,62 +584,171 @@ int atag_arm_load(struct kexec_info *info, unsigned long base,
 
 	len = ((char *)params - buf) + sizeof(struct tag_header);
 
-	add_segment_phys_virt(info, buf, len, base, len);
+	if (add_segment_phys_virt(info, buf, len, base, len))
+		return -1;
 
 	if (initrd) {
-		*initrd_start = locate_hole(info, initrd_len, getpagesize(),initrd_off, ULONG_MAX, INT_MAX);
-		if (*initrd_start == ULONG_MAX)
-		{
-			free(buf);
+		*initrd_start = initrd_base;
+		if (add_segment_phys_virt(info, initrd, initrd_len, *initrd_start, initrd_len))
 			return -1;
-		}
-		add_segment_phys_virt(info, initrd, initrd_len, *initrd_start, initrd_len);
 	}
 
 	return 0;
 }
 
-int zImage_arm_load(const char *buf, char *command_line, char *ramdisk, off_t len, struct kexec_info *info)
+static uint32_t zImage_word(const char *buf, off_t offset)
+{
+	uint32_t word;
+
+	memcpy(&word, buf + offset, sizeof(word));
+	return le32_to_cpu(word);
+}
+
+/** how much memory a zImage needs from where it is loaded:
+ * the kernel it decompresses with its bss, or the kernel and the
+ * decompressor, that moves itself after it when they would overlap.
+ * returns 0 if the image doesn't tell us, -1 if it's truncated.
+ */
+static off_t zImage_footprint(const char *buf, off_t len)
+{
+	uint32_t start, end, image, offset, words, size, bss, size_ptr;
+	off_t room;
+
+	if (len < ZIMAGE_TABLE_OFFSET + 4 ||
+	    zImage_word(buf, ZIMAGE_MAGIC_OFFSET) != ZIMAGE_MAGIC)
+		return 0;
+	start = zImage_word(buf, ZIMAGE_START_OFFSET);
+	end = zImage_word(buf, ZIMAGE_END_OFFSET);
+	image = end - start;
+	if (image > len) {
+		ERROR("zImage is truncated: %lu bytes of %lu\n", (unsigned long)len, (unsigned long)image);
+		return -1;
+	}
+	size = 0;
+	bss = ZIMAGE_BSS_GUESS;
+	/* since 4.15 a tag says where the decompressed size is and how big bss is */
+	if (zImage_word(buf, ZIMAGE_MAGIC2_OFFSET) == ZIMAGE_MAGIC2) {
+		offset = zImage_word(buf, ZIMAGE_TABLE_OFFSET);
+		while (offset < image && image - offset >= 16) {
+			words = zImage_word(buf, offset);
+			if (words < 2 || words > (image - offset) / 4)
+				break;
+			if (words >= 4 && zImage_word(buf, offset + 4) == ZIMAGE_TAG_KRNL_SIZE) {
+				size_ptr = zImage_word(buf, offset + 8);
+				if (size_ptr <= image - 4) {
+					size = zImage_word(buf, size_ptr);
+					bss = zImage_word(buf, offset + 12);
+				}
+				break;
+			}
+			offset += words * 4;
+		}
+	}
+	/* before that the decompressor kept it in LC0, a list of its own addresses:
+	 * LC0 itself, __bss_start, _end, _edata and where the decompressed size is.
+	 */
+	for (offset = ZIMAGE_TABLE_OFFSET + 4; !size && offset + 20 <= image; offset += 4) {
+		if (zImage_word(buf, offset) != start + offset ||
+		    zImage_word(buf, offset + 12) != end ||
+		    zImage_word(buf, offset + 4) < end ||
+		    zImage_word(buf, offset + 8) < zImage_word(buf, offset + 4))
+			continue;
+		size_ptr = zImage_word(buf, offset + 16) - start;
+		if (size_ptr <= image - 4)
+			size = zImage_word(buf, size_ptr);
+	}
+	/* it can't be smaller than what it has been made from */
+	if (size < image)
+		return 0;
+	room = len + ZIMAGE_HEAP_SIZE;
+	if (room < bss)
+		room = bss;
+	return (off_t)size + room;
+}
+
+/** place the kernel and then the initrd in one walk over the free memory,
+ * the initrd goes in the first hole after the kernel that fits it
+ * @kernel_size: what the kernel needs from base on
+ * @initrd_len: 0 if there is no initrd
+ * @base, @initrd_base: where they go
+ * returns 0 on success, -1 if they don't fit.
+ */
+static int plan_layout(struct kexec_info *info, unsigned long kernel_size, unsigned long initrd_len,
+	unsigned long *base, unsigned long *initrd_base)
+{
+	struct free_walk w;
+	unsigned long long start, end, page;
+	int kernel_placed;
+
+	page = getpagesize();
+	kernel_placed = 0;
+	free_walk_start(&w, info);
+	while (free_walk_next(&w, &start, &end)) {
+		start = (start + page - 1) & ~(page - 1);
+		if (!kernel_placed) {
+			if (start >= end || end - start < kernel_size)
+				continue;
+			*base = start;
+			kernel_placed = 1;
+			if (!initrd_len)
+				return 0;
+			start = (start + kernel_size + page - 1) & ~(page - 1);
+		}
+		if (start < end && end - start >= initrd_len) {
+			*initrd_base = start;
+			return 0;
+		}
+	}
+	ERROR("could not find room for a %lx bytes kernel and a %lx bytes initrd\n", kernel_size, initrd_len);
+	return -1;
+}
+
+// how much of command_line goes in the ATAGs, its '\0' included
+static off_t command_line_size(const char *command_line)
 {
-	unsigned long base;
-	unsigned int atag_offset = 0x1000; /* 4k offset from memory start */
-	unsigned int offset = 0x8000;      /* 32k offset from memory start */
 	off_t command_line_len;
-	char *ramdisk_buf;
-	off_t ramdisk_length;
-	off_t ramdisk_offset;
 
 	command_line_len = 0;
-	ramdisk_buf = NULL;
-	ramdisk_length = 0;
 
 	if (command_line) {
 		command_line_len = strlen(command_line) + 1;
 		if (command_line_len > COMMAND_LINE_SIZE)
 			command_line_len = COMMAND_LINE_SIZE;
 	}
-	if (ramdisk) {
-		ramdisk_buf = slurp_file(ramdisk, &ramdisk_length);
-		if(!ramdisk_buf)
-			return -1;
-	}
+	return command_line_len;
+}
 
-	base = locate_hole(info,len+offset,0,0,ULONG_MAX,INT_MAX);
+int zImage_arm_load(const char *buf, char *command_line, const char *ramdisk_buf, off_t ramdisk_length, off_t len, struct kexec_info *info)
+{
+	unsigned long base, ramdisk_base;
+	unsigned int atag_offset = KEXEC_ARM_ATAGS_OFFSET; /* 4k offset from memory start */
+	unsigned int offset = KEXEC_ARM_ZIMAGE_OFFSET;     /* 32k offset from memory start */
+	off_t command_line_len;
+	off_t footprint;
 
-	if (base == ULONG_MAX)
-		return -1;
+	command_line_len = command_line_size(command_line);
 
-	/* assume the maximum kernel compression ratio is 4,
-	 * and just to be safe, place ramdisk after that
-	 */
-	ramdisk_offset = base + len * 4;
+	footprint = zImage_footprint(buf, len);
+	if (footprint < 0)
+		return -1;
+	if (!footprint) {
+		/* assume the maximum kernel compression ratio is 4,
+		 * and just to be safe, place ramdisk after that
+		 */
+		footprint = len * 4;
+	}
+	ramdisk_base = 0;
+	if (plan_layout(info, offset + footprint, (ramdisk_buf ? ramdisk_length : 0), &base, &ramdisk_base))
+		return -1;
+	DEBUG("kernel at %lx needs %lx bytes, initrd at %lx\n", base + offset, (unsigned long)footprint, ramdisk_base);
 
 	if (atag_arm_load(info, base + atag_offset,
 			 command_line, command_line_len,
-			 ramdisk_buf, ramdisk_length, ramdisk_offset))
+			 ramdisk_buf, ramdisk_length, ramdisk_base))
 		return -1;
 
-	add_segment_phys_virt(info, buf, len, base + offset, len);
+	if (add_segment_phys_virt(info, buf, len, base + offset, len))
+		return -1;
 
 	info->entry = (void*)base + offset;
 
@@ -567,9 +811,97 @@ int uImage_probe(const char *buf, off_t len, unsigned int arch)
 	return 0;
 }
 
-int uImage_load(const char *buf, char *cmdline, char *initrd, off_t len, struct kexec_info *info)
+int uImage_load(const char *buf, char *cmdline, const char *initrd, off_t initrd_len, off_t len, struct kexec_info *info)
 {
-	return zImage_arm_load(buf + sizeof(struct image_header), cmdline, initrd,len - sizeof(struct image_header), info);
+	return zImage_arm_load(buf + sizeof(struct image_header), cmdline, initrd, initrd_len, len - sizeof(struct image_header), info);
+}
+
+/** is buf an ELF file, like vmlinux
+ * returns 0 if it is, -1 if it isn't.
+ */
+static int elf_arm_probe(const char *buf, off_t len)
+{
+	if (len < SELFMAG || memcmp(buf, ELFMAG, SELFMAG))
+		return -1;
+	return 0;
+}
+
+/** load an uncompressed ELF kernel, there is nothing to decompress at boot.
+ * every PT_LOAD becomes a segment that points in buf,
+ * its bss is the part of memsz after filesz.
+ * vmlinux has only virtual addresses: PAGE_OFFSET goes at the first
+ * 16MB boundary with room for the kernel, that becomes its PHYS_OFFSET.
+ */
+static int elf_arm_load(const char *buf, char *command_line, const char *ramdisk_buf, off_t ramdisk_length, off_t len, struct kexec_info *info)
+{
+	struct mem_ehdr ehdr;
+	struct mem_phdr *phdr;
+	unsigned long low, high, virt_base, phys_base, entry, initrd_base;
+	off_t command_line_len;
+	int i, result;
+
+	if (build_elf_info(buf, len, &ehdr, 0) < 0) {
+		ERROR("invalid ELF kernel\n");
+		return -1;
+	}
+	result = -1;
+	if (ehdr.ei_class != ELFCLASS32 || ehdr.e_type != ET_EXEC || ehdr.e_machine != EM_ARM) {
+		ERROR("ELF kernel is not for 32 bit ARM\n");
+		goto out;
+	}
+	low = ULONG_MAX;
+	high = 0;
+	for (i = 0; i < ehdr.e_phnum; i++) {
+		phdr = ehdr.e_phdr + i;
+		if (phdr->p_type != PT_LOAD || !phdr->p_memsz)
+			continue;
+		if (phdr->p_vaddr < low)
+			low = phdr->p_vaddr;
+		if (phdr->p_vaddr + phdr->p_memsz > high)
+			high = phdr->p_vaddr + phdr->p_memsz;
+	}
+	if (high <= low) {
+		ERROR("ELF kernel has nothing to load\n");
+		goto out;
+	}
+	/* the kernel starts TEXT_OFFSET after PAGE_OFFSET */
+	virt_base = low & ~((unsigned long)ARM_PHYS_ALIGN - 1);
+	if (ehdr.e_entry < virt_base + KEXEC_ARM_ZIMAGE_OFFSET || ehdr.e_entry >= high) {
+		ERROR("ELF kernel entry %lx is out of its image\n", ehdr.e_entry);
+		goto out;
+	}
+	phys_base = locate_hole(info, high - virt_base, ARM_PHYS_ALIGN, 0, ULONG_MAX, 1);
+	if (phys_base == ULONG_MAX)
+		goto out;
+	for (i = 0; i < ehdr.e_phnum; i++) {
+		phdr = ehdr.e_phdr + i;
+		if (phdr->p_type != PT_LOAD)
+			continue;
+		if (add_segment_phys_virt(info, phdr->p_data, phdr->p_filesz,
+				phys_base + (phdr->p_vaddr - virt_base), phdr->p_memsz))
+			goto out;
+	}
+	entry = phys_base + (ehdr.e_entry - virt_base);
+	DEBUG("ELF kernel at %lx, entry %lx\n", phys_base, entry);
+
+	initrd_base = 0;
+	if (ramdisk_buf && ramdisk_length) {
+		initrd_base = locate_hole(info, ramdisk_length, 0, phys_base + (high - virt_base), ULONG_MAX, 1);
+		if (initrd_base == ULONG_MAX)
+			goto out;
+	}
+	command_line_len = command_line_size(command_line);
+	/* the running kernel finds the ATAGs from the entry, as for a zImage */
+	if (atag_arm_load(info, entry - KEXEC_ARM_ZIMAGE_OFFSET + KEXEC_ARM_ATAGS_OFFSET,
+			 command_line, command_line_len,
+			 ramdisk_buf, ramdisk_length, initrd_base))
+		goto out;
+
+	info->entry = (void *)entry;
+	result = 0;
+out:
+	free_elf_info(&ehdr);
+	return result;
 }
 
 int valid_memory_range(struct kexec_info *info,
@@ -582,20 +914,11 @@ int valid_memory_range(struct kexec_info *info,
 	if ((send > mem_max) || (sstart < mem_min)) {
 		return 0;
 	}
+	/* adjacent RAM ranges are already merged */
 	for (i = 0; i < info->memory_ranges; i++) {
-		unsigned long mstart, mend;
-		/* Only consider memory ranges */
-		if (info->memory_range[i].type != RANGE_RAM)
-			continue;
-		mstart = info->memory_range[i].start;
-		mend = info->memory_range[i].end;
-		if (i < info->memory_ranges - 1
-		    && mend == info->memory_range[i+1].start
-		    && info->memory_range[i+1].type == RANGE_RAM)
-			mend = info->memory_range[i+1].end;
-
 		/* Check to see if we are fully contained */
-		if ((mstart <= sstart) && (mend >= send)) {
+		if ((info->memory_range[i].start <= sstart) &&
+		    (info->memory_range[i].end > send)) {
 			return 1;
 		}
 	}
@@ -612,28 +935,14 @@ static int valid_memory_segment(struct kexec_info *info,
 	return valid_memory_range(info, sstart, send);
 }
 
-int sort_segments(struct kexec_info *info)
+/** see if any of the segments overlap,
+ * add_segment_phys_virt keeps them sorted.
+ */
+int check_segments(struct kexec_info *info)
 {
-	int i, j;
+	int i;
 	void *end;
 
-	/* Do a stupid insertion sort... */
-	for (i = 0; i < info->nr_segments; i++) {
-		int tidx;
-		struct kexec_segment temp;
-		tidx = i;
-		for (j = i +1; j < info->nr_segments; j++) {
-			if (info->segment[j].mem < info->segment[tidx].mem) {
-				tidx = j;
-			}
-		}
-		if (tidx != i) {
-			temp = info->segment[tidx];
-			info->segment[tidx] = info->segment[i];
-			info->segment[i] = temp;
-		}
-	}
-	/* Now see if any of the segments overlap */
 	end = 0;
 	for (i = 0; i < info->nr_segments; i++) {
 		if (end > info->segment[i].mem) {
@@ -1012,7 +1321,6 @@ static int build_mem_phdrs(const char *buf, off_t len, struct mem_ehdr *ehdr,
 			result = build_mem_elf64_phdr(buf, ehdr, i);
 		}
 		if (result < 0) {
-			free(ehdr->e_phdr);
 			return result;
 		}
 
@@ -1026,13 +1334,11 @@ static int build_mem_phdrs(const char *buf, off_t len, struct mem_ehdr *ehdr,
 			   (uintmax_t)len) {
 			/* The segment does not fit in the buffer */
 			DEBUG("ELF segment not in file\n");
-			free(ehdr->e_phdr);
 			return -1;
 		}
 		if ((phdr->p_paddr + phdr->p_memsz) < phdr->p_paddr) {
 			/* The memory address wraps */
 			DEBUG("ELF address wrap around\n");
-			free(ehdr->e_phdr);
 			return -1;
 		}
 		/* Remember where the segment lives in the buffer */
@@ -1225,7 +1531,6 @@ static int build_mem_shdrs(const char *buf, off_t len, struct mem_ehdr *ehdr,
 			result = build_mem_elf64_shdr(buf, ehdr, i);
 		}
 		if (result < 0) {
-			free(ehdr->e_shdr);
 			return result;
 		}
 		/* Check the section headers to be certain
@@ -1239,13 +1544,11 @@ static int build_mem_shdrs(const char *buf, off_t len, struct mem_ehdr *ehdr,
 			   (uintmax_t)len) {
 			/* The section does not fit in the buffer */
 			DEBUG("ELF section %zd not in file\n",i);
-			free(ehdr->e_shdr);
 			return -1;
 		}
 		if ((shdr->sh_addr + shdr->sh_size) < shdr->sh_addr) {
 			/* The memory address wraps */
 			DEBUG("ELF address wrap around\n");
-			free(ehdr->e_shdr);
 			return -1;
 		}
 		/* Remember where the section lives in the buffer */
@@ -1345,6 +1648,7 @@ void free_elf_info(struct mem_ehdr *ehdr)
 {
 	free(ehdr->e_phdr);
 	free(ehdr->e_shdr);
+	free(ehdr->e_note);
 	memset(ehdr, 0, sizeof(*ehdr));
 }
 
@@ -1507,22 +1811,18 @@ int elf_rel_set_symbol(struct mem_ehdr *ehdr,
 	return 0;
 }
 
-static int update_purgatory(struct kexec_info *info)
+/** compute the digest that purgatory checks before jumping to the new kernel.
+ * segments are hashed in their sorted order, the zero-fill without any buffer.
+ * @region: SHA256_REGIONS entries, filled with the hashed segments
+ */
+static void hash_segments(struct kexec_info *info, sha256_digest_t digest, struct sha256_region *region)
 {
-	static const uint8_t null_buf[256];
 	sha256_context ctx;
-	sha256_digest_t digest;
-	struct sha256_region region[SHA256_REGIONS];
 	int i, j;
-	/* Don't do anything if we are not using purgatory */
-	if (!info->rhdr.e_shdr) {
-		return 0;
-	}
-	memset(region, 0, sizeof(region));
+
+	memset(region, 0, SHA256_REGIONS * sizeof(struct sha256_region));
 	sha256_starts(&ctx);
-	/* Compute a hash of the loaded kernel */
 	for(j = i = 0; i < info->nr_segments; i++) {
-		unsigned long nullsz;
 		/* Don't include purgatory in the checksum.  The stack
 		 * in the bss will definitely change, and the .data section
 		 * will also change when we poke the sha256_digest in there.
@@ -1533,23 +1833,20 @@ static int update_purgatory(struct kexec_info *info)
 		}
 		sha256_update(&ctx, info->segment[i].buf,
 			      info->segment[i].bufsz);
-		nullsz = info->segment[i].memsz - info->segment[i].bufsz;
-		while(nullsz) {
-			unsigned long bytes = nullsz;
-			if (bytes > sizeof(null_buf)) {
-				bytes = sizeof(null_buf);
-			}
-			sha256_update(&ctx, null_buf, bytes);
-			nullsz -= bytes;
-		}
+		sha256_update_zeros(&ctx, info->segment[i].memsz - info->segment[i].bufsz);
 		region[j].start = (unsigned long) info->segment[i].mem;
 		region[j].len   = info->segment[i].memsz;
 		j++;
 	}
 	sha256_finish(&ctx, digest);
-	if(elf_rel_set_symbol(&info->rhdr, "sha256_regions", &region,sizeof(region)))
+}
+
+/** poke the digest and the hashed regions into purgatory */
+static int update_purgatory(struct kexec_info *info, sha256_digest_t digest, struct sha256_region *region)
+{
+	if(elf_rel_set_symbol(&info->rhdr, "sha256_regions", region, SHA256_REGIONS * sizeof(struct sha256_region)))
 		return -1;
-	if(elf_rel_set_symbol(&info->rhdr, "sha256_digest", &digest,sizeof(digest)))
+	if(elf_rel_set_symbol(&info->rhdr, "sha256_digest", digest, sizeof(sha256_digest_t)))
 		return -1;
 	return 0;
 }
@@ -1560,12 +1857,91 @@ static inline long kexec_load(void *entry, unsigned long nr_segments,
 	return (long) syscall(__NR_kexec_load, entry, nr_segments, segments, flags);
 }
 
-int k_load(char *kernel,char *initrd,char *cmdline)
+/** free the buffers of the loaded segments.
+ * some of them are mappings of the kernel or initrd files,
+ * some segments point into the same buffer ( zImage/uImage ).
+ */
+static void free_segments(struct kexec_info *info)
 {
-	char *kernel_buf;
-	off_t kernel_size;
-	int result,i;
+	int i;
+
+	for(i=0;i<info->nr_buffers;i++)
+		release_buffer(info->buffers + i);
+	free(info->buffers);
+	info->buffers = NULL;
+	info->nr_buffers = 0;
+	free(info->segment);
+	info->segment = NULL;
+	info->nr_segments = 0;
+}
+
+static inline long kexec_file_load(int kernel_fd, int initrd_fd,
+			unsigned long cmdline_len, const char *cmdline, unsigned long flags)
+{
+#if defined(__NR_kexec_file_load) && !defined(NO_KEXEC_FILE)
+	return (long) syscall(__NR_kexec_file_load, kernel_fd, initrd_fd, cmdline_len, cmdline, flags);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+// set once the running kernel told us it has no kexec_file_load
+static int kexec_file_unsupported = 0;
+
+/** let the running kernel read kernel and initrd by itself.
+ * it parses and decompresses them, we don't need to build any segment.
+ * returns 0 on success, -1 on error.
+ */
+static int k_file_load(char *kernel, char *initrd, char *cmdline)
+{
+	int kernel_fd, initrd_fd, result, err, phase;
+	unsigned long flags;
+
+	if (kexec_file_unsupported) {
+		errno = ENOSYS;
+		return -1;
+	}
+	flags = KEXEC_FILE_FLAGS;
+	initrd_fd = -1;
+	if ((kernel_fd = open(kernel, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	if (!initrd)
+		flags |= KEXEC_FILE_NO_INITRAMFS;
+	else if ((initrd_fd = open(initrd, O_RDONLY | O_CLOEXEC)) < 0) {
+		err = errno;
+		close(kernel_fd);
+		errno = err;
+		return -1;
+	}
+	// cmdline_len counts the trailing '\0'
+	phase = trace_begin("kexec_file_load");
+	result = kexec_file_load(kernel_fd, initrd_fd, (cmdline ? strlen(cmdline) + 1 : 0), cmdline, flags);
+	err = errno;
+	trace_end(phase);
+	if (result && (err == ENOSYS || err == EOPNOTSUPP))
+		kexec_file_unsupported = 1;
+	close(kernel_fd);
+	if (initrd_fd >= 0)
+		close(initrd_fd);
+	errno = err;
+	return (result ? -1 : 0);
+}
+
+/** build the segments ourselves and give them to kexec_load.
+ * kernel and initrd are loaded by two workers at the same time,
+ * we lay out the segments once we have both.
+ * @cancel: see k_load
+ * returns 0 on success, -1 on error.
+ */
+static int k_segments_load(char *kernel,char *initrd,char *cmdline, volatile int *cancel)
+{
+	struct segment_file kernel_file, initrd_file;
+	job kernel_job, initrd_job;
+	int result,i,err,phase;
 	struct kexec_info info;
+	sha256_digest_t digest;
+	struct sha256_region region[SHA256_REGIONS];
 
 	memset(&info, 0, sizeof(info));
 	info.segment = NULL;
@@ -1576,34 +1952,63 @@ int k_load(char *kernel,char *initrd,char *cmdline)
 	mem_max = ULONG_MAX;
 	mem_min = 0xA0000000;
 
-	result = 0;
-	/* slurp in the input kernel */
-	kernel_buf = slurp_decompress_file(kernel, &kernel_size);
-
-	if(!kernel_buf)
-		return -1;
-
-	if (get_memory_ranges(&info.memory_range, &info.memory_ranges)) {
+	memset(&kernel_file, 0, sizeof(kernel_file));
+	memset(&initrd_file, 0, sizeof(initrd_file));
+	kernel_file.filename = kernel;
+	kernel_file.decompress = 1;
+	kernel_job.name = "kernel";
+	kernel_job.run = segment_file_job;
+	kernel_job.arg = &kernel_file;
+	job_submit(&kernel_job);
+	// the running kernel decompresses the initrd by itself
+	initrd_file.filename = initrd;
+	initrd_file.decompress = 0;
+	initrd_job.name = "initrd";
+	initrd_job.run = segment_file_job;
+	initrd_job.arg = &initrd_file;
+	if(initrd)
+		job_submit(&initrd_job);
+
+	// read the memory layout while they work
+	result = get_memory_ranges(&info.memory_range, &info.memory_ranges);
+	if(result)
 		ERROR("could not get memory layout\n");
-		free(kernel_buf);
-		return -1;
+	if(job_wait(&kernel_job))
+		result = -1;
+	err = errno;
+	if(initrd && job_wait(&initrd_job))
+	{
+		result = -1;
+		err = errno;
 	}
-	if(uImage_probe(kernel_buf, kernel_size,IH_ARCH_ARM))
+	// from now on free_segments releases them
+	if(kernel_file.buf && own_buffer(&info, kernel_file.mem.buf, kernel_file.mem.len))
+		result = -1;
+	if(initrd_file.buf && own_buffer(&info, initrd_file.mem.buf, initrd_file.mem.len))
+		result = -1;
+	if(result)
 	{
-		// NOT uImage
-		if(zImage_arm_load(kernel_buf,cmdline,initrd,kernel_size, &info))
-		{
-			ERROR("cannot load \"%s\"\n",kernel);
-			free(kernel_buf);
-			return -1;
-		}
+		free_segments(&info);
+		errno = err;
+		return -1;
 	}
-	else if(uImage_load(kernel_buf,cmdline,initrd,kernel_size, &info))
+	if(K_CANCELLED(cancel))
+		goto cancelled;
+
+	if(!uImage_probe(kernel_file.buf, kernel_file.size,IH_ARCH_ARM))
+		result = uImage_load(kernel_file.buf,cmdline,initrd_file.buf,initrd_file.size,kernel_file.size, &info);
+	else if(!elf_arm_probe(kernel_file.buf, kernel_file.size))
+		result = elf_arm_load(kernel_file.buf,cmdline,initrd_file.buf,initrd_file.size,kernel_file.size, &info);
+	else
+		result = zImage_arm_load(kernel_file.buf,cmdline,initrd_file.buf,initrd_file.size,kernel_file.size, &info);
+	if(result)
 	{
 		ERROR("cannot load \"%s\"\n",kernel);
-		free(kernel_buf);
+		free_segments(&info);
 		return -1;
 	}
+	if(K_CANCELLED(cancel))
+		goto cancelled;
 
 	/* Verify all of the segments load to a valid location in memory */
 	for (i = 0; i < info.nr_segments; i++) {
@@ -1612,34 +2017,90 @@ int k_load(char *kernel,char *initrd,char *cmdline)
 				info.segment[i].mem,
 				((char *)info.segment[i].mem) +
 				info.segment[i].memsz);
-			free(kernel_buf);
-			for(i=0;i<info.nr_segments;i++)
-				if(info.segment[i].buf)
-					free((void *)info.segment[i].buf);
+			free_segments(&info);
 			return -1;
 		}
 	}
-	/* Sort the segments and verify we don't have overlaps */
-	if (sort_segments(&info) < 0) {
-		free(kernel_buf);
-		for(i=0;i<info.nr_segments;i++)
-			if(info.segment[i].buf)
-				free((void *)info.segment[i].buf);
+	/* Verify we don't have overlaps, they are already sorted */
+	if (check_segments(&info) < 0) {
+		free_segments(&info);
 		return -1;
 	}
 	/* if purgatory is loaded update it */
-	if(update_purgatory(&info))
+	if(info.rhdr.e_shdr)
 	{
-		ERROR("cannot update purgatory\n");
-		return -1;
+		phase = trace_begin("hashing");
+		hash_segments(&info, digest, region);
+		trace_end(phase);
+		if(update_purgatory(&info, digest, region))
+		{
+			ERROR("cannot update purgatory\n");
+			free_segments(&info);
+			return -1;
+		}
 	}
+	if(K_CANCELLED(cancel))
+		goto cancelled;
+	phase = trace_begin("kexec_load");
 	result = kexec_load(info.entry, info.nr_segments, info.segment, info.kexec_flags);
+	trace_end(phase);
 	if (result != 0)
 	{
 		ERROR("kexec_load failed: %s\n", strerror(errno));
 		DEBUG("entry       = %p flags = %lx\n", info.entry, info.kexec_flags);
 	}
+	// the kernel has its own copy now
+	free_segments(&info);
 	return result;
+
+cancelled:
+	free_segments(&info);
+	errno = ECANCELED;
+	return -1;
+}
+
+/** log how long backend took to load kernel, since start */
+static void log_load_time(const char *kernel, const char *backend, struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	INFO("\"%s\" loaded by %s in %ld ms\n", kernel, backend,
+		(end.tv_sec - start->tv_sec) * 1000 + (end.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+/** load kernel, initrd and cmdline into the running kernel.
+ * kexec_file_load is tried first, if the running kernel cannot do it
+ * ( too old, no loader for this image type, ... ) we fall back to kexec_load.
+ * @cancel: if not NULL, we give up as soon as *cancel is set ( errno = ECANCELED ).
+ *          it's checked between each loading stage.
+ * returns 0 on success, -1 on error.
+ */
+int k_load(char *kernel,char *initrd,char *cmdline, volatile int *cancel)
+{
+	struct timespec start;
+
+	if (K_CANCELLED(cancel)) {
+		errno = ECANCELED;
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (!k_file_load(kernel, initrd, cmdline)) {
+		log_load_time(kernel, "kexec_file_load", &start);
+		return 0;
+	}
+	if (errno != ENOSYS)
+		DEBUG("kexec_file_load \"%s\" - %s, trying kexec_load\n", kernel, strerror(errno));
+	if (k_segments_load(kernel, initrd, cmdline, cancel))
+		return -1;
+	log_load_time(kernel, "kexec_load", &start);
+	return 0;
+}
+
+/** drop the image loaded by k_load */
+int k_unload(void)
+{
+	return kexec_load(NULL, 0, NULL, KEXEC_FLAGS);
 }
 
 static inline long kexec_reboot(void)
@@ -12,6 +12,7 @@
 
 #include "elf.h"
 #include "sha256.h"
+#include "decompress.h"
 //#include "unused.h"
 
 #ifndef BYTE_ORDER
@@ -260,6 +261,29 @@ struct tag {
 #define tag_size(type)  ((sizeof(struct tag_header) + sizeof(struct type) + 3) >> 2)
 #define KEXEC_MAX_SEGMENTS 16
 
+/* the words the zImage decompressor puts at the beginning of the image,
+ * little endian. kernels since 4.15 also have a table of tags after them,
+ * one says where the decompressed size is and how big the kernel bss is.
+ */
+#define ZIMAGE_MAGIC_OFFSET	0x24
+#define ZIMAGE_START_OFFSET	0x28
+#define ZIMAGE_END_OFFSET	0x2c
+#define ZIMAGE_MAGIC2_OFFSET	0x34
+#define ZIMAGE_TABLE_OFFSET	0x38
+#define ZIMAGE_MAGIC		0x016f2818
+#define ZIMAGE_MAGIC2		0x45454545
+#define ZIMAGE_TAG_KRNL_SIZE	0x5a534c4b
+// the decompressor bss is followed by 64K of malloc space
+#define ZIMAGE_HEAP_SIZE	0x10000
+// older kernels don't tell us their bss, it has never been this big
+#define ZIMAGE_BSS_GUESS	(8 << 20)
+
+// where the running kernel expects the next one, from the start of its RAM
+#define KEXEC_ARM_ATAGS_OFFSET	0x1000
+#define KEXEC_ARM_ZIMAGE_OFFSET	0x8000
+// ARM_PATCH_PHYS_VIRT kernels want to start at a multiple of this
+#define ARM_PHYS_ALIGN		(16 << 20)
+
 struct sha256_region {
 	uint64_t start;
 	uint64_t len;
@@ -287,6 +311,13 @@ struct sha256_region {
 #define KEXEC_ON_CRASH 0x00000001
 #define KEXEC_ARCH_ARM     (40 << 16)
 #define KEXEC_FLAGS (KEXEC_ARCH_ARM | KEXEC_HARDBOOT | KEXEC_ON_CRASH )
+#define KEXEC_FILE_UNLOAD		0x00000001
+#define KEXEC_FILE_ON_CRASH		0x00000002
+#define KEXEC_FILE_NO_INITRAMFS	0x00000004
+// kexec_file_load has no hardboot flag, build with KEXEC_FILE=0 if your kernel needs it
+#define KEXEC_FILE_FLAGS (KEXEC_FILE_ON_CRASH)
+// k_load() has been asked to stop
+#define K_CANCELLED(c) ((c) && *(c))
 
 /*
  * Operating System Codes
@@ -380,9 +411,17 @@ typedef struct image_header {
 } image_header_t;
 
 
+/* memory that the segments point to, released by free_segments */
+struct kexec_buffer {
+	void *buf;
+	size_t len; /* length of the mapping, 0 if malloc'd */
+};
+
 struct kexec_info {
 	struct kexec_segment *segment;
 	int nr_segments;
+	struct kexec_buffer *buffers;
+	int nr_buffers;
 	struct memory_range *memory_range;
 	int memory_ranges;
 	void *entry;
@@ -410,11 +449,14 @@ extern const struct arch_map_entry arches[];
 int get_memory_ranges(struct memory_range **range, int *ranges);
 int valid_memory_range(struct kexec_info *info,
 		       unsigned long sstart, unsigned long send);
-int sort_segments(struct kexec_info *info);
+int check_segments(struct kexec_info *info);
 unsigned long locate_hole(struct kexec_info *info,
 	unsigned long hole_size, unsigned long hole_align,
 	unsigned long hole_min, unsigned long hole_max,
 	int hole_end);
+int build_elf_info(const char *buf, off_t len, struct mem_ehdr *ehdr,
+			uint32_t flags);
+void free_elf_info(struct mem_ehdr *ehdr);
 
 typedef int (probe_t)(const char *kernel_buf, off_t kernel_size);
 typedef int (load_t )(int argc, char **argv,
@@ -429,10 +471,6 @@ struct file_type {
 extern struct file_type file_type[];
 extern int file_types;
 
-//from other files
-char *zlib_decompress_file(const char *, off_t *);
-char *lzma_decompress_file(const char *, off_t *);
-
 /*
 #define OPT_HELP		'h'
 #define OPT_VERSION		'v'
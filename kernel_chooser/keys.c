@@ -0,0 +1,156 @@
+/* read the keys that are held down right now, straight from evdev.
+ * with INSTANT_BOOT we don't wait for the user to press a key:
+ * if nobody is holding one of HOLD_KEYS we boot the default entry at once.
+ * the main loop also reads the BUTTONS that are pressed from here.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+
+#include "common.h"
+#include "uevent.h"
+#include "keys.h"
+
+/** make the nodes of all the evdev devices known to the kernel
+ * @sysfs: where sysfs is mounted
+ * returns how many nodes we made.
+ */
+int keys_coldplug(const char *sysfs)
+{
+	char path[PATH_MAX];
+	struct dirent *d;
+	DIR *dir;
+	int n;
+
+	snprintf(path,sizeof(path),"%s/class/input",sysfs);
+	if(!(dir = opendir(path)))
+		return 0;
+	n = 0;
+	while((d = readdir(dir)))
+		if(!strncmp(d->d_name,"event",5))
+		{
+			snprintf(path,sizeof(path),INPUT_DIR "/%s",d->d_name);
+			if(!uevent_coldplug(sysfs,path))
+				n++;
+		}
+	closedir(dir);
+	return n;
+}
+
+/** check if one of HOLD_KEYS is down on any evdev device
+ * returns 1 if it is, 0 if not,
+ * -1 if we cannot read any device ( we don't know ).
+ */
+int keys_held(void)
+{
+	const int hold_keys[] = HOLD_KEYS;
+	unsigned char keys[KEY_MAX/8 + 1];
+	char path[PATH_MAX];
+	struct dirent *d;
+	DIR *dir;
+	int fd,i,held,devices;
+
+	if(!(dir = opendir(INPUT_DIR)))
+		return -1;
+	held = devices = 0;
+	while(!held && (d = readdir(dir)))
+	{
+		if(strncmp(d->d_name,"event",5))
+			continue;
+		snprintf(path,sizeof(path),INPUT_DIR "/%s",d->d_name);
+		if((fd = open(path,O_RDONLY|O_NONBLOCK|O_CLOEXEC)) < 0)
+			continue;
+		memset(keys,0,sizeof(keys));
+		if(ioctl(fd,EVIOCGKEY(sizeof(keys)),keys) >= 0)
+		{
+			devices++;
+			for(i=0;hold_keys[i]!=KEY_RESERVED;i++)
+				if(keys[hold_keys[i]/8] & (1 << (hold_keys[i]%8)))
+				{
+					DEBUG("key %d is held down on %s\n",hold_keys[i],path);
+					held = 1;
+					break;
+				}
+		}
+		close(fd);
+	}
+	closedir(dir);
+	if(!devices)
+		return -1;
+	return held;
+}
+
+/** open an evdev device, if it has one of BUTTONS
+ * returns the non blocking file descriptor, -1 if we cannot read it
+ * or it has none of them ( ENODEV ).
+ */
+int keys_open(const char *path)
+{
+	const int buttons[] = BUTTONS;
+	unsigned char bits[KEY_MAX/8 + 1];
+	int fd,i;
+
+	if((fd = open(path,O_RDONLY|O_NONBLOCK|O_CLOEXEC)) < 0)
+		return -1;
+	memset(bits,0,sizeof(bits));
+	if(ioctl(fd,EVIOCGBIT(EV_KEY,sizeof(bits)),bits) >= 0)
+		for(i=0;buttons[i]!=KEY_RESERVED;i++)
+			if(bits[buttons[i]/8] & (1 << (buttons[i]%8)))
+				return fd;
+	close(fd);
+	errno = ENODEV;
+	return -1;
+}
+
+/** open all the evdev devices that have BUTTONS
+ * @fds: where we put them
+ * @max: how many fds can take
+ * returns how many we opened.
+ */
+int keys_open_all(int *fds, int max)
+{
+	char path[PATH_MAX];
+	struct dirent *d;
+	DIR *dir;
+	int n;
+
+	if(!(dir = opendir(INPUT_DIR)))
+		return 0;
+	n = 0;
+	while(n < max && (d = readdir(dir)))
+	{
+		if(strncmp(d->d_name,"event",5))
+			continue;
+		snprintf(path,sizeof(path),INPUT_DIR "/%s",d->d_name);
+		if((fds[n] = keys_open(path)) >= 0)
+			n++;
+	}
+	closedir(dir);
+	return n;
+}
+
+/** the next button pressed on fd, its autorepeat counts too
+ * returns the key code, -1 when there are no more ( EAGAIN ) or on error.
+ */
+int keys_read(int fd)
+{
+	const int buttons[] = BUTTONS;
+	struct input_event ev;
+	int i;
+
+	while(read(fd,&ev,sizeof(ev)) == sizeof(ev))
+	{
+		// 0 is the release
+		if(ev.type != EV_KEY || !ev.value)
+			continue;
+		for(i=0;buttons[i]!=KEY_RESERVED;i++)
+			if(ev.code == buttons[i])
+				return ev.code;
+	}
+	return -1;
+}
@@ -0,0 +1,25 @@
+#ifndef _KEYS_H
+#define _KEYS_H
+
+#include <linux/input.h>
+
+// where we make the evdev nodes
+#define INPUT_DIR "/dev/input"
+/* keys that show the menu if they are held down at startup ( INSTANT_BOOT=1 ).
+ * volume keys on the tablet, ESC and space on the dock.
+ */
+#define HOLD_KEYS { KEY_VOLUMEUP, KEY_VOLUMEDOWN, KEY_ESC, KEY_SPACE, KEY_RESERVED }
+/* the buttons of the tablet, the main loop reads them from evdev.
+ * the keys of the dock come from the console.
+ */
+#define BUTTONS { KEY_VOLUMEUP, KEY_VOLUMEDOWN, KEY_POWER, KEY_RESERVED }
+// at most this many devices with BUTTONS are watched
+#define MAX_KEY_DEVICES 8
+
+int keys_coldplug(const char *);
+int keys_held(void);
+int keys_open(const char *);
+int keys_open_all(int *, int);
+int keys_read(int);
+
+#endif
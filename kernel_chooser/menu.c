@@ -3,8 +3,6 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <string.h>
-#include <curses.h>
-#include <menu.h>
 
 #include "menu.h"
 #include "common.h"
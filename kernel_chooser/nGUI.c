@@ -1,24 +1,83 @@
-#include <curses.h>
-#include <menu.h>
+#include <stdio.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
-#include <wait.h>
+#include <poll.h>
+#include <termios.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/kd.h>
+#include <linux/input.h>
 
 #include "common.h"
 #include "menu.h"
 #include "nGUI.h"
+#include "font.h"
+#include "trace.h"
 
-int	menu_i, menu_sizex, // size fo the menu_window ( getmaxyx does not work )
+/* we draw text straight on the framebuffer: the screen is a grid of cells,
+ * what we want on screen is in cells, what frame has is in drawn.
+ * nc_refresh draws only the cells that differ.
+ */
+struct cell
+{
+	unsigned char ch;
+	unsigned char color;
+};
+
+struct cell *cells, *drawn,
+						*saved; // what was under a popup
+int cols, lines; // size of the screen in cells
+font ui_font;
+const char *box; // BOX_GLYPHS or BOX_ASCII
+
+// the colors of the COLOR_* cells
+static const struct
+{
+	uint32_t fg,bg; // 0xRRGGBB
+	int alpha; // how much bg covers the background
+} palette[] =
+{
+	[COLOR_DEFAULT] = { 0xaaaaaa, 0x000000, 0 },
+	[COLOR_LOG_DEBUG] = { 0x00aaaa, 0x000000, 0 },
+	[COLOR_LOG_WARN] = { 0xffff55, 0x000000, 0 },
+	[COLOR_LOG_ERROR] = { 0xff5555, 0x000000, 0 },
+	[COLOR_MENU_BORDER] = { 0xaa0000, 0x000000, PANEL_ALPHA },
+	[COLOR_MENU_TEXT] = { 0xffffff, 0x000000, PANEL_ALPHA },
+	[COLOR_MENU_TITLE] = { 0x00aaaa, 0x000000, PANEL_ALPHA },
+	[COLOR_POPUP] = { 0xffffff, 0xaa0000, PANEL_ALPHA },
+	[COLOR_MENU_CURRENT] = { 0x000000, 0xaaaaaa, PANEL_ALPHA }
+};
+
+int	menu_i, menu_sizex, // size of the menu list, in cells
 		menu_sizey,
-		entries_count; // count of created entries ( useful for error handling )
-ITEM **items[MENU_COUNT]; // ncurses menu items
-MENU *menu[MENU_COUNT]; //, *menu2; // ncurses menu
-WINDOW 	*menu_window, // ncurses menu window
-				*messages_win; // ncurses messages window
-char 	**local_entries; // our padded copy of the items names
+		menu_x, menu_y; // where the list starts
+char **entries[MENU_COUNT]; // our copy of the items names
+int entries_count[MENU_COUNT],
+		selected[MENU_COUNT], // the current item
+		top[MENU_COUNT]; // the first item shown
+// the messages window, at the bottom. msg_x and msg_y are the cursor
+int msg_top, msg_sizex, msg_sizey, msg_x, msg_y;
+struct termios saved_tio; // how the console was before nc_init
+int help_shown; // the help popup is on the menu, the next key closes it
+int buttons; // evdev devices with our buttons, see nc_set_buttons
+// the preload thread prints messages while we draw the countdown
+pthread_mutex_t nc_lock = PTHREAD_MUTEX_INITIALIZER;
+// the screen is started by nc_ui, only if someone has to look at it
+enum { UI_DOWN, UI_STARTING, UI_UP } ui_state;
+pthread_mutex_t ui_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_t ui_thread; // who is starting the UI
+// messages pushed while the UI is not up, nc_ui shows them
+struct
+{
+	int color;
+	char *prefix;
+	char text[MAX_MESSAGE];
+} pending[MAX_PENDING_MESSAGES];
+int pending_count; // can be more than MAX_PENDING_MESSAGES, the others are lost
 
 struct _default_entries
 {
@@ -49,106 +108,320 @@ const struct _default_entries default_entries[] =
 #endif
 };
 
-void print_in_middle(WINDOW *win, int starty, int startx, int width, char *string)
+/* all the drawing functions clip to the screen
+ * NOTE: we must hold nc_lock
+ */
+static void put_char(int y, int x, int color, unsigned char c)
 {
-	int length, x, y;
-	float temp;
+	if(y < 0 || y >= lines || x < 0 || x >= cols)
+		return;
+	cells[y*cols + x].ch = c;
+	cells[y*cols + x].color = color;
+}
 
-	if(win == NULL)
-		win = stdscr;
-	getyx(win, y, x);
-	if(startx != 0)
-		x = startx;
-	if(starty != 0)
-		y = starty;
-	if(width == 0)
-		width = 80;
+/** write at most width characters of string
+ * returns how many have been written.
+ */
+static int put_text(int y, int x, int color, const char *string, int width)
+{
+	int i;
 
-	length = strlen(string);
-	temp = (width - length)/ 2;
-	x = startx + (int)temp;
-	mvwprintw(win, y, x, "%s", string);
-	refresh();
+	for(i=0;string[i] && i<width;i++)
+		put_char(y, x+i, color, string[i]);
+	return i;
 }
 
-/** copy src string to *dst, padding equally from right and left
- * @dest: destination char *
- * @src: source char *
- * @sizex: size of the padded string
-*/
-int copy_with_padd(char **dest, int sizex, char *src)
+static void fill(int y, int x, int h, int w, int color, unsigned char c)
+{
+	int i,j;
+
+	for(j=0;j<h;j++)
+		for(i=0;i<w;i++)
+			put_char(y+j, x+i, color, c);
+}
+
+static void create_box(int h, int w, int y, int x, int color)
+{
+	fill(y, x, h+1, w+1, color, ' ');
+	put_char(y, x, color, box[2]);
+	put_char(y, x + w, color, box[3]);
+	put_char(y + h, x, color, box[4]);
+	put_char(y + h, x + w, color, box[5]);
+	fill(y, x + 1, 1, w - 1, color, box[0]);
+	fill(y + h, x + 1, 1, w - 1, color, box[0]);
+	fill(y + 1, x, h - 1, 1, color, box[1]);
+	fill(y + 1, x + w, h - 1, 1, color, box[1]);
+}
+
+/** draw the cells that changed and show them
+ * NOTE: we must hold nc_lock
+ */
+static void nc_refresh(void)
 {
-	int len;
+	int i,c;
 
-	len = strlen(src);
-	*dest = malloc((sizex+1)*sizeof(char));
-	if(!*dest)
+	for(i=0;i<cols*lines;i++)
+		if(cells[i].ch != drawn[i].ch || cells[i].color != drawn[i].color)
+		{
+			c = cells[i].color;
+			fb_draw_glyph((i % cols)*ui_font.width, (i / cols)*ui_font.height, ui_font.width, ui_font.height,
+				(cells[i].ch == ' ' ? NULL : font_glyph(&ui_font, cells[i].ch)),
+				palette[c].fg, palette[c].bg, palette[c].alpha);
+			drawn[i] = cells[i];
+		}
+	fb_flush();
+}
+
+/** read keys one by one, without echo */
+static int raw_input(void)
+{
+	struct termios tio;
+
+	if(tcgetattr(0, &saved_tio))
+		return -1;
+	tio = saved_tio;
+	tio.c_lflag &= ~(ICANON | ECHO);
+	tio.c_iflag &= ~(IXON);
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	return tcsetattr(0, TCSANOW, &tio);
+}
+
+/** give the console back as we found it, fbcon draws again */
+static void console_mode(void)
+{
+	tcsetattr(0, TCSANOW, &saved_tio);
+	ioctl(0, KDSETMODE, KD_TEXT);
+	fb_release();
+}
+
+/** stop fbcon from drawing over us, read keys one by one
+ * returns 0 on success, -1 on error.
+ */
+static int graphics_mode(void)
+{
+	if(raw_input())
+		return -1;
+	// fbcon may draw over us now and then, we can live with it
+	if(ioctl(0, KDSETMODE, KD_GRAPHICS))
+		WARN("cannot put the console in graphics mode - %s\n", strerror(errno));
+	return 0;
+}
+
+/** read a byte that is coming, it can take ESC_DELAY_MS
+ * returns 0 on success, -1 on error.
+ */
+static int next_byte(unsigned char *c)
+{
+	struct pollfd pfd;
+
+	pfd.fd = 0;
+	pfd.events = POLLIN;
+	if(poll(&pfd, 1, ESC_DELAY_MS) <= 0)
+		return -1;
+	return (read(0, c, 1) == 1 ? 0 : -1);
+}
+
+/** wait for a key
+ * @timeout: milliseconds, -1 to wait forever
+ * returns the key, -1 on timeout or error
+ */
+static int nc_getch(int timeout)
+{
+	struct pollfd pfd;
+	unsigned char c;
+	int num;
+
+	pfd.fd = 0;
+	pfd.events = POLLIN;
+	while((num = poll(&pfd, 1, timeout)) < 0 && errno == EINTR);
+	if(num <= 0)
 	{
-		FATAL("malloc - %s\n",strerror(errno));
+		if(!num)
+			errno = EAGAIN;
 		return -1;
 	}
-	memset(*dest,' ',sizex);
-	strncpy(*dest+1,src,len);
-	*((*dest)+sizex)='\0';
-	return 0;
+	if((num = read(0, &c, 1)) != 1)
+	{
+		// the console has gone away
+		if(!num)
+			errno = EIO;
+		return -1;
+	}
+	if(c == '\r')
+		return NC_KEY_ENTER;
+	if(c != 27)
+		return c;
+	// ESC [ number final
+	if(next_byte(&c) || c != '[')
+		return NC_KEY_OTHER;
+	for(num=0;!next_byte(&c) && c >= '0' && c <= '9';)
+		num = num*10 + c - '0';
+	switch(c)
+	{
+		case 'A':
+			return NC_KEY_UP;
+		case 'B':
+			return NC_KEY_DOWN;
+		case '[': // F1 to F5, ESC [ [ letter
+			next_byte(&c);
+			break;
+		case '~':
+			if(num == 5)
+				return NC_KEY_PPAGE;
+			if(num == 6)
+				return NC_KEY_NPAGE;
+			// F14, our keymap gives it to volume down. nc_button has it too
+			if(num == 26 && !buttons)
+				return NC_KEY_DOWN;
+			break;
+	}
+	return NC_KEY_OTHER;
 }
 
-void create_box(int h, int w, int y, int x)
+/** read a key from the console, without waiting
+ * returns the key, -1 on error ( EAGAIN if there is none )
+ */
+int nc_read_key(void)
+{
+	return nc_getch(0);
+}
+
+/** the key for an evdev button, see NC_BUTTONS
+ * returns NC_KEY_OTHER if it's not one of them
+ */
+int nc_button(int code)
 {
+	const int map[][2] = NC_BUTTONS;
 	int i;
-	for(i = y; i <= y + h; i++)
-		mvhline(i,x,' ',w);
-	mvaddch(y, x, ACS_ULCORNER);
-	mvaddch(y, x + w, ACS_URCORNER);
-	mvaddch(y + h, x, ACS_LLCORNER);
-	mvaddch(y + h, x + w, ACS_LRCORNER);
-	mvhline(y, x + 1, ACS_HLINE, w - 1);
-	mvhline(y + h, x + 1, ACS_HLINE, w - 1);
-	mvvline(y + 1, x, ACS_VLINE, h - 1);
-	mvvline(y + 1, x + w, ACS_VLINE, h - 1);
-	refresh();
+
+	for(i=0;i<ARRAY_SIZE(map);i++)
+		if(map[i][0] == code)
+			return map[i][1];
+	return NC_KEY_OTHER;
+}
+
+/** tell us how many evdev devices with buttons are watched,
+ * the console keys they also send are ignored
+ */
+void nc_set_buttons(int count)
+{
+	buttons = count;
 }
 
 int nc_init(void)
 {
-	int sizex,sizey;
+	int width,height,sizey;
 
-	/* Initialize variables to free in case of errors */
-	for(menu_i=0; menu_i<MENU_COUNT; menu_i++) {
-		items[menu_i] = NULL;
-		menu[menu_i] = NULL;
+	if(fb_init())
+		return -1;
+	if(font_open(FONT_FILE, &ui_font))
+	{
+		if(errno != ENOENT)
+			WARN("cannot load \"%s\" - %s\n", FONT_FILE, strerror(errno));
+		if(font_console(0, &ui_font))
+		{
+			ERROR("cannot get the console font - %s\n", strerror(errno));
+			return -1;
+		}
+	}
+	box = (ui_font.count >= 256 ? BOX_GLYPHS : BOX_ASCII);
+	fb_size(&width, &height);
+	cols = width / ui_font.width;
+	lines = height / ui_font.height;
+	if(!cols || !lines)
+	{
+		ERROR("the font is bigger than the screen\n");
+		goto error;
 	}
+	// the screen starts empty, and so does frame
+	cells = calloc(cols*lines, sizeof(struct cell));
+	drawn = calloc(cols*lines, sizeof(struct cell));
+	saved = calloc(cols*lines, sizeof(struct cell));
+	if(!cells || !drawn || !saved)
+	{
+		ERROR("malloc - %s\n", strerror(errno));
+		goto error;
+	}
+	fill(0, 0, lines, cols, COLOR_DEFAULT, ' ');
+	memcpy(drawn, cells, cols*lines*sizeof(struct cell));
 
-	messages_win = menu_window = NULL;
-	local_entries = NULL;
-	entries_count = 0;
-
-	/* Initialize curses */
-	initscr(); // TODO: error checking
-	cbreak();
-	noecho();
-	curs_set(0);
-	keypad(stdscr, TRUE);
-
-	/* Initialize colors */
-	start_color();
-	use_default_colors();
-	init_pair(COLOR_LOG_DEBUG, COLOR_CYAN, -1);
-	init_pair(COLOR_LOG_WARN, COLOR_YELLOW, -1);
-	init_pair(COLOR_LOG_ERROR, COLOR_RED, -1);
-	init_pair(COLOR_MENU_BORDER, COLOR_RED, COLOR_BLACK);
-	init_pair(COLOR_MENU_TEXT, COLOR_WHITE, COLOR_BLACK);
-	init_pair(COLOR_MENU_TITLE, COLOR_CYAN, COLOR_BLACK);
-	init_pair(COLOR_POPUP, COLOR_WHITE, COLOR_RED);
-
-	/* Create messages window */
-	sizey = (LINES * MSG_HEIGHT_PERC)/100;
-	sizex = (COLS * MSG_WIDTH_PERC)/100;
-	//mvhline(LINES-sizey+1,0,ACS_HLINE,sizex);
-	messages_win = newwin(sizey-1,sizex,(LINES-sizey)+2,0);
-	scrollok(messages_win,TRUE);
-
-	refresh();
+	/* the messages window */
+	sizey = (lines * MSG_HEIGHT_PERC)/100;
+	msg_sizex = (cols * MSG_WIDTH_PERC)/100;
+	msg_sizey = (sizey > 1 ? sizey - 1 : 1);
+	msg_top = lines - msg_sizey;
+	msg_x = msg_y = 0;
+
+	if(graphics_mode())
+	{
+		ERROR("cannot read the keyboard - %s\n", strerror(errno));
+		goto error;
+	}
+	return 0;
+
+	error:
+	free(cells);
+	free(drawn);
+	free(saved);
+	cells = drawn = saved = NULL;
+	font_free(&ui_font);
+	return -1;
+}
+
+static void print_message(int i, char *prefix, char *text);
+
+/** bring up the screen, if it's not up yet.
+ * we don't pay for it when the default entry boots without showing anything.
+ * messages pushed until now are shown.
+ * NOTE: the background and the font are read from /data
+ * returns 0 on success, -1 on error.
+ */
+int nc_ui(void)
+{
+	int phase,i;
+
+	if(ui_state == UI_UP)
+		return 0;
+	// a FATAL while we are starting it
+	if(ui_state == UI_STARTING && pthread_equal(ui_thread,pthread_self()))
+		return 0;
+	// the preload thread can call FATAL too
+	pthread_mutex_lock(&ui_lock);
+	if(ui_state == UI_UP)
+	{
+		pthread_mutex_unlock(&ui_lock);
+		return 0;
+	}
+	ui_thread = pthread_self();
+	ui_state = UI_STARTING;
+	phase = trace_begin("nc_init");
+	i = nc_init();
+	trace_end(phase);
+	if(i)
+	{
+		ui_state = UI_DOWN;
+		pthread_mutex_unlock(&ui_lock);
+		return -1;
+	}
+	phase = trace_begin("fb_background");
+	fb_background();
+	trace_end(phase);
+
+	pthread_mutex_lock(&nc_lock);
+	for(i=0;i<pending_count && i<MAX_PENDING_MESSAGES;i++)
+		print_message(pending[i].color,pending[i].prefix,pending[i].text);
+	if(pending_count > MAX_PENDING_MESSAGES)
+	{
+		snprintf(pending[0].text,MAX_MESSAGE,"%d messages lost\n",pending_count - MAX_PENDING_MESSAGES);
+		print_message(COLOR_LOG_WARN,"[WARN ]",pending[0].text);
+	}
+	// one pass for all of them
+	nc_refresh();
+	pending_count = 0;
+	ui_state = UI_UP;
+	pthread_mutex_unlock(&nc_lock);
+	pthread_mutex_unlock(&ui_lock);
 	return 0;
 }
 
@@ -156,192 +429,165 @@ void nc_destroy_menu(void)
 {
 	int i;
 
-	for(menu_i=0; menu_i<MENU_COUNT; menu_i++) {
-		unpost_menu(menu[menu_i]);
-		free_menu(menu[menu_i]);
-		for(i=0; items[menu_i][i]; i++) // items are NULL-terminated
-		{
-			entries_count--;
-			free(local_entries[entries_count]);
-			free_item(items[menu_i][i]);
-		}
-		free(items[menu_i]);
+	for(menu_i=0; menu_i<MENU_COUNT; menu_i++)
+	{
+		for(i=0; entries[menu_i] && i<entries_count[menu_i]; i++)
+			free(entries[menu_i][i]);
+		free(entries[menu_i]);
+		entries[menu_i] = NULL;
+		entries_count[menu_i] = selected[menu_i] = top[menu_i] = 0;
 	}
-
-	delwin(menu_window);
-	free(local_entries);
+	menu_i = MENU_MAIN;
 }
 
 void nc_destroy(void)
 {
-	/*delwin(messages_win);
-	 * WARNING: call this function here causes a kernel panic.
-	 * NOTE:DEBUG("messages_win=%p",messages_win) return a valid pointer...
-	 * we have to find why this happens
-	 * NOTE: btw, kernel saying that all memory has freed...strange behaviour.
-	 */
+	if(ui_state != UI_UP)
+		return;
 
 #ifdef DEVELOPMENT
-	if (nc_push_message(COLOR_LOG_ERROR,"\nWE ARE LEAVING NCURSES NOW!","Last chance to see this output. press <ENTER> to continue...\n") == 0)
+	if (nc_push_message(COLOR_LOG_ERROR,"\nWE ARE LEAVING THE UI NOW!","Last chance to see this output. press <ENTER> to continue...\n") == 0)
 		nc_wait_enter(); //don't wait if we can't print the message
 #endif
 
-	clear();
-	endwin();
+	pthread_mutex_lock(&nc_lock);
+	// what we print from now on goes to the console
+	console_mode();
+	printf("\033[2J\033[H");
+	fflush(stdout);
+	free(cells);
+	free(drawn);
+	free(saved);
+	cells = drawn = saved = NULL;
+	font_free(&ui_font);
+	// nc_error can bring it up again
+	ui_state = UI_DOWN;
+	pthread_mutex_unlock(&nc_lock);
 }
 
-/* save ncurses state
-   used to temporarly leave ncusrses (run external program) */
+/* save the UI state
+   used to temporarly leave the UI (run external program) */
 void nc_save() {
-	unpost_menu(menu[menu_i]); // will repost when we get back
-	def_prog_mode();
-	endwin();
+	pthread_mutex_lock(&nc_lock);
+	console_mode();
+	pthread_mutex_unlock(&nc_lock);
 }
 
-/* restore curses state */
+/* restore the UI state */
 void nc_load() {
-	reset_prog_mode();
-	keypad(stdscr, true);
-	refresh();
+	if(graphics_mode())
+		ERROR("cannot read the keyboard - %s\n", strerror(errno));
+	pthread_mutex_lock(&nc_lock);
+	// frame still has everything, the screen doesn't
+	fb_redraw();
+	nc_refresh();
+	pthread_mutex_unlock(&nc_lock);
 }
 
-void draw_menu_border(void)
+// the items in the menu window
+static void draw_menu(void)
+{
+	int i,n,color;
+
+	for(i=0;i<menu_sizey;i++)
+	{
+		n = top[menu_i] + i;
+		color = (n == selected[menu_i] ? COLOR_MENU_CURRENT : COLOR_MENU_TEXT);
+		fill(menu_y+i, menu_x, 1, menu_sizex, color, ' ');
+		if(n < entries_count[menu_i])
+			put_text(menu_y+i, menu_x+1, color, entries[menu_i][n], menu_sizex-1);
+	}
+}
+
+static void draw_menu_border(void)
 {
 	int startx,starty,len;
 	/* Print a border around the main window and print a title */
-	getbegyx(menu_window,starty,startx);
-	startx -= 1;
-	starty -= 3;
+	startx = menu_x - 1;
+	starty = menu_y - 3;
 	len = strlen(PROMPT);
-	create_box(menu_sizey+3,menu_sizex+1,starty,startx);
-	mvhline(starty+2, startx+1, ACS_HLINE, menu_sizex);
-	mvaddch(starty+2,startx,ACS_LTEE);
-	mvaddch(starty+2,startx+menu_sizex+1,ACS_RTEE);
-	attron(COLOR_PAIR(COLOR_MENU_TITLE));
-	mvprintw(starty+1,startx + ((menu_sizex - len)/2),"%s",PROMPT);
-	attroff(COLOR_PAIR(COLOR_MENU_TITLE));
-	wrefresh(menu_window);
-	refresh();
+	create_box(menu_sizey+3,menu_sizex+1,starty,startx,COLOR_MENU_BORDER);
+	fill(starty+2, startx+1, 1, menu_sizex, COLOR_MENU_BORDER, box[0]);
+	put_char(starty+2,startx,COLOR_MENU_BORDER,box[6]);
+	put_char(starty+2,startx+menu_sizex+1,COLOR_MENU_BORDER,box[7]);
+	put_text(starty+1,startx + ((menu_sizex - len)/2),COLOR_MENU_TITLE,PROMPT,menu_sizex);
+}
+
+/** move the selection of the current menu
+ * @delta: how many items, negative goes up
+ */
+static void menu_move(int delta)
+{
+	int *c = &selected[menu_i], *t = &top[menu_i];
+
+	*c += delta;
+	if(*c >= entries_count[menu_i])
+		*c = entries_count[menu_i] - 1;
+	if(*c < 0)
+		*c = 0;
+	// keep it in the window
+	if(*c < *t)
+		*t = *c;
+	else if(*c >= *t + menu_sizey)
+		*t = *c - menu_sizey + 1;
 }
 
 int nc_compute_menu(menu_entry *list)
 {
-	int n_choices, default_count;
+	int n_choices, default_count, i;
 	menu_entry *current;
 
 	/* Compute menu size */
-	menu_sizey = (LINES * MENU_HEIGHT_PERC)/100;
-	menu_sizex = (COLS * MENU_WIDTH_PERC)/100;
+	menu_sizey = (lines * MENU_HEIGHT_PERC)/100;
+	menu_sizex = (cols * MENU_WIDTH_PERC)/100;
 
 	menu_sizex-=2; // borders
 	menu_sizey-=5; // borders + head
+	if(menu_sizex < 1 || menu_sizey < 1)
+	{
+		FATAL("the screen is too small for the menu\n");
+		return -1;
+	}
+	menu_x = (cols-menu_sizex)/2;
+	menu_y = 5;
 
 	/* Create items */
 	// count entries
 	for(n_choices=0,current=list;current;current=current->next,n_choices++);
 	// count the default ones
 	default_count = ARRAY_SIZE(default_entries);
-	// sum
-	items[MENU_MAIN] = (ITEM **)malloc((n_choices+1)*sizeof(ITEM *));
-	items[MENU_POWER] = (ITEM **)malloc((default_count+1)*sizeof(ITEM *));
-	local_entries = malloc((n_choices+default_count+1)*sizeof(char *));
-	if( !local_entries || !items[MENU_MAIN] || !items[MENU_POWER])
+	entries[MENU_MAIN] = malloc((n_choices+1)*sizeof(char *));
+	entries[MENU_POWER] = malloc((default_count+1)*sizeof(char *));
+	if(!entries[MENU_MAIN] || !entries[MENU_POWER])
 	{
 		FATAL("malloc - %s\n",strerror(errno));
 		goto error;
 	}
 	// create default entries
-	for(entries_count=0;entries_count<default_count;entries_count++)
-		if(copy_with_padd(local_entries+entries_count,menu_sizex,(char*)default_entries[entries_count].name))
-			goto error;
-		else
-		{
-			// HACK: store src pointer in item description
-			items[MENU_POWER][entries_count] = new_item(local_entries[entries_count], default_entries[entries_count].name);
-			if(!items[MENU_POWER][entries_count])
-			{
-				free(local_entries[entries_count]);
-				FATAL("new_item - %s\n",strerror(errno));
-				goto error;
-			}
-		}
-	items[MENU_POWER][default_count] = new_item(NULL,NULL);
-	for(current=list;current;current=current->next,entries_count++)
-		if(copy_with_padd(local_entries+entries_count,menu_sizex,current->name))
-			goto error;
-		else
-		{
-			// HACK: store src pointer in item description
-			items[MENU_MAIN][entries_count-default_count] = new_item(local_entries[entries_count], current->name);
-			if(!items[MENU_MAIN][entries_count-default_count])
-			{
-				free(local_entries[entries_count]);
-				FATAL("new_item - %s\n",strerror(errno));
-				goto error;
-			}
-		}
-	items[MENU_MAIN][entries_count-default_count] = new_item(NULL,NULL);
-
-	/* Print title */
-	mvprintw(0,0,"%s",HEADER_LEFT);
-	mvprintw(0,COLS-strlen(HEADER_RIGHT),"%s",HEADER_RIGHT);
-	refresh();
-	fb_crefresh(0,0,COLS,1);
-
-	/* Create the window to be associated with the menu */
-	menu_window = newwin( menu_sizey, menu_sizex, 5, (COLS-menu_sizex)/2);
-	if(!menu_window)
-	{
-		FATAL("newwin - %s\n",strerror(errno));
-		goto error;
-	}
-	keypad(menu_window, TRUE);
-	if(wattron(menu_window,COLOR_PAIR(COLOR_MENU_TEXT))==ERR)
-		ERROR("wattron - %s\n",strerror(errno));
-	/* Set main window and sub window */
-
-	for(menu_i=0; menu_i<MENU_COUNT; menu_i++)
-	{
-		/* Create menu */
-		menu[menu_i] = new_menu((ITEM **)items[menu_i]);
-		if(!menu[menu_i])
+	for(i=0;i<default_count;i++,entries_count[MENU_POWER]++)
+		if(!(entries[MENU_POWER][i] = strdup(default_entries[i].name)))
 		{
-			FATAL("new_menu - %s\n",strerror(errno));
+			FATAL("malloc - %s\n",strerror(errno));
 			goto error;
 		}
-
-		/* Set menu option not to show the description */
-		menu_opts_off(menu[menu_i], O_SHOWDESC);
-		/* Change item color */
-		set_menu_back(menu[menu_i], COLOR_PAIR(COLOR_MENU_TEXT));
-
-		if(set_menu_win(menu[menu_i], menu_window)==ERR)
+	for(i=0,current=list;current;current=current->next,i++,entries_count[MENU_MAIN]++)
+		if(!(entries[MENU_MAIN][i] = strdup(current->name)))
 		{
-			FATAL("set_menu_win - %s\n",strerror(errno));
+			FATAL("malloc - %s\n",strerror(errno));
 			goto error;
 		}
-		// set menu size
-		if(set_menu_format(menu[menu_i], menu_sizey,1) != E_OK)
-			ERROR("set_menu_format - %s\n",strerror(errno));
-
-		/* Set menu mark  */
-		if(set_menu_mark(menu[menu_i], NULL)!= E_OK)
-			ERROR("set_menu_mark - %s\n",strerror(errno));
-	}
 	menu_i = MENU_MAIN;
 
-	wbkgd(menu_window,COLOR_PAIR(COLOR_MENU_TEXT));
-	attron(COLOR_PAIR(COLOR_MENU_BORDER));
-	draw_menu_border();
-	attroff(COLOR_PAIR(COLOR_MENU_BORDER));
-
-	attron(COLOR_PAIR(COLOR_LOG_ERROR));
-	mvprintw(7+menu_sizey,(COLS-strlen(HELP_MESSAGE))/2,HELP_MESSAGE);
-	attroff(COLOR_PAIR(COLOR_LOG_ERROR));
-	refresh();
-	//fb_crefresh((COLS-strlen(HELP_MESSAGE))/2,7+menu_sizey,strlen(HELP_MESSAGE),1);
+	pthread_mutex_lock(&nc_lock);
+	/* Print title */
+	put_text(0,0,COLOR_DEFAULT,HEADER_LEFT,cols);
+	put_text(0,cols-strlen(HEADER_RIGHT),COLOR_DEFAULT,HEADER_RIGHT,cols);
 
-	fb_crefresh(0,0,COLS,LINES); //redraw the whole background
+	draw_menu_border();
+	draw_menu();
+	put_text(7+menu_sizey,(cols-strlen(HELP_MESSAGE))/2,COLOR_LOG_ERROR,HELP_MESSAGE,cols);
+	nc_refresh();
+	pthread_mutex_unlock(&nc_lock);
 
 	return 0;
 	error:
@@ -350,35 +596,41 @@ int nc_compute_menu(menu_entry *list)
 }
 
 /* An error occurred, alert the user
- * If ncurses is active, create a popup
+ * If the UI is active, create a popup
  * Otherwise, write with printf
  * If the console is not actived, there is nothing we can do
  */
 void nc_error(char *fmt, ...)
 {
 	va_list ap;
-	char msg[COLS];
+	char msg[MAX_MESSAGE];
 
 	va_start(ap,fmt);
-	vsprintf(msg, fmt, ap);
+	vsnprintf(msg, MAX_MESSAGE, fmt, ap);
 	va_end(ap);
 
-	if (messages_win)
+	nc_ui();
+	if (ui_state == UI_UP)
 	{
 		int x, y, width;
+		pthread_mutex_lock(&nc_lock);
 		width = strlen(msg)-1;
-		if (msg[width] == '\n')
+		if (width >= 0 && msg[width] == '\n')
 			msg[width] = '\0';
 		if (width < strlen(FATAL_TITLE))
 			width = strlen(FATAL_TITLE);
-		x = (COLS-width)/2;
-		y = (LINES-4)/2;
-		attron(COLOR_PAIR(COLOR_POPUP));
-		create_box( 6, width+3, y-1, x-2);
-		mvprintw(y+0,x,FATAL_TITLE);
-		mvprintw(y+2,x,msg);
-		mvprintw(y+4,x,PRESS_ENTER);
+		x = (cols-width)/2;
+		y = (lines-4)/2;
+		memcpy(saved, cells, cols*lines*sizeof(struct cell));
+		create_box( 6, width+3, y-1, x-2, COLOR_POPUP);
+		put_text(y+0,x,COLOR_POPUP,FATAL_TITLE,cols);
+		put_text(y+2,x,COLOR_POPUP,msg,cols);
+		put_text(y+4,x,COLOR_POPUP,PRESS_ENTER,cols);
+		nc_refresh();
 		nc_wait_enter();
+		memcpy(cells, saved, cols*lines*sizeof(struct cell));
+		nc_refresh();
+		pthread_mutex_unlock(&nc_lock);
 	}
 	else
 	{
@@ -386,165 +638,209 @@ void nc_error(char *fmt, ...)
 		printf("%s\n\n",msg);
 		printf("press <ENTER> to continue...");
 		fflush(stdout);
-		fgets(msg,COLS,stdin);
+		fgets(msg,MAX_MESSAGE,stdin);
 	}
 }
 
-void nc_help_popup()
+/** the next key closes it
+ * NOTE: we must hold nc_lock
+ */
+static void nc_help_popup()
 {
 	int x, y, i;
 	const char *strings[] = HELP_PAGE;
-	x = (COLS-menu_sizex)/2+1;
-	y = 3;
+	x = menu_x+1;
+	y = menu_y-2;
 
-	unpost_menu(menu[menu_i]); // E_POSTED from nc_get_user_choice
-	attron(COLOR_PAIR(COLOR_POPUP));
-	create_box( menu_sizey+3, menu_sizex+1, y-1, x-2);
-	for(i=0;strings[i];i++)
+	memcpy(saved, cells, cols*lines*sizeof(struct cell));
+	create_box( menu_sizey+3, menu_sizex+1, y-1, x-2, COLOR_POPUP);
+	// it stays in the box
+	for(i=0;strings[i] && i<menu_sizey+1;i++)
 	{
-		mvprintw(y+i,x,strings[i]);
+		put_text(y+i,x,COLOR_POPUP,strings[i],menu_sizex-1);
 	}
-	mvprintw(y+i+1,(COLS-strlen(PRESS_ENTER))/2,PRESS_ENTER);
-
-	nc_wait_enter();
-	attron(COLOR_PAIR(COLOR_MENU_BORDER));
-	draw_menu_border();
+	put_text(y+i+1,(cols-strlen(PRESS_ENTER))/2,COLOR_POPUP,PRESS_ENTER,menu_sizex);
+	help_shown = 1;
 }
 
-int nc_get_user_choice()
+/** show the menu, the keys come through nc_key */
+void nc_show_menu(void)
 {
-	int c;
-
-	post_menu:
-
-	/* Post the menu */
-	if(post_menu(menu[menu_i])!=E_OK)
-	{
-		ERROR("post_menu - %s\n",strerror(errno));
-		goto error;
-	}
-	wrefresh(menu_window);
-	wrefresh(messages_win);
-	refresh();
-
-	fb_crefresh((COLS-menu_sizex)/2-1, 2, menu_sizex+2, menu_sizey+4);
+	pthread_mutex_lock(&nc_lock);
+	draw_menu();
+	nc_refresh();
+	pthread_mutex_unlock(&nc_lock);
+}
 
-	while((c = wgetch(menu_window)) != 10)
+/** handle a key on the menu
+ * returns the choice, MENU_NONE if the user is still choosing
+ */
+int nc_key(int c)
+{
+	pthread_mutex_lock(&nc_lock);
+	if(help_shown)
 	{
-		switch(c)
+		if(c == NC_KEY_ENTER)
 		{
-			case 278:
-			case KEY_DOWN:
-				menu_driver(menu[menu_i], REQ_DOWN_ITEM);
-				break;
-			//case KEY_VOLUMEUP: TODO
-			case KEY_UP:
-				menu_driver(menu[menu_i], REQ_UP_ITEM);
-				break;
-			case KEY_NPAGE:
-				menu_driver(menu[menu_i], REQ_SCR_DPAGE);
-				break;
-			case KEY_PPAGE:
-				menu_driver(menu[menu_i], REQ_SCR_UPAGE);
-				break;
-			case HELP_KEY:
-				nc_help_popup();
-				goto post_menu;
-			case MENU_TOGGLE_KEY:
-				unpost_menu(menu[menu_i]);
-				if (menu_i == MENU_POWER)
-					menu_i = MENU_MAIN;
-				else
-					menu_i = MENU_POWER;
-				goto post_menu;
-			case SCREENSHOT_KEY:
-				return MENU_SCREENSHOT;
+			memcpy(cells, saved, cols*lines*sizeof(struct cell));
+			help_shown = 0;
+			nc_refresh();
 		}
-		wrefresh(menu_window);
-		fb_crefresh((COLS-menu_sizex)/2-1, 2, menu_sizex+2, menu_sizey+4);
+		pthread_mutex_unlock(&nc_lock);
+		return MENU_NONE;
 	}
-
-	c = item_index(current_item(menu[menu_i]));
-	if (menu_i == MENU_MAIN)
+	switch(c)
 	{
-		if(c)
-			return c+1;
-		return MENU_DEFAULT;
+		case NC_KEY_ENTER:
+			pthread_mutex_unlock(&nc_lock);
+			c = selected[menu_i];
+			if(menu_i == MENU_POWER)
+				return default_entries[c].num;
+			if(c)
+				return c+1;
+			return MENU_DEFAULT;
+		case NC_KEY_DOWN:
+			menu_move(1);
+			break;
+		case NC_KEY_UP:
+			menu_move(-1);
+			break;
+		case NC_KEY_NPAGE:
+			menu_move(menu_sizey);
+			break;
+		case NC_KEY_PPAGE:
+			menu_move(-menu_sizey);
+			break;
+		case HELP_KEY:
+			nc_help_popup();
+			break;
+		case MENU_TOGGLE_KEY:
+			if (menu_i == MENU_POWER)
+				menu_i = MENU_MAIN;
+			else
+				menu_i = MENU_POWER;
+			break;
+		case SCREENSHOT_KEY:
+			pthread_mutex_unlock(&nc_lock);
+			return MENU_SCREENSHOT;
 	}
-	else if (menu_i == MENU_POWER)
+	if(!help_shown)
+		draw_menu();
+	nc_refresh();
+	pthread_mutex_unlock(&nc_lock);
+	return MENU_NONE;
+}
+
+/** the cursor of the messages window goes to the next line, scrolling it
+ * NOTE: we must hold nc_lock
+ */
+static void new_line(void)
+{
+	msg_x = 0;
+	if(++msg_y < msg_sizey)
+		return;
+	msg_y = msg_sizey - 1;
+	memmove(cells + msg_top*cols, cells + (msg_top+1)*cols, (msg_sizey-1)*cols*sizeof(struct cell));
+	fill(msg_top + msg_y, 0, 1, msg_sizex, COLOR_DEFAULT, ' ');
+}
+
+static void put_message(int color, const char *text)
+{
+	for(;*text;text++)
 	{
-		return default_entries[c].num;
+		if(*text == '\n')
+		{
+			new_line();
+			continue;
+		}
+		if(msg_x >= msg_sizex)
+			new_line();
+		put_char(msg_top + msg_y, msg_x++, color, *text);
 	}
+}
 
-	error:
-	return MENU_FATAL_ERROR;
+/** print text in the messages window
+ * NOTE: we must hold nc_lock
+ */
+static void print_message(int i, char *prefix, char *text)
+{
+	put_message(i, prefix);
+	put_message(COLOR_DEFAULT, " ");
+	put_message(COLOR_DEFAULT, text);
 }
 
+/** show a message, or keep it for later if the UI is not up */
 int nc_push_message(int i, char *prefix, char *fmt,...)
 {
 	va_list ap;
-	int sizex, sizey;
+	char text[MAX_MESSAGE];
 
-	if(!messages_win)
-		return ERR;
-
-	wattron(messages_win, COLOR_PAIR(i));
-	wprintw(messages_win,"%s ",prefix);
-	wattroff(messages_win, COLOR_PAIR(i));
-	wrefresh(messages_win);
 	va_start(ap,fmt);
-	vw_printw(messages_win,fmt,ap);
+	vsnprintf(text,MAX_MESSAGE,fmt,ap);
 	va_end(ap);
-	wrefresh(messages_win);
 
-	sizey = (LINES * MSG_HEIGHT_PERC)/100;
-	sizex = (COLS * MSG_WIDTH_PERC)/100;
-	fb_crefresh(0,(LINES-sizey)+2,sizex,sizey-2);
+	pthread_mutex_lock(&nc_lock);
+	if(ui_state == UI_UP)
+	{
+		print_message(i,prefix,text);
+		nc_refresh();
+	}
+	else if(pending_count++ < MAX_PENDING_MESSAGES)
+	{
+		pending[pending_count-1].color = i;
+		pending[pending_count-1].prefix = prefix;
+		memcpy(pending[pending_count-1].text,text,MAX_MESSAGE);
+	}
+	pthread_mutex_unlock(&nc_lock);
 
 	return 0;
 }
 
 void nc_wait_enter(void)
 {
-	while(getch() != 10);
+	int c;
+
+	while((c = nc_getch(-1)) != NC_KEY_ENTER && c != -1);
 }
 
 void nc_status(char *msg)
 {
 	int x, y;
-	y = (LINES/2)-1;
-	x = (COLS - strlen(msg))/2;
-	mvprintw(y,x,msg);
-	refresh();
+	// nobody is looking, and it will be old news
+	if(ui_state != UI_UP)
+		return;
+	y = (lines/2)-1;
+	x = (cols - strlen(msg))/2;
+	pthread_mutex_lock(&nc_lock);
+	put_text(y,x,COLOR_DEFAULT,msg,cols);
+	nc_refresh();
+	pthread_mutex_unlock(&nc_lock);
 }
 
-/** wait for a keypress while coutdown.
- * if user press something return 0.
- * -1 otherwise
+/** show how long the countdown has left, the first call brings up the UI
+ * @left: milliseconds, 0 when it's over
+ * returns 0 on success, -1 if there is no UI to show it
  */
-int nc_wait_for_keypress(void)
+int nc_countdown(int left)
 {
-	int x,y,timeout,len;
+	int x,y,len;
+	char msg[MAX_MESSAGE];
 
+	if(nc_ui())
+		return -1;
 	len = snprintf(NULL,0,WAIT_MESSAGE,0);
+	y = (lines/2)-1;
+	x = (cols - len)/2;
 
-	y = (LINES/2)-1;
-	x = (COLS - len)/2;
-
-	/* this set an internal timeout for the getch() call.
-	 * 'man 3 timeout' for more info.
-	 * wait one second between keypress checks
-	*/
-	timeout(1000);
-
-	for (timeout=TIMEOUT_BOOT; timeout>0; timeout--) {
-		mvprintw(y,x,WAIT_MESSAGE, timeout);
-		refresh();
-		fb_crefresh(x,y,len,1);
-		if (getch() != ERR) {
-			mvprintw(y,x,"%*s",COLS-x-1," ");
-			return 0;
-		}
+	pthread_mutex_lock(&nc_lock);
+	if(left > 0)
+	{
+		snprintf(msg,MAX_MESSAGE,WAIT_MESSAGE, (left + 999) / 1000);
+		put_text(y,x,COLOR_DEFAULT,msg,cols);
 	}
-	return -1;
+	else
+		fill(y,x,1,cols-x,COLOR_DEFAULT,' ');
+	nc_refresh();
+	pthread_mutex_unlock(&nc_lock);
+	return 0;
 }
@@ -10,12 +10,30 @@
 #define MENU_SCREENSHOT		-5
 #define MENU_DEFAULT		-6
 #define MENU_FATAL_ERROR	-7
+#define MENU_NONE			-8 /* nothing chosen yet */
+#define MENU_PROMPT			-9 /* show the menu */
 
 // menu screens
 #define MENU_COUNT 2
 #define MENU_MAIN  0
 #define MENU_POWER 1
 
+/* keys nc_getch reads from the console, besides the plain characters.
+ * the linux console sends escape sequences for them.
+ */
+#define NC_KEY_ENTER '\n'
+#define NC_KEY_UP    0x101
+#define NC_KEY_DOWN  0x102
+#define NC_KEY_NPAGE 0x103
+#define NC_KEY_PPAGE 0x104
+#define NC_KEY_OTHER 0x1ff // a sequence we don't know
+/* what the evdev buttons of the tablet do, read by the main loop.
+ * volume down also comes from the console, as F14.
+ */
+#define NC_BUTTONS { { KEY_VOLUMEUP, NC_KEY_UP }, { KEY_VOLUMEDOWN, NC_KEY_DOWN }, { KEY_POWER, NC_KEY_ENTER } }
+// how long the bytes after an ESC can take to arrive, in milliseconds
+#define ESC_DELAY_MS 50
+
 #define HELP_KEY 'h'
 #define MENU_TOGGLE_KEY 'r'
 #define SCREENSHOT_KEY '='
@@ -27,8 +45,20 @@
 #define MSG_HEIGHT_PERC 15
 #define MSG_WIDTH_PERC 100
 
+// how much the menu and the popups cover the background, from 0 to 255
+#define PANEL_ALPHA 200
+
+/* box drawing glyphs of the console fonts ( cp437 ) and the ones we use without them:
+ * horizontal, vertical, upper left, upper right, lower left, lower right, left tee, right tee
+ */
+#define BOX_GLYPHS "\xc4\xb3\xda\xbf\xc0\xd9\xc3\xb4"
+#define BOX_ASCII  "-|++++++"
+
+// messages kept until the UI is up, and their maximum length
+#define MAX_PENDING_MESSAGES 64
+#define MAX_MESSAGE 256
+
 #define WAIT_MESSAGE "Automatic boot in %2d..."
-#define TIMEOUT_BOOT 10 /* time to wait for the user to press a key */
 
 #define HEADER_LEFT "kernel_chooser v3"
 #define HEADER_RIGHT "github.com/tux-mind/tf201-dev/kernel_chooser"
@@ -72,11 +102,16 @@
 
 int nc_compute_menu(menu_entry *list);
 int nc_init(void);
+int nc_ui(void);
 void nc_destroy(void);
 void nc_destroy_menu(void);
 void nc_save();
 void nc_load();
 void nc_wait_enter(void);
-int nc_get_user_choice();
+void nc_show_menu(void);
+int nc_key(int);
+int nc_read_key(void);
+int nc_button(int);
+void nc_set_buttons(int);
 void nc_print_header(void);
-int nc_wait_for_keypress(void);
\ No newline at end of file
+int nc_countdown(int);
\ No newline at end of file
@@ -0,0 +1,286 @@
+/* resize 0xXXRRGGBB pictures with integers only.
+ * shrinking more than twice first averages boxes of whole pixels,
+ * then a bilinear pass reaches the exact size.
+ * the bilinear pass works on red and blue in one word and on green
+ * in another, the loops have no branches so the compiler can vectorize them.
+ * "make scale_test" checks it against a floating point version.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "scale.h"
+
+// mix a and b, w is the weight of b from 0 to 256
+static inline uint32_t lerp(uint32_t a, uint32_t b, uint32_t w)
+{
+	uint32_t rb,g;
+
+	rb = ((a & 0xff00ff) * (256 - w) + (b & 0xff00ff) * w) >> 8;
+	g = ((a & 0x00ff00) * (256 - w) + (b & 0x00ff00) * w) >> 8;
+	return (rb & 0xff00ff) | (g & 0x00ff00);
+}
+
+/** average boxes of kx*ky pixels
+ * @dst: (sw/kx)*(sh/ky) pixels, one row after the other
+ * returns 0 on success, -1 on error.
+ */
+static int box(const uint8_t *src, int sw, int sh, size_t stride, uint32_t *dst, int kx, int ky)
+{
+	int dw,dh,x,y,i,j;
+	uint32_t *sums,inv,p;
+	const uint32_t *row;
+
+	dw = sw/kx;
+	dh = sh/ky;
+	// red, green and blue of a row of boxes
+	if(!(sums = malloc(dw*3*sizeof(uint32_t))))
+		return -1;
+	// a division for every box is too slow, 0.16 fixed point reciprocal
+	inv = ((1 << 16) + kx*ky/2) / (kx*ky);
+	for(y=0;y<dh;y++,dst+=dw)
+	{
+		memset(sums,0,dw*3*sizeof(uint32_t));
+		for(j=0;j<ky;j++)
+		{
+			row = (const uint32_t *)(src + (y*ky + j)*stride);
+			for(x=0;x<dw;x++,row+=kx)
+				for(i=0;i<kx;i++)
+				{
+					p = row[i];
+					sums[x*3] += (p >> 16) & 0xff;
+					sums[x*3+1] += (p >> 8) & 0xff;
+					sums[x*3+2] += p & 0xff;
+				}
+		}
+		for(x=0;x<dw;x++)
+			dst[x] = ((sums[x*3] * inv + 0x8000) >> 16) << 16 |
+				((sums[x*3+1] * inv + 0x8000) >> 16) << 8 |
+				((sums[x*3+2] * inv + 0x8000) >> 16);
+	}
+	free(sums);
+	return 0;
+}
+
+/** where every destination pixel takes its source from, along one axis.
+ * pixel centers are aligned, the borders are repeated.
+ * @pos: the first source pixel
+ * @weight: how much of the next one, 0 to 256
+ */
+static void sample(int src, int dst, int *pos, uint32_t *weight)
+{
+	int64_t p,last;
+	int i;
+
+	last = (int64_t)(src - 1) << SCALE_SHIFT;
+	for(i=0;i<dst;i++)
+	{
+		// the center of i, ( i + 0.5 ) * src / dst - 0.5. adding a step would drift
+		p = ((int64_t)(2*i + 1) * src << SCALE_SHIFT) / (2*dst) - (1 << (SCALE_SHIFT - 1));
+		if(p < 0)
+			p = 0;
+		if(p > last)
+			p = last;
+		pos[i] = p >> SCALE_SHIFT;
+		weight[i] = (p >> (SCALE_SHIFT - 8)) & 0xff;
+	}
+}
+
+// one source row, stretched to the destination width
+static void scale_row(const uint32_t *src, int sw, uint32_t *dst, int dw, const int *xs, const uint32_t *wx)
+{
+	int x,next;
+
+	for(x=0;x<dw;x++)
+	{
+		next = xs[x] + (xs[x] < sw - 1);
+		dst[x] = lerp(src[xs[x]], src[next], wx[x]);
+	}
+}
+
+/** bilinear resize
+ * returns 0 on success, -1 on error.
+ */
+static int bilinear(const uint8_t *src, int sw, int sh, size_t stride, uint8_t *dst, int dw, int dh, size_t dstride)
+{
+	int *xs,*ys,x,y,row0,row1;
+	uint32_t *wx,*wy,*rows,*r0,*r1,*out;
+
+	xs = malloc(dw*sizeof(int));
+	wx = malloc(dw*sizeof(uint32_t));
+	ys = malloc(dh*sizeof(int));
+	wy = malloc(dh*sizeof(uint32_t));
+	// the two source rows we are between, already stretched
+	rows = malloc(dw*2*sizeof(uint32_t));
+	if(!xs || !wx || !ys || !wy || !rows)
+	{
+		free(xs);
+		free(wx);
+		free(ys);
+		free(wy);
+		free(rows);
+		errno = ENOMEM;
+		return -1;
+	}
+	sample(sw,dw,xs,wx);
+	sample(sh,dh,ys,wy);
+	r0 = rows;
+	r1 = rows + dw;
+	row0 = row1 = -1;
+	for(y=0;y<dh;y++)
+	{
+		if(row0 != ys[y])
+		{
+			// going down a row at a time, the old second row is the new first one
+			if(row1 == ys[y])
+			{
+				out = r0;
+				r0 = r1;
+				r1 = out;
+			}
+			else
+				scale_row((const uint32_t *)(src + ys[y]*stride),sw,r0,dw,xs,wx);
+			row0 = ys[y];
+			row1 = row0 + (row0 < sh - 1);
+			scale_row((const uint32_t *)(src + row1*stride),sw,r1,dw,xs,wx);
+		}
+		out = (uint32_t *)(dst + y*dstride);
+		for(x=0;x<dw;x++)
+			out[x] = lerp(r0[x],r1[x],wy[y]);
+	}
+	free(xs);
+	free(wx);
+	free(ys);
+	free(wy);
+	free(rows);
+	return 0;
+}
+
+/** resize a picture of 0xXXRRGGBB pixels
+ * @src, @sw, @sh, @stride: the picture, stride is in bytes
+ * @dst, @dw, @dh, @dstride: the resized one
+ * returns 0 on success, -1 on error.
+ */
+int scale_xrgb(const uint8_t *src, int sw, int sh, size_t stride, uint8_t *dst, int dw, int dh, size_t dstride)
+{
+	int kx,ky,ret;
+	uint32_t *small;
+
+	if(sw < 1 || sh < 1 || dw < 1 || dh < 1)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	kx = sw/dw;
+	ky = sh/dh;
+	if(kx < 2 && ky < 2)
+		return bilinear(src,sw,sh,stride,dst,dw,dh,dstride);
+	// bilinear only looks at 4 pixels, from far away the others must count too
+	if(kx < 2)
+		kx = 1;
+	if(ky < 2)
+		ky = 1;
+	if(!(small = malloc((size_t)(sw/kx)*(sh/ky)*sizeof(uint32_t))))
+		return -1;
+	ret = box(src,sw,sh,stride,small,kx,ky);
+	if(!ret)
+		ret = bilinear((uint8_t *)small,sw/kx,sh/ky,(sw/kx)*sizeof(uint32_t),dst,dw,dh,dstride);
+	free(small);
+	return ret;
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+// a made up picture, smooth enough for bilinear to be exact-ish
+static uint32_t test_color(int x, int y)
+{
+	return (x & 0xff) << 16 | (y & 0xff) << 8 | ((x + y) / 4 & 0xff);
+}
+
+// the same, with doubles and without the box pass
+static double reference(const uint32_t *src, int sw, int sh, int dw, int dh, int x, int y, int shift)
+{
+	double fx,fy,wx,wy,a,b,c,d;
+	int x0,y0,x1,y1;
+
+	fx = (x + 0.5) * sw / dw - 0.5;
+	fy = (y + 0.5) * sh / dh - 0.5;
+	fx = (fx < 0 ? 0 : fx > sw - 1 ? sw - 1 : fx);
+	fy = (fy < 0 ? 0 : fy > sh - 1 ? sh - 1 : fy);
+	x0 = fx;
+	y0 = fy;
+	x1 = (x0 < sw - 1 ? x0 + 1 : x0);
+	y1 = (y0 < sh - 1 ? y0 + 1 : y0);
+	wx = fx - x0;
+	wy = fy - y0;
+	a = (src[y0*sw + x0] >> shift) & 0xff;
+	b = (src[y0*sw + x1] >> shift) & 0xff;
+	c = (src[y1*sw + x0] >> shift) & 0xff;
+	d = (src[y1*sw + x1] >> shift) & 0xff;
+	return (a*(1-wx) + b*wx)*(1-wy) + (c*(1-wx) + d*wx)*wy;
+}
+
+int main(void)
+{
+	const int sizes[][4] =
+	{
+		{ 1280, 800, 1920, 1200 },
+		{ 1280, 800, 1366, 768 },
+		{ 1920, 1200, 1280, 800 },
+		{ 2560, 1600, 1280, 800 }, // box pass, halving is the same of bilinear
+		{ 100, 60, 100, 60 },
+		{ 1, 1, 64, 32 },
+	};
+	uint32_t *src,*dst;
+	int i,x,y,shift,sw,sh,dw,dh,bad;
+	double err,worst;
+	clock_t start;
+
+	for(bad=i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++)
+	{
+		sw = sizes[i][0];
+		sh = sizes[i][1];
+		dw = sizes[i][2];
+		dh = sizes[i][3];
+		src = malloc(sw*sh*4);
+		dst = malloc(dw*dh*4);
+		for(y=0;y<sh;y++)
+			for(x=0;x<sw;x++)
+				src[y*sw + x] = test_color(x,y);
+		start = clock();
+		if(scale_xrgb((uint8_t *)src,sw,sh,sw*4,(uint8_t *)dst,dw,dh,dw*4))
+		{
+			printf("%dx%d to %dx%d failed\n",sw,sh,dw,dh);
+			return EXIT_FAILURE;
+		}
+		printf("%dx%d to %dx%d in %.2f ms",sw,sh,dw,dh,(double)(clock() - start) * 1000 / CLOCKS_PER_SEC);
+		worst = 0;
+		for(y=0;y<dh;y++)
+			for(x=0;x<dw;x++)
+				for(shift=0;shift<24;shift+=8)
+				{
+					err = fabs(((dst[y*dw + x] >> shift) & 0xff) - reference(src,sw,sh,dw,dh,x,y,shift));
+					if(err > worst)
+						worst = err;
+				}
+		// the fixed point weights are 8 bits, the box pass moves pixel centers
+		printf(", worst error %.2f\n",worst);
+		if(worst > (sw >= 2*dw ? 4 : 2))
+			bad++;
+		free(src);
+		free(dst);
+	}
+	if(bad)
+	{
+		printf("%d FAILED\n",bad);
+		return EXIT_FAILURE;
+	}
+	printf("all good\n");
+	return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef _SCALE_H
+#define _SCALE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// bits after the point of the source coordinates
+#define SCALE_SHIFT 16
+
+int scale_xrgb(const uint8_t *, int, int, size_t, uint8_t *, int, int, size_t);
+
+#endif
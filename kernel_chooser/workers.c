@@ -0,0 +1,243 @@
+/* a small pool of threads for independent jobs,
+ * like loading the kernel and the initrd at the same time.
+ * threads are started when needed and live until we kexec.
+ * on top of it tasks run a graph of jobs, each one as soon
+ * as the ones it depends on have finished.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "workers.h"
+#include "trace.h"
+
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t wake, // a job has been queued
+								 done; // a job has finished
+	job *head,*tail;
+	int threads,
+			idle;
+	job_progress_t progress;
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, NULL };
+
+/** set the function that receives the events of all jobs.
+ * it's called from the worker threads.
+ */
+void job_set_progress_handler(job_progress_t handler)
+{
+	pool.progress = handler;
+}
+
+static int task_job(job *);
+
+/** tell the UI what j is doing
+ * @event: one of the JOB_* events
+ * @bytes: how much j has done
+ */
+void job_progress(job *j, int event, off_t bytes)
+{
+	job_progress_t handler = pool.progress;
+
+	// the UI shows what we load, not the startup steps
+	if(handler && j->run != task_job)
+		handler(j,event,bytes);
+}
+
+static void run_job(job *j)
+{
+	int result,err,phase;
+
+	job_progress(j,JOB_STARTED,0);
+	phase = trace_begin(j->name);
+	result = j->run(j);
+	err = errno;
+	trace_end(phase);
+	job_progress(j,(result ? JOB_FAILED : JOB_DONE),0);
+
+	pthread_mutex_lock(&pool.lock);
+	j->result = result;
+	j->err = err;
+	j->done = 1;
+	pthread_cond_broadcast(&pool.done);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+static void *worker(void *arg)
+{
+	job *j;
+
+	for(;;)
+	{
+		pthread_mutex_lock(&pool.lock);
+		pool.idle++;
+		while(!pool.head)
+			pthread_cond_wait(&pool.wake,&pool.lock);
+		pool.idle--;
+		j = pool.head;
+		if(!(pool.head = j->next))
+			pool.tail = NULL;
+		pthread_mutex_unlock(&pool.lock);
+		run_job(j);
+	}
+	return NULL;
+}
+
+/** queue j, a worker will run it as soon as possible.
+ * if we cannot start any thread j is run right now.
+ * returns 0.
+ */
+int job_submit(job *j)
+{
+	pthread_t thread;
+	int inline_run;
+
+	j->done = 0;
+	j->next = NULL;
+	inline_run = 0;
+	pthread_mutex_lock(&pool.lock);
+	if(!pool.idle && pool.threads < WORKERS)
+	{
+		if(!pthread_create(&thread,NULL,worker,NULL))
+		{
+			pthread_detach(thread);
+			pool.threads++;
+		}
+		else if(!pool.threads)
+			inline_run = 1;
+	}
+	if(!inline_run)
+	{
+		if(pool.tail)
+			pool.tail->next = j;
+		else
+			pool.head = j;
+		pool.tail = j;
+		pthread_cond_signal(&pool.wake);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	if(inline_run)
+		run_job(j);
+	return 0;
+}
+
+/** wait for j to finish
+ * returns what j returned, errno is set as j left it.
+ */
+int job_wait(job *j)
+{
+	pthread_mutex_lock(&pool.lock);
+	while(!j->done)
+		pthread_cond_wait(&pool.done,&pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+	errno = j->err;
+	return j->result;
+}
+
+// protects the state of all the tasks
+static pthread_mutex_t tasks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** submit the tasks of graph whose dependencies have all finished */
+static void start_ready(task **graph)
+{
+	task *t,*ready;
+	int i,j;
+
+	ready = NULL;
+	pthread_mutex_lock(&tasks_lock);
+	for(i=0;(t = graph[i]);i++)
+	{
+		if(t->state != TASK_WAITING)
+			continue;
+		for(j=0;t->deps[j] && t->deps[j]->state >= TASK_DONE;j++);
+		if(t->deps[j])
+			continue;
+		t->state = TASK_QUEUED;
+		t->next_ready = ready;
+		ready = t;
+	}
+	pthread_mutex_unlock(&tasks_lock);
+	// job_submit can run it right now, don't hold the lock
+	while((t = ready))
+	{
+		ready = t->next_ready;
+		job_submit(&t->job);
+	}
+}
+
+static int task_job(job *j)
+{
+	task *t = j->arg;
+	int i,result,err;
+
+	t->begin = trace_now();
+	result = err = 0;
+	for(i=0;t->deps[i];i++)
+		if(t->deps[i]->state == TASK_FAILED)
+		{
+			result = -1;
+			err = ECANCELED;
+			break;
+		}
+	if(!result && (result = t->run(t)))
+		err = errno;
+	t->end = trace_now();
+
+	pthread_mutex_lock(&tasks_lock);
+	t->state = (result ? TASK_FAILED : TASK_DONE);
+	pthread_mutex_unlock(&tasks_lock);
+	start_ready(t->graph);
+	errno = err;
+	return result;
+}
+
+/** start running the tasks of graph
+ * a task whose dependency failed fails with ECANCELED.
+ * @graph: NULL terminated, every task in it must be started only once
+ */
+void tasks_start(task **graph)
+{
+	task *t;
+	int i;
+
+	for(i=0;(t = graph[i]);i++)
+	{
+		t->graph = graph;
+		t->state = TASK_WAITING;
+		t->begin = t->end = 0;
+		memset(&(t->job),0,sizeof(job));
+		t->job.name = t->name;
+		t->job.run = task_job;
+		t->job.arg = t;
+	}
+	start_ready(graph);
+}
+
+/** wait for t to finish
+ * returns what t returned, errno is set as t left it.
+ */
+int task_wait(task *t)
+{
+	return job_wait(&(t->job));
+}
+
+/** trace why t finished when it did: t, the dependency
+ * of t that finished last, its own one and so on.
+ * NOTE: t must be finished
+ */
+void tasks_trace_critical_path(task *t)
+{
+	task *last;
+	int i;
+
+	for(;t;t=last)
+	{
+		trace_span(t->name,t->begin,t->end);
+		for(last=NULL,i=0;t->deps[i];i++)
+			if(!last || t->deps[i]->end > last->end)
+				last = t->deps[i];
+	}
+}
@@ -0,0 +1,64 @@
+#ifndef _WORKERS_H
+#define _WORKERS_H
+
+#include <sys/types.h>
+
+// the pool never grows over this ( we run on a quad-core SoC )
+#define WORKERS 4
+
+// events sent to the progress handler
+#define JOB_STARTED  0
+#define JOB_PROGRESS 1 /* bytes is how much the job has done */
+#define JOB_DONE     2
+#define JOB_FAILED   3
+
+typedef struct _job
+{
+	const char *name; // for the UI
+	int (*run)(struct _job *); // returns 0 on success, -1 on error ( errno is set )
+	void *arg;
+	// filled by the pool
+	int result,
+			err,
+			done;
+	struct _job *next;
+} job;
+
+typedef void (*job_progress_t)(job *, int, off_t);
+
+// a task can wait for at most this many other tasks
+#define TASK_MAX_DEPS 4
+
+// task states
+#define TASK_WAITING 0
+#define TASK_QUEUED  1
+#define TASK_DONE    2
+#define TASK_FAILED  3 /* also when one of its dependencies failed */
+
+/* a job that starts only when its dependencies have finished.
+ * tasks are grouped in a NULL terminated array, the graph.
+ */
+typedef struct _task
+{
+	const char *name;
+	int (*run)(struct _task *); // returns 0 on success, -1 on error ( errno is set )
+	void *arg;
+	struct _task *deps[TASK_MAX_DEPS+1]; // NULL terminated
+	// filled by tasks_start
+	struct _task **graph,
+							 *next_ready;
+	int state;
+	unsigned long long begin, // from trace_now
+										 end;
+	job job;
+} task;
+
+void job_set_progress_handler(job_progress_t);
+void job_progress(job *, int, off_t);
+int job_submit(job *);
+int job_wait(job *);
+void tasks_start(task **);
+int task_wait(task *);
+void tasks_trace_critical_path(task *);
+
+#endif
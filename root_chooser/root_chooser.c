@@ -23,7 +23,8 @@
  * 3) search for "newroot="
  * 4) parse as "block_device:root_directory:init_path,init_args"
  * 5) mount block_device on /newroot
- * 6) if /newroot/root_directory is a ext img mount it on /newroot
+ * 6) look at the first bytes of /newroot/root_directory:
+ *    if it's an ext/squashfs/erofs image mount it on /newroot
  * 7) if /newroot/root_directory is an initramfs mount it on /newroot
  * 8) chroot /newroot/root_directory
  * 9) execve init_script
@@ -49,9 +50,14 @@
 #include <sys/wait.h>
 
 #include "utils.h"
+#include "uevent.h"
+#include "detect_fs.h"
+#include "trace.h"
 #include "root_chooser.h"
 
 FILE * logfile;
+// the trace file on blkdev, it must be opened before we mount root over NEWROOT
+int trace_fd = -1;
 
 //fatal error occourred, boot up android
 void fatal(char **argv,char **envp)
@@ -65,16 +71,14 @@ void fatal(char **argv,char **envp)
 	execve("/init",argv,envp);
 }
 
-/* make /dev from /sys */
-void mdev(char **envp)
+/* append our phases to the trace file, if we opened one.
+ * do it before umounting NEWROOT, trace_fd keeps it busy.
+ */
+void dump_trace(void)
 {
-	pid_t pid;
-	if(!(pid = fork()))
-	{
-		char *mdev_argv[] = MDEV_ARGS;
-		execve(BUSYBOX,mdev_argv,envp);
-	}
-	waitpid(pid,NULL,0);
+	if(trace_fd >= 0 && trace_dump(trace_fd,"root_chooser"))
+		fprintf(logfile,"cannot write \"%s\" - %s\n",TRACE_LOG,strerror(errno));
+	trace_fd = -1;
 }
 
 /* substitute '\n' with '\0' */
@@ -239,6 +243,8 @@ int main(int argc, char **argv, char **envp)
              *blkdev,        // block device to mount on newroot
              **new_argv;     // init args
 	int i,mounted_twice; // general purpose integer
+	int phase;           // from trace_begin
+	struct detect_info image; // what root is
 
 	line = blkdev = root = NULL;
 	new_argv = NULL;
@@ -281,26 +287,35 @@ int main(int argc, char **argv, char **envp)
 		EXIT_SILENT;
 	}
 	start+=CMDLINE_OPTION_LEN;
-	if(parser(start,&blkdev,&root,&new_argv))
+	phase = trace_begin("parsing");
+	i = parser(start,&blkdev,&root,&new_argv);
+	trace_end(phase);
+	if(i)
 	{
 		free(line);
 		EXIT_ERROR("parsing failed");
 	}
 	free(line);
-	if(mount("sysfs","/sys","sysfs",MS_RELATIME,""))
+	phase = trace_begin("sysfs mount");
+	i = mount("sysfs","/sys","sysfs",MS_RELATIME,"");
+	trace_end(phase);
+	if(i)
 	{
 		EXIT_ERROR("unable to mount /sys");
 	}
-	mdev(envp);
-	// make sure this was made
-	for(i=1;access(blkdev, R_OK) && i < TIMEOUT;i++)
-	{
-		sleep(1);
-		mdev(envp);
-	}
+	// we need the loop device for image files
+	uevent_coldplug("/sys",LOOP_DEV);
+	// wait for blkdev, if it's not there yet
+	phase = trace_begin("device wait");
+	if(uevent_wait_for_device("/sys",blkdev,TIMEOUT))
+		fprintf(logfile,"waiting for \"%s\" - %s\n",blkdev,strerror(errno));
+	trace_end(phase);
 	umount("/sys");
 	//mount blkdev on NEWROOT
-	if(mount(blkdev,NEWROOT,"ext4",0,""))
+	phase = trace_begin("blkdev mount");
+	i = mount(blkdev,NEWROOT,"ext4",0,"");
+	trace_end(phase);
+	if(i)
 	{
 		fprintf(logfile,"unable to mount \"%s\" on %s - %s\n",blkdev,NEWROOT,strerror(errno));
 		free(blkdev);
@@ -310,8 +325,27 @@ int main(int argc, char **argv, char **envp)
 		EXIT_SILENT;
 	}
 	free(blkdev);
-	//if root is an ext image mount it on NEWROOT
-	if(!initrd_mount(root,NEWROOT) || !loop_mount(root,NEWROOT))
+	trace_fd = trace_open(TRACE_LOG,0);
+	// look only at the first bytes of root, and mount it on NEWROOT if it's an image
+	if(detect_image(root,&image))
+	{
+		fprintf(logfile,"cannot detect the type of \"%s\" - %s\n",root,strerror(errno));
+		i = -1;
+	}
+	else if(image.type == DETECT_ARCHIVE)
+	{
+		if((i = initrd_mount(root,NEWROOT)))
+			fprintf(logfile,"cannot extract \"%s\" ( %s, %llu bytes ) - %s\n",root,(image.compression ? image.compression : "cpio"),image.size,strerror(errno));
+	}
+	else if(image.type == DETECT_FS)
+	{
+		phase = trace_begin("loop_mount");
+		i = loop_mount(root,NEWROOT,image.filesystem);
+		trace_end(phase);
+	}
+	else // it's a directory
+		i = -1;
+	if(!i)
 	{
 		mounted_twice=1;
 		// root is NEWROOT now
@@ -333,6 +367,8 @@ int main(int argc, char **argv, char **envp)
 		line[i]='\0';
 		if(!access(line,R_OK|X_OK))
 		{
+			// the trace file could be out of the new root
+			dump_trace();
 			if(!chdir(root) && !chroot(root))
 			{
 				free(root);
@@ -354,6 +390,7 @@ int main(int argc, char **argv, char **envp)
 		else
 		{
 			fprintf(logfile,"cannot execute \"%s\" - %s\n",line,strerror(errno));
+			dump_trace();
 			free(line);
 			free(root);
 			for(i=0;new_argv[i];i++)
@@ -367,6 +404,7 @@ int main(int argc, char **argv, char **envp)
 	else
 	{
 		fprintf(logfile,"malloc - %s\n",strerror(errno));
+		dump_trace();
 		free(root);
 		for(i=0;new_argv[i];i++)
 			free(new_argv[i]);
@@ -13,7 +13,11 @@
 // start android init at start for give ADB access
 //#define ADB
 
-#define MDEV_ARGS { "/bin/mdev","-s",NULL }
+// the loop device used by loop_mount() ( LOOP_DEVICE in loop_mount.h )
+#define LOOP_DEV "/dev/loop0"
+
+// where we append our boot phases, on blkdev
+#define TRACE_LOG NEWROOT TRACE_FILE
 
 //where we looking for .root file
 #define DATA_DEV "/dev/mmcblk0p8"
@@ -0,0 +1,415 @@
+/* extract cpio archives ( newc, crc and odc formats ) while they are decompressed.
+ * we used to pipe the whole decompressed archive into busybox cpio,
+ * now we only need CPIO_BUFFER_SIZE bytes and the decoder window.
+ * extracted files overwrite the existing ones ( like "cpio -iu" ).
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "mimetypes.h"
+#include "cpio.h"
+
+struct cpio_stream
+{
+	cpio_read_t read;
+	void *ctx;
+	size_t pos,len;
+	unsigned long offset; // bytes consumed, for alignment
+	char buffer[CPIO_BUFFER_SIZE];
+};
+
+struct cpio_entry
+{
+	unsigned long ino,mode,uid,gid,nlink,filesize,namesize;
+	dev_t dev,rdev;
+	int odc; // odc archives are not padded
+	char name[PATH_MAX];
+};
+
+// remember hard links until the archive ends
+struct cpio_link
+{
+	dev_t dev;
+	unsigned long ino;
+	char *name;
+	struct cpio_link *next;
+};
+
+/* give us the next available bytes, up to len.
+ * returns how many bytes are in *data, 0 at the end of the stream, -1 on error.
+ */
+static ssize_t stream_peek(struct cpio_stream *s, char **data, size_t len)
+{
+	ssize_t ret;
+
+	if(s->pos == s->len)
+	{
+		do
+			ret = s->read(s->ctx,s->buffer,CPIO_BUFFER_SIZE);
+		while(ret < 0 && (errno == EINTR || errno == EAGAIN));
+		if(ret <= 0)
+			return ret;
+		s->pos = 0;
+		s->len = ret;
+	}
+	if(len > s->len - s->pos)
+		len = s->len - s->pos;
+	*data = s->buffer + s->pos;
+	s->pos += len;
+	s->offset += len;
+	return len;
+}
+
+/* copy exactly len bytes to dst, or skip them if dst is NULL */
+static int stream_read(struct cpio_stream *s, char *dst, size_t len)
+{
+	ssize_t ret;
+	char *data;
+
+	while(len)
+	{
+		if((ret = stream_peek(s,&data,len)) <= 0)
+		{
+			if(!ret)
+				errno = EIO; // truncated archive
+			return -1;
+		}
+		if(dst)
+		{
+			memcpy(dst,data,ret);
+			dst+=ret;
+		}
+		len-=ret;
+	}
+	return 0;
+}
+
+/* skip padding up to a multiple of 4 bytes ( newc and crc formats ) */
+static int stream_align(struct cpio_stream *s)
+{
+	return stream_read(s,NULL,(4 - (s->offset & 3)) & 3);
+}
+
+static unsigned long parse_number(const char *str, int len, int base)
+{
+	char tmp[12];
+
+	memcpy(tmp,str,len);
+	tmp[len] = '\0';
+	return strtoul(tmp,NULL,base);
+}
+
+/* read the next header and name into e.
+ * returns 0 on success, 1 at the end of the archive, -1 on error.
+ */
+static int read_header(struct cpio_stream *s, struct cpio_entry *e)
+{
+	char header[CPIO_NEWC_HEADER_LEN];
+	unsigned long rdev;
+
+	if(stream_read(s,header,MAX_MAGIC_LEN))
+		return -1;
+	if(!strncmp(header,CPIO_MAGIC,MAX_MAGIC_LEN))
+		e->odc = 1;
+	else if(!strncmp(header,CPIO_MAGIC_SVR4,MAX_MAGIC_LEN) || !strncmp(header,CPIO_MAGIC_CRC,MAX_MAGIC_LEN))
+		e->odc = 0;
+	else
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if(e->odc)
+	{
+		if(stream_read(s,header+MAX_MAGIC_LEN,CPIO_ODC_HEADER_LEN-MAX_MAGIC_LEN))
+			return -1;
+		e->dev      = parse_number(header+6,6,8);
+		e->ino      = parse_number(header+12,6,8);
+		e->mode     = parse_number(header+18,6,8);
+		e->uid      = parse_number(header+24,6,8);
+		e->gid      = parse_number(header+30,6,8);
+		e->nlink    = parse_number(header+36,6,8);
+		rdev        = parse_number(header+42,6,8);
+		e->namesize = parse_number(header+59,6,8);
+		e->filesize = parse_number(header+65,11,8);
+		// odc use the old 16 bit encoding for devices
+		e->rdev     = makedev((rdev >> 8) & 0xff,rdev & 0xff);
+	}
+	else
+	{
+		if(stream_read(s,header+MAX_MAGIC_LEN,CPIO_NEWC_HEADER_LEN-MAX_MAGIC_LEN))
+			return -1;
+		e->ino      = parse_number(header+6,8,16);
+		e->mode     = parse_number(header+14,8,16);
+		e->uid      = parse_number(header+22,8,16);
+		e->gid      = parse_number(header+30,8,16);
+		e->nlink    = parse_number(header+38,8,16);
+		e->filesize = parse_number(header+54,8,16);
+		e->dev      = makedev(parse_number(header+62,8,16),parse_number(header+70,8,16));
+		e->rdev     = makedev(parse_number(header+78,8,16),parse_number(header+86,8,16));
+		e->namesize = parse_number(header+94,8,16);
+	}
+	if(!e->namesize || e->namesize > PATH_MAX)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if(stream_read(s,e->name,e->namesize))
+		return -1;
+	e->name[e->namesize-1] = '\0';
+	if(!e->odc && stream_align(s))
+		return -1;
+	if(!strcmp(e->name,CPIO_TRAILER))
+		return 1;
+	return 0;
+}
+
+/* skip leading "/" and "./" */
+static char *clean_name(char *name)
+{
+	for(;;)
+	{
+		if(*name == '/')
+			name++;
+		else if(name[0] == '.' && name[1] == '/')
+			name+=2;
+		else
+			return name;
+	}
+}
+
+/* a name with a ".." component can take us out of the destination */
+static int escapes(const char *name)
+{
+	while(*name)
+	{
+		if(name[0] == '.' && name[1] == '.' && (name[2] == '/' || name[2] == '\0'))
+			return 1;
+		// the next component
+		while(*name && *name != '/')
+			name++;
+		while(*name == '/')
+			name++;
+	}
+	return 0;
+}
+
+/* write the entry data into fd */
+static int copy_data(struct cpio_stream *s, int fd, unsigned long len)
+{
+	ssize_t ret,written;
+	char *data;
+
+	while(len)
+	{
+		if((ret = stream_peek(s,&data,len)) <= 0)
+		{
+			if(!ret)
+				errno = EIO;
+			return -1;
+		}
+		len-=ret;
+		while(ret)
+		{
+			if((written = write(fd,data,ret)) < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				return -1;
+			}
+			data+=written;
+			ret-=written;
+		}
+	}
+	return 0;
+}
+
+static int extract_file(struct cpio_stream *s, int dirfd, const char *name, struct cpio_entry *e)
+{
+	int fd;
+
+	unlinkat(dirfd,name,0);
+	if((fd = openat(dirfd,name,O_WRONLY|O_CREAT|O_TRUNC|O_NOFOLLOW,0600)) < 0)
+		return -1;
+	if(copy_data(s,fd,e->filesize))
+	{
+		close(fd);
+		return -1;
+	}
+	return close(fd);
+}
+
+static int extract_symlink(struct cpio_stream *s, int dirfd, const char *name, struct cpio_entry *e)
+{
+	char target[PATH_MAX];
+
+	if(e->filesize >= PATH_MAX)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if(stream_read(s,target,e->filesize))
+		return -1;
+	target[e->filesize] = '\0';
+	unlinkat(dirfd,name,0);
+	return symlinkat(target,dirfd,name);
+}
+
+/* handle regular files with more than one link.
+ * newc archives store data only in the last link, odc ones in the first.
+ * we create the file when we see data and link all the other names to it.
+ */
+static int extract_hardlink(struct cpio_stream *s, int dirfd, const char *name, struct cpio_entry *e, struct cpio_link **links)
+{
+	struct cpio_link *l,*found;
+
+	for(found=*links;found && (found->dev != e->dev || found->ino != e->ino);found=found->next);
+	if(e->filesize || !found)
+	{
+		if(extract_file(s,dirfd,name,e))
+			return -1;
+		for(l=*links;l;l=l->next)
+			if(l->dev == e->dev && l->ino == e->ino)
+			{
+				unlinkat(dirfd,l->name,0);
+				if(linkat(dirfd,name,dirfd,l->name,0))
+					return -1;
+			}
+	}
+	else
+	{
+		if(escapes(found->name))
+		{
+			errno = EPERM;
+			return -1;
+		}
+		unlinkat(dirfd,name,0);
+		if(linkat(dirfd,found->name,dirfd,name,0))
+			return -1;
+	}
+	if(!(l = malloc(sizeof(struct cpio_link))) || !(l->name = strdup(name)))
+	{
+		free(l);
+		return -1;
+	}
+	l->dev = e->dev;
+	l->ino = e->ino;
+	l->next = *links;
+	*links = l;
+	return 0;
+}
+
+static int extract_entry(struct cpio_stream *s, int dirfd, struct cpio_entry *e, struct cpio_link **links)
+{
+	char *name;
+	int ret;
+
+	name = clean_name(e->name);
+	if(*name == '\0' || !strcmp(name,"."))
+		return stream_read(s,NULL,e->filesize);
+	if(escapes(name))
+	{
+		errno = EPERM;
+		return -1;
+	}
+
+	if(S_ISDIR(e->mode))
+	{
+		if(mkdirat(dirfd,name,0700) && errno != EEXIST)
+			return -1;
+		ret = stream_read(s,NULL,e->filesize);
+	}
+	else if(S_ISLNK(e->mode))
+		ret = extract_symlink(s,dirfd,name,e);
+	else if(S_ISREG(e->mode) && e->nlink > 1)
+		ret = extract_hardlink(s,dirfd,name,e,links);
+	else if(S_ISREG(e->mode))
+		ret = extract_file(s,dirfd,name,e);
+	else if(S_ISCHR(e->mode) || S_ISBLK(e->mode) || S_ISFIFO(e->mode) || S_ISSOCK(e->mode))
+	{
+		unlinkat(dirfd,name,0);
+		ret = mknodat(dirfd,name,e->mode & S_IFMT,e->rdev);
+		if(!ret)
+			ret = stream_read(s,NULL,e->filesize);
+	}
+	else
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if(ret)
+		return -1;
+	// as cpio(1) does, preserve owners only if we are root
+	if(!geteuid() && fchownat(dirfd,name,e->uid,e->gid,AT_SYMLINK_NOFOLLOW))
+		return -1;
+	// chown clears the set-id bits, and umask must not mask our mode
+	if(!S_ISLNK(e->mode) && fchmodat(dirfd,name,e->mode & 07777,0))
+		return -1;
+	return 0;
+}
+
+/** extract a cpio archive in dst folder
+ * @read: the function that gives us the archive
+ * @ctx: the read function context
+ * @dst: the directory to extract the archive into
+ * returns 0 on success, -1 on error ( errno is set )
+ */
+int cpio_extract(cpio_read_t read, void *ctx, const char *dst)
+{
+	struct cpio_stream *s;
+	struct cpio_entry *e;
+	struct cpio_link *links,*l;
+	int dirfd,ret,err;
+
+	links = NULL;
+	if((dirfd = open(dst,O_RDONLY|O_DIRECTORY)) < 0)
+		return -1;
+	s = malloc(sizeof(struct cpio_stream));
+	e = malloc(sizeof(struct cpio_entry));
+	if(!s || !e)
+	{
+		free(s);
+		free(e);
+		close(dirfd);
+		return -1;
+	}
+	s->read = read;
+	s->ctx = ctx;
+	s->pos = s->len = s->offset = 0;
+
+	while(!(ret = read_header(s,e)))
+	{
+		if(extract_entry(s,dirfd,e,&links))
+		{
+			ret = -1;
+			break;
+		}
+		// data of newc and crc archives are padded too
+		if(!e->odc && stream_align(s))
+		{
+			ret = -1;
+			break;
+		}
+	}
+	err = errno;
+	while(links)
+	{
+		l = links;
+		links = links->next;
+		free(l->name);
+		free(l);
+	}
+	free(s);
+	free(e);
+	close(dirfd);
+	errno = err;
+	return (ret < 0 ? -1 : 0);
+}
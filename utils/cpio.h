@@ -0,0 +1,20 @@
+#ifndef CPIO_H
+#define CPIO_H
+
+#include <sys/types.h>
+
+// size of the buffer between the decoder and the extractor
+#define CPIO_BUFFER_SIZE (1 << 15)
+#define CPIO_NEWC_HEADER_LEN 110
+#define CPIO_ODC_HEADER_LEN 76
+#define CPIO_TRAILER "TRAILER!!!"
+
+/** a function that reads up to len bytes from ctx into buf.
+ * it works like read(2): returns the number of bytes read,
+ * 0 at the end of the stream and -1 on error.
+ */
+typedef ssize_t (*cpio_read_t)(void *ctx, void *buf, size_t len);
+
+int cpio_extract(cpio_read_t, void *, const char *);
+
+#endif /* CPIO_H */
@@ -0,0 +1,671 @@
+/* one place to decompress kernels, initrds and root images.
+ * we read the first bytes once, look at the magic
+ * and give the file to the right decoder.
+ * files that we don't recognise are read as they are.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#include <lz4frame.h>
+#endif
+#ifdef HAVE_BZIP2
+#include <bzlib.h>
+#endif
+
+#include "mimetypes.h"
+#include "gzfile.h"
+#include "lzfile.h"
+#include "decompress.h"
+
+#if defined(HAVE_ZSTD) || defined(HAVE_LZ4) || defined(HAVE_BZIP2)
+// the whole input file, for the decoders that work on memory
+struct mapped
+{
+	const uint8_t *map;
+	size_t len,
+				 pos;
+};
+
+static int map_fd(int fd, struct mapped *m)
+{
+	struct stat st;
+	void *map;
+
+	if(fstat(fd,&st))
+		return -1;
+	if(!S_ISREG(st.st_mode) || !st.st_size)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if((map = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0)) == MAP_FAILED)
+		return -1;
+	madvise(map,st.st_size,MADV_SEQUENTIAL);
+	m->map = map;
+	m->len = st.st_size;
+	m->pos = 0;
+	return 0;
+}
+
+static void unmap(struct mapped *m)
+{
+	munmap((void *)m->map,m->len);
+}
+#endif
+
+/* read everything from a stream, growing the buffer as needed.
+ * @hint: the expected size, 0 if unknown.
+ */
+static char *stream_load(const struct decompressor *d, int fd, size_t hint, off_t *r_size)
+{
+	void *ctx;
+	char *buf,*tmp;
+	size_t size,allocated;
+	ssize_t ret;
+	int err;
+
+	if(!(ctx = d->open(fd)))
+		return NULL;
+	// one more byte, so we see the end of the stream without growing
+	allocated = (hint ? hint + 1 : DECOMPRESS_MIN_ALLOC);
+	if(!(buf = malloc(allocated)))
+	{
+		d->close(ctx);
+		return NULL;
+	}
+	size = 0;
+	for(;;)
+	{
+		if((ret = d->read(ctx,buf + size,allocated - size)) < 0)
+		{
+			if(errno == EINTR || errno == EAGAIN)
+				continue;
+			err = errno;
+			free(buf);
+			d->close(ctx);
+			errno = err;
+			return NULL;
+		}
+		if(!ret)
+			break;
+		size += ret;
+		if(size < allocated)
+			continue;
+		allocated <<= 1;
+		if(!(tmp = realloc(buf,allocated)))
+		{
+			free(buf);
+			d->close(ctx);
+			return NULL;
+		}
+		buf = tmp;
+	}
+	d->close(ctx);
+	*r_size = size;
+	return buf;
+}
+
+/* gzip, see zlib.c */
+
+static void *gz_open(int fd)
+{
+	return zlib_dopen(fd);
+}
+
+static ssize_t gz_read(void *ctx, void *buf, size_t len)
+{
+	return zlib_read(ctx,buf,len);
+}
+
+static void gz_close(void *ctx)
+{
+	zlib_close(ctx);
+}
+
+/* xz and lzma-alone, see lzma.c */
+
+static void *xz_open(int fd)
+{
+	LZFILE *lz;
+
+	if(lseek(fd,0,SEEK_SET) || (fd = dup(fd)) < 0)
+		return NULL;
+	if(!(lz = lzdopen(fd,"r")))
+		close(fd);
+	return lz;
+}
+
+static ssize_t xz_read(void *ctx, void *buf, size_t len)
+{
+	return lzread(ctx,buf,len);
+}
+
+static void xz_close(void *ctx)
+{
+	lzclose(ctx);
+}
+
+#ifdef HAVE_ZSTD
+
+struct zstd_ctx
+{
+	struct mapped in;
+	ZSTD_DStream *ds;
+	size_t pending; // 0 if the last frame is complete
+};
+
+static void *zstd_open(int fd)
+{
+	struct zstd_ctx *z;
+
+	if(!(z = malloc(sizeof(struct zstd_ctx))))
+		return NULL;
+	if(map_fd(fd,&(z->in)))
+	{
+		free(z);
+		return NULL;
+	}
+	if(!(z->ds = ZSTD_createDStream()) || ZSTD_isError(ZSTD_initDStream(z->ds)))
+	{
+		ZSTD_freeDStream(z->ds);
+		unmap(&(z->in));
+		free(z);
+		errno = ENOMEM;
+		return NULL;
+	}
+	z->pending = 0;
+	return z;
+}
+
+static ssize_t zstd_read(void *ctx, void *buf, size_t len)
+{
+	struct zstd_ctx *z = ctx;
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	size_t ret,last_in,last_out;
+
+	in.src = z->in.map;
+	in.size = z->in.len;
+	in.pos = z->in.pos;
+	out.dst = buf;
+	out.size = len;
+	out.pos = 0;
+	while(out.pos < out.size)
+	{
+		if(in.pos == in.size && !z->pending)
+			break; // the end
+		last_in = in.pos;
+		last_out = out.pos;
+		ret = ZSTD_decompressStream(z->ds,&out,&in);
+		if(ZSTD_isError(ret))
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		z->pending = ret;
+		if(in.pos == last_in && out.pos == last_out)
+		{
+			if(out.pos)
+				break;
+			errno = EIO; // truncated
+			return -1;
+		}
+	}
+	z->in.pos = in.pos;
+	return out.pos;
+}
+
+static void zstd_close(void *ctx)
+{
+	struct zstd_ctx *z = ctx;
+
+	ZSTD_freeDStream(z->ds);
+	unmap(&(z->in));
+	free(z);
+}
+
+/* zstd frames usually store their size, decode them in one call */
+static char *zstd_load(int fd, off_t *r_size)
+{
+	struct mapped in;
+	unsigned long long size;
+	size_t ret;
+	char *buf;
+
+	if(map_fd(fd,&in))
+		return NULL;
+	size = ZSTD_getFrameContentSize(in.map,in.len);
+	if(size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR || size > SIZE_MAX - 1)
+		size = 0;
+	else if((buf = malloc(size ? size : 1)))
+	{
+		ret = ZSTD_decompress(buf,size,in.map,in.len);
+		if(!ZSTD_isError(ret) && ret == size)
+		{
+			unmap(&in);
+			*r_size = size;
+			return buf;
+		}
+		// maybe there are more frames
+		free(buf);
+	}
+	unmap(&in);
+	return stream_load(decompress_probe(ZSTD_MAGIC,ZSTD_MAGIC_LEN),fd,size,r_size);
+}
+
+#endif /* HAVE_ZSTD */
+
+#ifdef HAVE_LZ4
+
+struct lz4_ctx
+{
+	struct mapped in;
+	int legacy;
+	LZ4F_dctx *dctx;
+	size_t pending; // 0 if the last frame is complete
+	// legacy blocks that do not fit the caller buffer
+	char *block;
+	size_t block_len,
+				 block_pos;
+};
+
+static void *lz4_open(int fd)
+{
+	struct lz4_ctx *l;
+
+	if(!(l = calloc(1,sizeof(struct lz4_ctx))))
+		return NULL;
+	if(map_fd(fd,&(l->in)))
+	{
+		free(l);
+		return NULL;
+	}
+	if(l->in.len >= LZ4_MAGIC_LEN && !memcmp(l->in.map,LZ4_LEGACY_MAGIC,LZ4_MAGIC_LEN))
+		l->legacy = 1;
+	else if(LZ4F_isError(LZ4F_createDecompressionContext(&(l->dctx),LZ4F_VERSION)))
+	{
+		unmap(&(l->in));
+		free(l);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return l;
+}
+
+static uint32_t lz4_le32(const uint8_t *p)
+{
+	return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+/* legacy format: magic, then blocks as "le32 compressed size, data".
+ * the stream ends with the input, a zero size or another stream
+ * ( linux pads concatenated initramfs ).
+ */
+static ssize_t lz4_legacy_read(struct lz4_ctx *l, char *buf, size_t len)
+{
+	size_t done,n;
+	uint32_t csize;
+	int ret;
+	char *dst;
+
+	for(done=0;done < len;)
+	{
+		if(l->block_pos < l->block_len)
+		{
+			n = l->block_len - l->block_pos;
+			if(n > len - done)
+				n = len - done;
+			memcpy(buf + done,l->block + l->block_pos,n);
+			l->block_pos += n;
+			done += n;
+			continue;
+		}
+		if(l->in.len - l->in.pos < 4)
+			break;
+		csize = lz4_le32(l->in.map + l->in.pos);
+		if(!memcmp(l->in.map + l->in.pos,LZ4_LEGACY_MAGIC,LZ4_MAGIC_LEN))
+		{
+			l->in.pos += 4;
+			continue;
+		}
+		if(!csize)
+			break;
+		l->in.pos += 4;
+		if(csize > l->in.len - l->in.pos || csize > LZ4_COMPRESSBOUND(LZ4_LEGACY_BLOCK_SIZE))
+		{
+			errno = EIO;
+			return -1;
+		}
+		// decode straight into the caller buffer if it's big enough
+		if(len - done >= LZ4_LEGACY_BLOCK_SIZE)
+			dst = buf + done;
+		else
+		{
+			if(!l->block && !(l->block = malloc(LZ4_LEGACY_BLOCK_SIZE)))
+				return -1;
+			dst = l->block;
+		}
+		ret = LZ4_decompress_safe((const char *)l->in.map + l->in.pos,dst,csize,LZ4_LEGACY_BLOCK_SIZE);
+		if(ret < 0)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		l->in.pos += csize;
+		if(dst == l->block)
+		{
+			l->block_len = ret;
+			l->block_pos = 0;
+		}
+		else
+			done += ret;
+	}
+	return done;
+}
+
+static ssize_t lz4_read(void *ctx, void *buf, size_t len)
+{
+	struct lz4_ctx *l = ctx;
+	size_t done,in_len,out_len;
+
+	if(l->legacy)
+		return lz4_legacy_read(l,buf,len);
+	for(done=0;done < len;)
+	{
+		if(l->in.pos == l->in.len)
+		{
+			if(!l->pending)
+				break;
+			if(done)
+				break;
+			errno = EIO; // truncated
+			return -1;
+		}
+		in_len = l->in.len - l->in.pos;
+		out_len = len - done;
+		l->pending = LZ4F_decompress(l->dctx,(char *)buf + done,&out_len,l->in.map + l->in.pos,&in_len,NULL);
+		if(LZ4F_isError(l->pending))
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		l->in.pos += in_len;
+		done += out_len;
+		// anything that is not another frame is padding
+		if(!l->pending && (l->in.len - l->in.pos < LZ4_MAGIC_LEN ||
+			memcmp(l->in.map + l->in.pos,LZ4_MAGIC,LZ4_MAGIC_LEN)))
+		{
+			l->in.pos = l->in.len;
+			break;
+		}
+	}
+	return done;
+}
+
+static void lz4_close(void *ctx)
+{
+	struct lz4_ctx *l = ctx;
+
+	if(l->dctx)
+		LZ4F_freeDecompressionContext(l->dctx);
+	free(l->block);
+	unmap(&(l->in));
+	free(l);
+}
+
+#endif /* HAVE_LZ4 */
+
+#ifdef HAVE_BZIP2
+
+struct bz_ctx
+{
+	struct mapped in;
+	bz_stream strm;
+	int end;
+};
+
+static void *bz_open(int fd)
+{
+	struct bz_ctx *b;
+
+	if(!(b = calloc(1,sizeof(struct bz_ctx))))
+		return NULL;
+	if(map_fd(fd,&(b->in)))
+	{
+		free(b);
+		return NULL;
+	}
+	if(BZ2_bzDecompressInit(&(b->strm),0,0) != BZ_OK)
+	{
+		unmap(&(b->in));
+		free(b);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return b;
+}
+
+static ssize_t bz_read(void *ctx, void *buf, size_t len)
+{
+	struct bz_ctx *b = ctx;
+	size_t done;
+	int ret;
+
+	for(done=0;done < len && !b->end;)
+	{
+		b->strm.next_in = (char *)b->in.map + b->in.pos;
+		b->strm.avail_in = b->in.len - b->in.pos;
+		b->strm.next_out = (char *)buf + done;
+		b->strm.avail_out = len - done;
+		ret = BZ2_bzDecompress(&(b->strm));
+		done = len - b->strm.avail_out;
+		b->in.pos = b->in.len - b->strm.avail_in;
+		if(ret == BZ_STREAM_END)
+		{
+			// "bzip2 file1 file2" makes concatenated streams
+			BZ2_bzDecompressEnd(&(b->strm));
+			if(b->in.len - b->in.pos < BZIP2_MAGIC_LEN ||
+				memcmp(b->in.map + b->in.pos,BZIP2_MAGIC,BZIP2_MAGIC_LEN) ||
+				BZ2_bzDecompressInit(&(b->strm),0,0) != BZ_OK)
+				b->end = 1;
+		}
+		else if(ret != BZ_OK)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		else if(b->in.pos == b->in.len && b->strm.avail_out)
+		{
+			errno = EIO; // truncated
+			return -1;
+		}
+	}
+	return done;
+}
+
+static void bz_close(void *ctx)
+{
+	struct bz_ctx *b = ctx;
+
+	if(!b->end)
+		BZ2_bzDecompressEnd(&(b->strm));
+	unmap(&(b->in));
+	free(b);
+}
+
+#endif /* HAVE_BZIP2 */
+
+/* raw files, we just read them */
+
+static void *raw_open(int fd)
+{
+	int *ctx;
+
+	if(lseek(fd,0,SEEK_SET) || !(ctx = malloc(sizeof(int))))
+		return NULL;
+	if((*ctx = dup(fd)) < 0)
+	{
+		free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+static ssize_t raw_read(void *ctx, void *buf, size_t len)
+{
+	return read(*(int *)ctx,buf,len);
+}
+
+static void raw_close(void *ctx)
+{
+	close(*(int *)ctx);
+	free(ctx);
+}
+
+static char *raw_load(int fd, off_t *r_size);
+
+// the last one must be the raw one
+static const struct decompressor decompressors[] =
+{
+	{ "gzip", GZIP_MAGIC, 2, zlib_decompress_fd, gz_open, gz_read, gz_close },
+	{ "xz", XZ_MAGIC, XZ_MAGIC_LEN, lzma_decompress_fd, xz_open, xz_read, xz_close },
+	{ "lzma", LZMA_MAGIC, LZMA_MAGIC_LEN, lzma_decompress_fd, xz_open, xz_read, xz_close },
+#ifdef HAVE_ZSTD
+	{ "zstd", ZSTD_MAGIC, ZSTD_MAGIC_LEN, zstd_load, zstd_open, zstd_read, zstd_close },
+#endif
+#ifdef HAVE_LZ4
+	{ "lz4", LZ4_MAGIC, LZ4_MAGIC_LEN, NULL, lz4_open, lz4_read, lz4_close },
+	{ "lz4", LZ4_LEGACY_MAGIC, LZ4_MAGIC_LEN, NULL, lz4_open, lz4_read, lz4_close },
+#endif
+#ifdef HAVE_BZIP2
+	{ "bzip2", BZIP2_MAGIC, BZIP2_MAGIC_LEN, NULL, bz_open, bz_read, bz_close },
+#endif
+	{ "raw", NULL, 0, raw_load, raw_open, raw_read, raw_close }
+};
+
+#define RAW_DECOMPRESSOR (decompressors + (sizeof(decompressors) / sizeof(decompressors[0])) - 1)
+
+static char *raw_load(int fd, off_t *r_size)
+{
+	struct stat st;
+
+	if(fstat(fd,&st))
+		return NULL;
+	// block and char devices have no size
+	return stream_load(RAW_DECOMPRESSOR,fd,(S_ISREG(st.st_mode) ? st.st_size : 0),r_size);
+}
+
+/** find the decompressor for a file that starts with buf
+ * @len: how many bytes are in buf
+ * never returns NULL, unknown files are "raw".
+ */
+const struct decompressor *decompress_probe(const char *buf, size_t len)
+{
+	const struct decompressor *d;
+
+	for(d=decompressors;d->magic;d++)
+		if(len >= d->magic_len && !memcmp(buf,d->magic,d->magic_len))
+			return d;
+	return d;
+}
+
+/** read the first bytes of fd and find its decompressor.
+ * fd is moved back to its start.
+ * returns NULL on error.
+ */
+const struct decompressor *decompress_probe_fd(int fd)
+{
+	char magic[DECOMPRESS_PROBE_LEN];
+	ssize_t len;
+
+	if(lseek(fd,0,SEEK_SET))
+		return NULL;
+	while((len = read(fd,magic,DECOMPRESS_PROBE_LEN)) < 0 && errno == EINTR);
+	if(len < 0 || lseek(fd,0,SEEK_SET))
+		return NULL;
+	return decompress_probe(magic,len);
+}
+
+/** decompress the whole fd into a malloc'd buffer
+ * @r_size: where we store the buffer size
+ * returns NULL on error.
+ */
+char *decompress_fd(int fd, off_t *r_size)
+{
+	const struct decompressor *d;
+
+	if(!(d = decompress_probe_fd(fd)))
+		return NULL;
+	if(d->load)
+		return d->load(fd,r_size);
+	return stream_load(d,fd,0,r_size);
+}
+
+/** decompress a whole file, reading it as it is if it's not compressed.
+ * returns NULL on error.
+ */
+char *decompress_file(const char *filename, off_t *r_size)
+{
+	char *buf;
+	int fd,err;
+
+	if(!filename)
+	{
+		*r_size = 0;
+		return NULL;
+	}
+	if((fd = open(filename,O_RDONLY)) < 0)
+		return NULL;
+	buf = decompress_fd(fd,r_size);
+	err = errno;
+	close(fd);
+	errno = err;
+	return buf;
+}
+
+/** open fd as a decompressed stream
+ * fd can be closed after this call.
+ * returns NULL on error.
+ */
+struct decompress_stream *decompress_open(int fd)
+{
+	struct decompress_stream *s;
+
+	if(!(s = malloc(sizeof(struct decompress_stream))))
+		return NULL;
+	if(!(s->d = decompress_probe_fd(fd)) || !(s->ctx = s->d->open(fd)))
+	{
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+/** read up to len decompressed bytes, like read(2)
+ * it takes a void * so it can be used as a cpio_read_t.
+ */
+ssize_t decompress_read(void *stream, void *buf, size_t len)
+{
+	struct decompress_stream *s = stream;
+
+	return s->d->read(s->ctx,buf,len);
+}
+
+void decompress_close(struct decompress_stream *s)
+{
+	s->d->close(s->ctx);
+	free(s);
+}
@@ -0,0 +1,44 @@
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <sys/types.h>
+
+// how many bytes we read to find the compression format
+#define DECOMPRESS_PROBE_LEN 6
+// first allocation when we don't known the decompressed size
+#define DECOMPRESS_MIN_ALLOC 65536
+// lz4 legacy format ( lz4 -l, used by linux ) blocks decompress to 8MB at most
+#define LZ4_LEGACY_BLOCK_SIZE (8 << 20)
+
+/** a compression format that we can decode.
+ * all functions receive a file descriptor at offset 0 and never close it.
+ */
+struct decompressor
+{
+	const char *name;
+	const char *magic; // NULL for the raw "decompressor"
+	size_t magic_len;
+	// decompress the whole file into a malloc'd buffer. NULL means "use the stream functions"
+	char *(*load)(int, off_t *);
+	// open a stream that works like read(2)
+	void *(*open)(int);
+	ssize_t (*read)(void *, void *, size_t);
+	void (*close)(void *);
+};
+
+// an open stream, see decompress_open
+struct decompress_stream
+{
+	const struct decompressor *d;
+	void *ctx;
+};
+
+const struct decompressor *decompress_probe(const char *, size_t);
+const struct decompressor *decompress_probe_fd(int);
+char *decompress_fd(int, off_t *);
+char *decompress_file(const char *, off_t *);
+struct decompress_stream *decompress_open(int);
+ssize_t decompress_read(void *, void *, size_t);
+void decompress_close(struct decompress_stream *);
+
+#endif /* DECOMPRESS_H */
@@ -0,0 +1,21 @@
+# optional decompressors, see decompress.c
+# include this after CFLAGS and LDFLAGS are set.
+# gzip and xz are always there, set one of these to 1 if your toolchain has the library. (defaults to 0)
+ZSTD?=0
+LZ4?=0
+BZIP2?=0
+
+ifeq ($(ZSTD), 1)
+    CFLAGS+=-DHAVE_ZSTD
+    LDFLAGS+=-lzstd
+endif
+
+ifeq ($(LZ4), 1)
+    CFLAGS+=-DHAVE_LZ4
+    LDFLAGS+=-llz4
+endif
+
+ifeq ($(BZIP2), 1)
+    CFLAGS+=-DHAVE_BZIP2
+    LDFLAGS+=-lbz2
+endif
@@ -2,12 +2,17 @@
  * you can find the plain-text magic database.
  * as usually, open source rocks ;)
  */
+// stat files over 2GB
+#define _FILE_OFFSET_BITS 64
 #include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/stat.h>
+#include "mimetypes.h"
 #include "detect_fs.h"
+#include "decompress.h"
 
 typedef signed char s1;
 typedef unsigned char u1;
@@ -32,22 +37,24 @@ u4 get_le_long(void *from)
     (u4)p[0];
 }
 
-extern FILE *logfile;
-
-const char *find_filesystem(char *file)
+/** read the first bytes of file into buffer
+ * the rest of buffer is zeroed, so short files never match a superblock.
+ * returns 0 on success, -1 on error.
+ */
+static int read_head(const char *file, char *buffer)
 {
-	char buffer[BUFFER_SIZE];
-	int fd,len,clustersize;
+	int fd,len;
 
+	memset(buffer,0,DETECT_BUFFER_SIZE);
 	if((fd = open(file,O_RDONLY)) < 0)
-			return NULL;
-	if(read(fd,buffer,BUFFER_SIZE) < 0)
-	{
-			close(fd);
-			return NULL;
-	}
+		return -1;
+	len = read(fd,buffer,DETECT_BUFFER_SIZE);
 	close(fd);
-	
+	return (len < 0 ? -1 : 0);
+}
+
+static const char *fs_from_buffer(char *buffer)
+{
 	// check for linux ext FS
 	if(FS_EXT(buffer))
 	{
@@ -58,7 +65,69 @@ const char *find_filesystem(char *file)
 		else
 			return "ext4";
 	}
-	// TODO: detect others FS
-	errno=EOPNOTSUPP;
+	if(FS_SQUASHFS(buffer))
+		return "squashfs";
+	if(FS_EROFS(buffer))
+		return "erofs";
 	return NULL;
+}
+
+const char *find_filesystem(char *file)
+{
+	char buffer[DETECT_BUFFER_SIZE];
+	const char *fs;
+
+	if(read_head(file,buffer))
+		return NULL;
+	if(!(fs = fs_from_buffer(buffer)))
+		errno=EOPNOTSUPP;
+	return fs;
+}
+
+/** find out what file is, reading only its first DETECT_BUFFER_SIZE bytes.
+ * @file: the file to check
+ * @info: where we store what we found
+ * returns 0 on success, -1 on error ( errno = EOPNOTSUPP if we don't known the file type ).
+ */
+int detect_image(const char *file, struct detect_info *info)
+{
+	char buffer[DETECT_BUFFER_SIZE];
+	struct stat st;
+	const struct decompressor *d;
+
+	memset(info,0,sizeof(struct detect_info));
+	if(stat(file,&st))
+		return -1;
+	info->size = st.st_size;
+	if(S_ISDIR(st.st_mode))
+	{
+		info->type = DETECT_DIR;
+		return 0;
+	}
+	if(!S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode))
+	{
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	if(read_head(file,buffer))
+		return -1;
+
+	if((d = decompress_probe(buffer,DETECT_BUFFER_SIZE))->magic)
+		info->compression = d->name;
+	// compressed images are initramfs, we cannot loop mount them anyway
+	if(info->compression ||
+		!strncmp(buffer,CPIO_MAGIC,MAX_MAGIC_LEN) ||
+		!strncmp(buffer,CPIO_MAGIC_SVR4,MAX_MAGIC_LEN) ||
+		!strncmp(buffer,CPIO_MAGIC_CRC,MAX_MAGIC_LEN))
+	{
+		info->type = DETECT_ARCHIVE;
+		return 0;
+	}
+	if((info->filesystem = fs_from_buffer(buffer)))
+	{
+		info->type = DETECT_FS;
+		return 0;
+	}
+	errno = EOPNOTSUPP;
+	return -1;
 }
\ No newline at end of file
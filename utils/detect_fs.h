@@ -1,3 +1,6 @@
+#ifndef DETECT_FS_H
+#define DETECT_FS_H
+
 #define FS_EXT_OFFSET			0x438
 #define FS_EXT(x)				(get_le_short(x+FS_EXT_OFFSET) == 0xEF53)
 #define EXT_JOURNAL_OFF			0x45c
@@ -6,5 +9,29 @@
 #define EXT_JOURNAL(x)			(get_le_long(x+EXT_JOURNAL_OFF) & 0x4)
 #define EXT_SMALL_INCOMPAT(x)	(get_le_long(x+EXT_INCOMPAT_OFF) < 0x40)
 #define EXT_SMALL_RO_COMPAT(x)	(get_le_long(x+EXT_RO_COMPAT_OFF) < 0x8)
-// how many bytes we should read?
-#define BUFFER_SIZE				1200
\ No newline at end of file
+#define FS_SQUASHFS(x)			(!memcmp(x,"hsqs",4))
+#define FS_EROFS_OFFSET			0x400
+#define FS_EROFS(x)				(get_le_long(x+FS_EROFS_OFFSET) == 0xE0F5E1E2)
+// how many bytes we should read? ( all the superblocks above are in the first 4KB )
+#define DETECT_BUFFER_SIZE		4096
+
+// what detect_image found
+#define DETECT_UNKNOWN			0
+#define DETECT_DIR				1
+#define DETECT_ARCHIVE			2 /* a cpio archive, maybe compressed ( initramfs ) */
+#define DETECT_FS				3 /* a filesystem image to loop mount */
+
+struct detect_info
+{
+	int type;
+	const char *compression, // the decompressor name ( "gzip", "xz", ... ) or NULL
+				*filesystem; // the type to give to mount(2)
+	unsigned long long size; // from stat(2), images can be over 2GB
+};
+
+unsigned short int get_le_short(void *);
+unsigned long int get_le_long(void *);
+const char *find_filesystem(char *);
+int detect_image(const char *, struct detect_info *);
+
+#endif /* DETECT_FS_H */
\ No newline at end of file
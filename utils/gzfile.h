@@ -0,0 +1,39 @@
+#ifndef GZFILE_H
+#define GZFILE_H
+
+#include <sys/types.h>
+#include <zlib.h>
+
+// gzip member layout ( RFC 1952 )
+#define GZ_HEADER_LEN 10
+#define GZ_TRAILER_LEN 8
+#define GZ_FHCRC 0x02
+#define GZ_FEXTRA 0x04
+#define GZ_FNAME 0x08
+#define GZ_FCOMMENT 0x10
+// deflate cannot compress better than this, an ISIZE above it is garbage
+#define GZ_MAX_RATIO 1032
+// first allocation when we cannot trust ISIZE
+#define GZ_MIN_ALLOC 65536
+
+typedef struct
+{
+	unsigned char *map; // the whole mmap'd input
+	size_t len,
+				 pos; // next input byte to read
+	z_stream strm;
+	uLong crc, // of the current member
+				isize;
+	int end; // no more members
+} ZFILE;
+
+ZFILE *zlib_dopen(int);
+ZFILE *zlib_open(const char *);
+ssize_t zlib_read(ZFILE *, void *, size_t);
+size_t zlib_expected_size(ZFILE *);
+void zlib_close(ZFILE *);
+char *zlib_decompress_fd(int, off_t *);
+char *zlib_decompress_file(const char *, off_t *);
+int read_first_bytes_of_archive(char *, char *, int);
+
+#endif /* GZFILE_H */
@@ -1,3 +1,3 @@
-#define CPIO_ARGV { "/bin/cpio", "-i", NULL }
-// form zlib.c
-char *zlib_decompress_file(const char *, unsigned long *);
+#include "mimetypes.h"
+#include "cpio.h"
+#include "decompress.h"
@@ -92,11 +92,12 @@ int set_loop(const char *device, char *file,int *fd_to_close)
 }
 
 /** this function tries to mount the regular file loopfile on mountpoint though loop devices.
- * @loopfile:			the source file to mount. we don't support offset, so it MUST be an ext4 partition.
+ * @loopfile:			the source file to mount. we don't support offset, so it MUST be a whole filesystem.
  * @mountpoint:		the directory were to mount the image file.
+ * @fstype:				the filesystem of loopfile ( see detect_image ), NULL means ext4.
  */
 
-int loop_mount(char *loopfile, const char *mountpoint)
+int loop_mount(char *loopfile, const char *mountpoint, const char *fstype)
 {
 	int res,retries,fd_to_close;
 	struct stat st;
@@ -129,7 +130,7 @@ int loop_mount(char *loopfile, const char *mountpoint)
 	if(res)
 		return 1;
 	umount(mountpoint);
-	if(mount(LOOP_DEVICE,mountpoint,"ext4",MS_LOOP,""))
+	if(mount(LOOP_DEVICE,mountpoint,(fstype ? fstype : "ext4"),MS_LOOP,""))
 	{
 		LOG("cannot mount \"%s\" on \"%s\" - %s\n",LOOP_DEVICE,mountpoint,strerror(errno));
 		close(fd_to_close);
@@ -0,0 +1,27 @@
+#ifndef LZFILE_H
+#define LZFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <lzma.h>
+
+#define kBufferSize (1 << 15)
+// max threads decoding xz blocks ( tegra 3 has 4 cores )
+#define LZMA_THREADS 4
+
+typedef struct lzfile {
+	uint8_t buf[kBufferSize];
+	lzma_stream strm;
+	FILE *file;
+	int encoding;
+	int eof;
+} LZFILE;
+
+LZFILE *lzopen(const char *path, const char *mode);
+LZFILE *lzdopen(int fd, const char *mode);
+int lzclose(LZFILE *lzfile);
+ssize_t lzread(LZFILE *lzfile, void *buf, size_t len);
+char *lzma_decompress_fd(int fd, off_t *r_size);
+char *lzma_decompress_file(const char *filename, off_t *r_size);
+
+#endif /* LZFILE_H */
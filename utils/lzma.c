@@ -10,23 +10,13 @@
 #include <limits.h>
 #include <sys/stat.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <lzma.h>
 
-#include "common.h"
-
-#define kBufferSize (1 << 15)
-
-typedef struct lzfile {
-	uint8_t buf[kBufferSize];
-	lzma_stream strm;
-	FILE *file;
-	int encoding;
-	int eof;
-} LZFILE;
-
-LZFILE *lzopen(const char *path, const char *mode);
-int lzclose(LZFILE *lzfile);
-ssize_t lzread(LZFILE *lzfile, void *buf, size_t len);
+#include "mimetypes.h"
+#include "lzfile.h"
 
 static LZFILE *lzopen_internal(const char *path, const char *mode, int fd)
 {
@@ -75,6 +65,7 @@ static LZFILE *lzopen_internal(const char *path, const char *mode, int fd)
 	if (ret != LZMA_OK) {
 		fclose(fp);
 		free(lzfile);
+		errno = ret == LZMA_MEM_ERROR ? ENOMEM : EINVAL;
 		return NULL;
 	}
 	return lzfile;
@@ -85,10 +76,16 @@ LZFILE *lzopen(const char *path, const char *mode)
 	return lzopen_internal(path, mode, -1);
 }
 
+LZFILE *lzdopen(int fd, const char *mode)
+{
+	return lzopen_internal(NULL, mode, fd);
+}
+
 int lzclose(LZFILE *lzfile)
 {
 	lzma_ret ret;
 	size_t n;
+	int result;
 
 	if (!lzfile)
 		return -1;
@@ -109,8 +106,9 @@ int lzclose(LZFILE *lzfile)
 	}
 	lzma_end(&lzfile->strm);
 
-	return fclose(lzfile->file);
+	result = fclose(lzfile->file);
 	free(lzfile);
+	return result;
 }
 
 ssize_t lzread(LZFILE *lzfile, void *buf, size_t len)
@@ -118,8 +116,10 @@ ssize_t lzread(LZFILE *lzfile, void *buf, size_t len)
 	lzma_ret ret;
 	int eof = 0;
 
-	if (!lzfile || lzfile->encoding)
+	if (!lzfile || lzfile->encoding) {
+		errno = EINVAL;
 		return -1;
+	}
 
 	if (lzfile->eof)
 		return 0;
@@ -141,32 +141,42 @@ ssize_t lzread(LZFILE *lzfile, void *buf, size_t len)
 			return len - lzfile->strm.avail_out;
 		}
 
-		if (ret != LZMA_OK)
+		if (ret != LZMA_OK) {
+			errno = ret == LZMA_MEM_ERROR ? ENOMEM : EINVAL;
 			return -1;
+		}
 
 		if (!lzfile->strm.avail_out)
 			return len;
 
-		if (eof)
+		if (eof) {
+			// truncated, or fread() failed and set errno
+			if (!ferror(lzfile->file))
+				errno = EINVAL;
 			return -1;
+		}
 	}
 }
 
-char *lzma_decompress_file(const char *filename, off_t *r_size)
+/* decode fd from its start through lzread(), growing the buffer as needed.
+ * used for lzma-alone files and xz files that we cannot split.
+ * on error errno says why, the caller logs it.
+ */
+static char *lzma_decompress_stream(int fd, off_t *r_size)
 {
 	LZFILE *fp;
 	char *buf,*tmp;
 	off_t size, allocated;
 	ssize_t result;
+	int err;
 
-	if (!filename) {
-		*r_size = 0;
-		return 0;
-	}
-	fp = lzopen(filename, "rb");
+	if (lseek(fd, 0, SEEK_SET) || (fd = dup(fd)) < 0)
+		return NULL;
+	fp = lzdopen(fd, "rb");
 	if (fp == 0) {
-		lzclose(fp);
-		ERROR("cannot open \"%s\" - %s\n", filename,strerror(errno));
+		err = errno;
+		close(fd);
+		errno = err;
 		return NULL;
 	}
 	size = 0;
@@ -174,7 +184,8 @@ char *lzma_decompress_file(const char *filename, off_t *r_size)
 	buf = malloc(allocated);
 	if(!buf)
 	{
-		ERROR("malloc - %s\n",strerror(errno));
+		lzclose(fp);
+		errno = ENOMEM;
 		return NULL;
 	}
 	do {
@@ -185,7 +196,7 @@ char *lzma_decompress_file(const char *filename, off_t *r_size)
 			{
 				free(buf);
 				lzclose(fp);
-				ERROR("realloc - %s\n",strerror(errno));
+				errno = ENOMEM;
 				return NULL;
 			}
 			buf = tmp;
@@ -195,20 +206,307 @@ char *lzma_decompress_file(const char *filename, off_t *r_size)
 			if ((errno == EINTR) || (errno == EAGAIN))
 				continue;
 
+			err = errno;
 			free(buf);
 			lzclose(fp);
-			ERROR ("read on \"%s\" of %ld bytes failed\n",
-				filename, (allocated - size) + 0UL);
+			errno = err;
 			return NULL;
 		}
 		size += result;
 	} while(result > 0);
-	result = lzclose(fp);
-	if (result != LZMA_OK) {
-		ERROR ("close of %s failed\n", filename);
+	if (lzclose(fp)) {
 		free(buf);
 		return NULL;
 	}
 	*r_size =  size;
 	return buf;
 }
+
+/* xz files made of many blocks ( "xz -T" or "xz --block-size" )
+ * can be decoded in parallel: the index at the end of the stream
+ * tells us where every block is and how big it is once decompressed.
+ */
+
+struct xz_block
+{
+	uint64_t in_offset, // the block header offset in the file
+					 in_size,
+					 out_offset,
+					 out_size;
+};
+
+struct xz_job
+{
+	const uint8_t *in;
+	uint8_t *out;
+	struct xz_block *blocks;
+	size_t count,
+				 next; // next block to decode
+	lzma_check check;
+	int error;
+	pthread_mutex_t lock;
+};
+
+static int xz_decode_block(struct xz_job *job, struct xz_block *b)
+{
+	lzma_block block;
+	lzma_filter filters[LZMA_FILTERS_MAX + 1];
+	size_t in_pos,out_pos;
+	lzma_ret ret;
+	int i;
+
+	memset(&block,0,sizeof(block));
+	block.version = 0;
+	block.check = job->check;
+	block.filters = filters;
+	block.header_size = lzma_block_header_size_decode(job->in[b->in_offset]);
+	if(block.header_size > b->in_size)
+		return -1;
+	if(lzma_block_header_decode(&block,NULL,job->in + b->in_offset) != LZMA_OK)
+		return -1;
+	in_pos = b->in_offset + block.header_size;
+	out_pos = b->out_offset;
+	ret = lzma_block_buffer_decode(&block,NULL,job->in,&in_pos,b->in_offset + b->in_size,
+																job->out,&out_pos,b->out_offset + b->out_size);
+	for(i=0;filters[i].id != LZMA_VLI_UNKNOWN;i++)
+		free(filters[i].options);
+	if(ret != LZMA_OK || out_pos != b->out_offset + b->out_size)
+		return -1;
+	return 0;
+}
+
+static void *xz_worker(void *arg)
+{
+	struct xz_job *job = arg;
+	size_t i;
+
+	for(;;)
+	{
+		pthread_mutex_lock(&(job->lock));
+		if(job->error || job->next == job->count)
+		{
+			pthread_mutex_unlock(&(job->lock));
+			break;
+		}
+		i = job->next++;
+		pthread_mutex_unlock(&(job->lock));
+		if(xz_decode_block(job,job->blocks + i))
+		{
+			pthread_mutex_lock(&(job->lock));
+			job->error = 1;
+			pthread_mutex_unlock(&(job->lock));
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* decode all job blocks using up to LZMA_THREADS threads */
+static int xz_run_job(struct xz_job *job)
+{
+	pthread_t threads[LZMA_THREADS];
+	long cpus;
+	int i,n;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if(cpus < 1)
+		cpus = 1;
+	if(cpus > LZMA_THREADS)
+		cpus = LZMA_THREADS;
+	if(cpus > job->count)
+		cpus = job->count;
+	pthread_mutex_init(&(job->lock),NULL);
+	// we are a worker too
+	for(n=0;n<cpus-1;n++)
+		if(pthread_create(threads + n,NULL,xz_worker,job))
+			break;
+	xz_worker(job);
+	for(i=0;i<n;i++)
+		pthread_join(threads[i],NULL);
+	pthread_mutex_destroy(&(job->lock));
+	return (job->error ? -1 : 0);
+}
+
+/** read the index of a single-stream xz file.
+ * @in: the whole file
+ * @len: its length
+ * @index: where we store the decoded index
+ * @flags: the stream flags
+ * returns 0 on success, -1 if the file must be decoded as a stream.
+ */
+static int xz_read_index(const uint8_t *in, size_t len, lzma_index **index, lzma_stream_flags *flags)
+{
+	lzma_stream_flags footer;
+	uint64_t memlimit;
+	size_t pos,index_pos;
+
+	// skip stream padding
+	for(pos=len;pos >= 4 && !in[pos-1] && !in[pos-2] && !in[pos-3] && !in[pos-4];pos-=4);
+	if(pos < 2 * LZMA_STREAM_HEADER_SIZE)
+		return -1;
+	if(lzma_stream_header_decode(flags,in) != LZMA_OK ||
+		lzma_stream_footer_decode(&footer,in + pos - LZMA_STREAM_HEADER_SIZE) != LZMA_OK ||
+		lzma_stream_flags_compare(flags,&footer) != LZMA_OK)
+		return -1;
+	if(footer.backward_size > pos - 2 * LZMA_STREAM_HEADER_SIZE)
+		return -1;
+	index_pos = pos - LZMA_STREAM_HEADER_SIZE - footer.backward_size;
+	memlimit = UINT64_MAX;
+	*index = NULL;
+	if(lzma_index_buffer_decode(index,&memlimit,NULL,in,&index_pos,pos - LZMA_STREAM_HEADER_SIZE) != LZMA_OK)
+		return -1;
+	// concatenated streams, let lzread handle them
+	if(lzma_index_stream_size(*index) != pos)
+	{
+		lzma_index_end(*index,NULL);
+		return -1;
+	}
+	return 0;
+}
+
+/** decompress a whole xz or lzma file.
+ * xz files are mmap'd and the output is allocated once from the index size.
+ * blocks are decoded in parallel, if there are more than one.
+ * @fd: the file to decompress, it's not closed.
+ * returns NULL if fd is not an xz/lzma file.
+ */
+char *lzma_decompress_fd(int fd, off_t *r_size)
+{
+	struct xz_job job;
+	lzma_stream_flags flags;
+	lzma_index *index;
+	lzma_index_iter iter;
+	struct stat st;
+	uint8_t *map,*buf;
+	uint64_t size;
+	size_t i;
+	int ret;
+
+	if(fstat(fd,&st) || !S_ISREG(st.st_mode) || st.st_size < 2 * LZMA_STREAM_HEADER_SIZE ||
+		(map = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0)) == MAP_FAILED)
+		return lzma_decompress_stream(fd, r_size);
+	if(memcmp(map,XZ_MAGIC,XZ_MAGIC_LEN) || xz_read_index(map,st.st_size,&index,&flags))
+	{
+		munmap(map,st.st_size);
+		return lzma_decompress_stream(fd, r_size);
+	}
+	size = lzma_index_uncompressed_size(index);
+	job.count = lzma_index_block_count(index);
+	buf = NULL;
+	job.blocks = NULL;
+	ret = -1;
+	if(size > SIZE_MAX || !(buf = malloc(size ? size : 1)))
+		goto out;
+	if(job.count == 1) // nothing to split, decode it here
+	{
+		size_t in_pos = 0, out_pos = 0;
+		uint64_t memlimit = UINT64_MAX;
+		if(lzma_stream_buffer_decode(&memlimit,0,NULL,map,&in_pos,st.st_size,buf,&out_pos,size) == LZMA_OK && out_pos == size)
+			ret = 0;
+		goto out;
+	}
+	if(!(job.blocks = malloc(job.count * sizeof(struct xz_block))))
+		goto out;
+	lzma_index_iter_init(&iter,index);
+	for(i=0;i<job.count && !lzma_index_iter_next(&iter,LZMA_INDEX_ITER_BLOCK);i++)
+	{
+		job.blocks[i].in_offset = iter.block.compressed_file_offset;
+		job.blocks[i].in_size = iter.block.total_size;
+		job.blocks[i].out_offset = iter.block.uncompressed_file_offset;
+		job.blocks[i].out_size = iter.block.uncompressed_size;
+	}
+	job.in = map;
+	job.out = buf;
+	job.next = 0;
+	job.error = 0;
+	job.check = flags.check;
+	ret = xz_run_job(&job);
+
+out:
+	lzma_index_end(index,NULL);
+	munmap(map,st.st_size);
+	free(job.blocks);
+	if(ret)
+	{
+		free(buf);
+		errno = EINVAL;
+		return NULL;
+	}
+	*r_size = size;
+	return (char *)buf;
+}
+
+char *lzma_decompress_file(const char *filename, off_t *r_size)
+{
+	char *buf;
+	int fd,err;
+
+	if (!filename) {
+		*r_size = 0;
+		return 0;
+	}
+	if((fd = open(filename,O_RDONLY)) < 0)
+		return NULL;
+	buf = lzma_decompress_fd(fd, r_size);
+	err = errno;
+	close(fd);
+	errno = err;
+	return buf;
+}
+
+#ifdef TEST
+
+#include <time.h>
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* compare the old stream decoder against the block one:
+ * make a multi-block file with "xz -k --block-size=1MiB file"
+ * and run "lzma_test file.xz"
+ */
+int main(int argc, char *argv[])
+{
+	char *a,*b;
+	off_t a_size,b_size;
+	double start,t_stream,t_blocks;
+	int i,fd;
+
+	for(i=1;i<argc;i++)
+	{
+		if((fd = open(argv[i],O_RDONLY)) < 0)
+		{
+			printf("%s: %s\n",argv[i],strerror(errno));
+			return EXIT_FAILURE;
+		}
+		start = now();
+		a = lzma_decompress_stream(fd,&a_size);
+		t_stream = now() - start;
+		start = now();
+		b = lzma_decompress_fd(fd,&b_size);
+		t_blocks = now() - start;
+		close(fd);
+		if(!a || !b)
+		{
+			printf("%s: cannot decompress\n",argv[i]);
+			return EXIT_FAILURE;
+		}
+		printf("%s: %ld bytes\n",argv[i],(long)b_size);
+		printf("  stream: %.3fs %6.1f MB/s\n",t_stream,a_size / t_stream / 1e6);
+		printf("  blocks: %.3fs %6.1f MB/s\n",t_blocks,b_size / t_blocks / 1e6);
+		if(a_size != b_size || memcmp(a,b,a_size))
+		{
+			printf("  output differs!\n");
+			return EXIT_FAILURE;
+		}
+		free(a);
+		free(b);
+	}
+	return EXIT_SUCCESS;
+}
+#endif
@@ -2,4 +2,16 @@
 #define CPIO_MAGIC					"070707"
 #define CPIO_MAGIC_SVR4	"070702"
 #define CPIO_MAGIC_CRC		"070701"
-#define MAX_MAGIC_LEN			6
\ No newline at end of file
+#define MAX_MAGIC_LEN			6
+#define XZ_MAGIC					"\xfd\x37\x7a\x58\x5a\x00"
+#define XZ_MAGIC_LEN			6
+
+#define LZMA_MAGIC					"\x5d\x00\x00" /* lzma-alone has no magic, this is the default header */
+#define LZMA_MAGIC_LEN			3
+#define ZSTD_MAGIC					"\x28\xb5\x2f\xfd"
+#define ZSTD_MAGIC_LEN			4
+#define LZ4_MAGIC					"\x04\x22\x4d\x18"
+#define LZ4_LEGACY_MAGIC	"\x02\x21\x4c\x18"
+#define LZ4_MAGIC_LEN			4
+#define BZIP2_MAGIC				"BZh"
+#define BZIP2_MAGIC_LEN			3
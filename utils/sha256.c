@@ -18,7 +18,34 @@
  *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+/*
+ * the compression function has a few backends, the fastest one
+ * that the running cpu supports is chosen at the first use:
+ *  - x86 SHA-NI ( for the tests on the host )
+ *  - ARMv8 SHA2 instructions ( ARMV8_CRYPTO=1, see simd.mk )
+ *  - NEON message schedule ( NEON=1, the default when building for ARM )
+ *  - plain C on whole words
+ *  - the original byte-oriented C code
+ * they all give the same digests, "make sha256_test" checks it.
+ */
+
 #include <string.h>
+#include <stdio.h>
+#include <endian.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if (defined(__ARM_NEON__) || defined(__ARM_NEON)) && !defined(__ARMEB__) && !defined(__AARCH64EB__)
+#define SHA256_NEON
+#if defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2)
+#define SHA256_ARMV8
+#endif
+#include <arm_neon.h>
+#endif
 
 #include "sha256.h"
 
@@ -53,7 +80,7 @@ void sha256_starts( sha256_context *ctx )
 	ctx->state[7] = 0x5BE0CD19;
 }
 
-void sha256_process( sha256_context *ctx, const uint8_t data[64] )
+static void sha256_process( uint32_t state[8], const uint8_t data[64] )
 {
 	uint32_t temp1, temp2, W[64];
 	uint32_t A, B, C, D, E, F, G, H;
@@ -100,14 +127,14 @@ void sha256_process( sha256_context *ctx, const uint8_t data[64] )
 	d += temp1; h = temp1 + temp2;          \
 }
 
-	A = ctx->state[0];
-	B = ctx->state[1];
-	C = ctx->state[2];
-	D = ctx->state[3];
-	E = ctx->state[4];
-	F = ctx->state[5];
-	G = ctx->state[6];
-	H = ctx->state[7];
+	A = state[0];
+	B = state[1];
+	C = state[2];
+	D = state[3];
+	E = state[4];
+	F = state[5];
+	G = state[6];
+	H = state[7];
 
 	P( A, B, C, D, E, F, G, H, W[ 0], 0x428A2F98 );
 	P( H, A, B, C, D, E, F, G, W[ 1], 0x71374491 );
@@ -174,14 +201,362 @@ void sha256_process( sha256_context *ctx, const uint8_t data[64] )
 	P( C, D, E, F, G, H, A, B, R(62), 0xBEF9A3F7 );
 	P( B, C, D, E, F, G, H, A, R(63), 0xC67178F2 );
 
-	ctx->state[0] += A;
-	ctx->state[1] += B;
-	ctx->state[2] += C;
-	ctx->state[3] += D;
-	ctx->state[4] += E;
-	ctx->state[5] += F;
-	ctx->state[6] += G;
-	ctx->state[7] += H;
+	state[0] += A;
+	state[1] += B;
+	state[2] += C;
+	state[3] += D;
+	state[4] += E;
+	state[5] += F;
+	state[6] += G;
+	state[7] += H;
+}
+
+static const uint32_t K[64] =
+{
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+static void sha256_blocks_generic( uint32_t state[8], const uint8_t *data, size_t blocks )
+{
+	for( ; blocks; blocks--, data += 64 )
+		sha256_process( state, data );
+}
+
+/* the 64 rounds, wk[t] is W[t] + K[t] */
+static void sha256_rounds( uint32_t state[8], const uint32_t wk[64] )
+{
+	uint32_t temp1, temp2;
+	uint32_t A, B, C, D, E, F, G, H;
+
+	A = state[0];
+	B = state[1];
+	C = state[2];
+	D = state[3];
+	E = state[4];
+	F = state[5];
+	G = state[6];
+	H = state[7];
+
+#define P8(i)                                       \
+{                                                   \
+	P( A, B, C, D, E, F, G, H, wk[(i)    ], 0 ); \
+	P( H, A, B, C, D, E, F, G, wk[(i) + 1], 0 ); \
+	P( G, H, A, B, C, D, E, F, wk[(i) + 2], 0 ); \
+	P( F, G, H, A, B, C, D, E, wk[(i) + 3], 0 ); \
+	P( E, F, G, H, A, B, C, D, wk[(i) + 4], 0 ); \
+	P( D, E, F, G, H, A, B, C, wk[(i) + 5], 0 ); \
+	P( C, D, E, F, G, H, A, B, wk[(i) + 6], 0 ); \
+	P( B, C, D, E, F, G, H, A, wk[(i) + 7], 0 ); \
+}
+
+	P8(  0 ); P8(  8 ); P8( 16 ); P8( 24 );
+	P8( 32 ); P8( 40 ); P8( 48 ); P8( 56 );
+
+	state[0] += A;
+	state[1] += B;
+	state[2] += C;
+	state[3] += D;
+	state[4] += E;
+	state[5] += F;
+	state[6] += G;
+	state[7] += H;
+}
+
+static inline uint32_t load_be32( const uint8_t *p )
+{
+	uint32_t n;
+
+	memcpy( &n, p, 4 );
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	n = __builtin_bswap32( n );
+#endif
+	return n;
+}
+
+/* same as the generic one, but with word loads ( "rev" on arm ) */
+static void sha256_blocks_words( uint32_t state[8], const uint8_t *data, size_t blocks )
+{
+	uint32_t W[64], wk[64];
+	int t;
+
+	for( ; blocks; blocks--, data += 64 )
+	{
+		for( t = 0; t < 16; t++ )
+		{
+			W[t] = load_be32( data + 4 * t );
+			wk[t] = W[t] + K[t];
+		}
+		for( ; t < 64; t++ )
+			wk[t] = R(t) + K[t];
+		sha256_rounds( state, wk );
+	}
+}
+
+#ifdef SHA256_NEON
+
+/* rotate right, on 4 and 2 lanes */
+#define VRORQ(x,n) vsliq_n_u32( vshrq_n_u32( x, n ), x, 32 - n )
+#define VROR(x,n)  vsli_n_u32( vshr_n_u32( x, n ), x, 32 - n )
+
+#define VS0Q(x) veorq_u32( veorq_u32( VRORQ(x, 7), VRORQ(x,18) ), vshrq_n_u32(x, 3) )
+#define VS1(x)  veor_u32( veor_u32( VROR(x,17), VROR(x,19) ), vshr_n_u32(x,10) )
+
+/* the message schedule on NEON, 4 words at a time, the rounds in C.
+ * W[t..t+1] need W[t-2..t-1], so each group of 4 is done in two halves.
+ */
+static void sha256_blocks_neon( uint32_t state[8], const uint8_t *data, size_t blocks )
+{
+	uint32_t wk[64];
+	uint32x4_t x0, x1, x2, x3, t;
+	uint32x2_t lo, hi;
+	int i;
+
+	for( ; blocks; blocks--, data += 64 )
+	{
+		x0 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data      ) ) );
+		x1 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 16 ) ) );
+		x2 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 32 ) ) );
+		x3 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 48 ) ) );
+		vst1q_u32( wk,      vaddq_u32( x0, vld1q_u32( K      ) ) );
+		vst1q_u32( wk +  4, vaddq_u32( x1, vld1q_u32( K +  4 ) ) );
+		vst1q_u32( wk +  8, vaddq_u32( x2, vld1q_u32( K +  8 ) ) );
+		vst1q_u32( wk + 12, vaddq_u32( x3, vld1q_u32( K + 12 ) ) );
+
+		for( i = 16; i < 64; i += 4 )
+		{
+			/* W[t-16] + S0(W[t-15]) + W[t-7] */
+			t = vaddq_u32( vaddq_u32( x0, vextq_u32( x2, x3, 1 ) ), VS0Q( vextq_u32( x0, x1, 1 ) ) );
+			lo = vadd_u32( vget_low_u32( t ), VS1( vget_high_u32( x3 ) ) );
+			hi = vadd_u32( vget_high_u32( t ), VS1( lo ) );
+			x0 = x1;
+			x1 = x2;
+			x2 = x3;
+			x3 = vcombine_u32( lo, hi );
+			vst1q_u32( wk + i, vaddq_u32( x3, vld1q_u32( K + i ) ) );
+		}
+		sha256_rounds( state, wk );
+	}
+}
+
+#endif /* SHA256_NEON */
+
+#ifdef SHA256_ARMV8
+
+static void sha256_blocks_armv8( uint32_t state[8], const uint8_t *data, size_t blocks )
+{
+	uint32x4_t state0, state1, save0, save1, msg[4], wk, tmp;
+	int i;
+
+	state0 = vld1q_u32( state );
+	state1 = vld1q_u32( state + 4 );
+
+	for( ; blocks; blocks--, data += 64 )
+	{
+		save0 = state0;
+		save1 = state1;
+		for( i = 0; i < 4; i++ )
+			msg[i] = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 16 * i ) ) );
+
+		for( i = 0; i < 16; i++ )
+		{
+			wk = vaddq_u32( msg[i & 3], vld1q_u32( K + 4 * i ) );
+			// the last 4 groups use words that we already have
+			if( i < 12 )
+				msg[i & 3] = vsha256su0q_u32( msg[i & 3], msg[(i + 1) & 3] );
+			tmp = state0;
+			state0 = vsha256hq_u32( state0, state1, wk );
+			state1 = vsha256h2q_u32( state1, tmp, wk );
+			if( i < 12 )
+				msg[i & 3] = vsha256su1q_u32( msg[i & 3], msg[(i + 2) & 3], msg[(i + 3) & 3] );
+		}
+
+		state0 = vaddq_u32( state0, save0 );
+		state1 = vaddq_u32( state1, save1 );
+	}
+
+	vst1q_u32( state, state0 );
+	vst1q_u32( state + 4, state1 );
+}
+
+#endif /* SHA256_ARMV8 */
+
+#ifdef SHA256_X86
+
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani( uint32_t state[8], const uint8_t *data, size_t blocks )
+{
+	__m128i state0, state1, save0, save1, msg[4], wk, tmp;
+	const __m128i swap = _mm_set_epi64x( 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL );
+	int i;
+
+	/* the instructions want ABEF and CDGH */
+	tmp    = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *) state ), 0xB1 );
+	state1 = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *) ( state + 4 ) ), 0x1B );
+	state0 = _mm_alignr_epi8( tmp, state1, 8 );
+	state1 = _mm_blend_epi16( state1, tmp, 0xF0 );
+
+	for( ; blocks; blocks--, data += 64 )
+	{
+		save0 = state0;
+		save1 = state1;
+		for( i = 0; i < 4; i++ )
+			msg[i] = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) ( data + 16 * i ) ), swap );
+
+		for( i = 0; i < 16; i++ )
+		{
+			wk = _mm_add_epi32( msg[i & 3], _mm_loadu_si128( (const __m128i *) ( K + 4 * i ) ) );
+			state1 = _mm_sha256rnds2_epu32( state1, state0, wk );
+			if( i >= 3 && i < 15 )
+			{
+				tmp = _mm_alignr_epi8( msg[i & 3], msg[(i - 1) & 3], 4 );
+				msg[(i + 1) & 3] = _mm_add_epi32( msg[(i + 1) & 3], tmp );
+				msg[(i + 1) & 3] = _mm_sha256msg2_epu32( msg[(i + 1) & 3], msg[i & 3] );
+			}
+			wk = _mm_shuffle_epi32( wk, 0x0E );
+			state0 = _mm_sha256rnds2_epu32( state0, state1, wk );
+			if( i >= 1 && i < 13 )
+				msg[(i - 1) & 3] = _mm_sha256msg1_epu32( msg[(i - 1) & 3], msg[i & 3] );
+		}
+
+		state0 = _mm_add_epi32( state0, save0 );
+		state1 = _mm_add_epi32( state1, save1 );
+	}
+
+	/* back to ABCD and EFGH */
+	tmp    = _mm_shuffle_epi32( state0, 0x1B );
+	state1 = _mm_shuffle_epi32( state1, 0xB1 );
+	state0 = _mm_blend_epi16( tmp, state1, 0xF0 );
+	state1 = _mm_alignr_epi8( state1, tmp, 8 );
+	_mm_storeu_si128( (__m128i *) state, state0 );
+	_mm_storeu_si128( (__m128i *) ( state + 4 ), state1 );
+}
+
+static int has_shani( void )
+{
+	unsigned int a, b, c, d;
+
+	if( ! __get_cpuid( 1, &a, &b, &c, &d ) || ! ( c & bit_SSE4_1 ) || ! ( c & bit_SSSE3 ) )
+		return 0;
+	if( __get_cpuid_max( 0, NULL ) < 7 )
+		return 0;
+	__cpuid_count( 7, 0, a, b, c, d );
+	return ( b & ( 1 << 29 ) ) != 0;
+}
+
+#endif /* SHA256_X86 */
+
+#if defined(SHA256_NEON)
+
+/* look for feature in the "Features" line of /proc/cpuinfo */
+static int cpuinfo_has( const char *feature )
+{
+	char line[1024], *tok, *save;
+	FILE *fp;
+	int found;
+
+	if( ! ( fp = fopen( "/proc/cpuinfo", "r" ) ) )
+		return 0;
+	found = 0;
+	while( ! found && fgets( line, sizeof( line ), fp ) )
+	{
+		if( strncmp( line, "Features", 8 ) )
+			continue;
+		for( tok = strtok_r( line, " \t\n:", &save ); tok && ! found; tok = strtok_r( NULL, " \t\n:", &save ) )
+			found = ! strcmp( tok, feature );
+	}
+	fclose( fp );
+	return found;
+}
+
+static int has_neon( void )
+{
+	// aarch64 calls it "asimd"
+	return cpuinfo_has( "neon" ) || cpuinfo_has( "asimd" );
+}
+
+#ifdef SHA256_ARMV8
+static int has_sha2( void )
+{
+	return cpuinfo_has( "sha2" );
+}
+#endif
+
+#endif /* SHA256_NEON */
+
+static int always( void )
+{
+	return 1;
+}
+
+struct sha256_backend
+{
+	const char *name;
+	int (*available)( void );
+	void (*blocks)( uint32_t state[8], const uint8_t *data, size_t blocks );
+};
+
+// the fastest first, "generic" must be the last one
+static const struct sha256_backend backends[] =
+{
+#ifdef SHA256_X86
+	{ "sha-ni", has_shani, sha256_blocks_shani },
+#endif
+#ifdef SHA256_ARMV8
+	{ "armv8", has_sha2, sha256_blocks_armv8 },
+#endif
+#ifdef SHA256_NEON
+	{ "neon", has_neon, sha256_blocks_neon },
+#endif
+	{ "words", always, sha256_blocks_words },
+	{ "generic", always, sha256_blocks_generic }
+};
+
+#define BACKENDS ( sizeof( backends ) / sizeof( backends[0] ) )
+
+static const struct sha256_backend *backend = NULL;
+
+static const struct sha256_backend *select_backend( void )
+{
+	const struct sha256_backend *b;
+
+	for( b = backends; ! b->available(); b++ );
+	return b;
+}
+
+static void sha256_blocks( uint32_t state[8], const uint8_t *data, size_t blocks )
+{
+	if( ! backend )
+		backend = select_backend();
+	backend->blocks( state, data, blocks );
+}
+
+/* the name of the backend in use */
+const char *sha256_backend( void )
+{
+	if( ! backend )
+		backend = select_backend();
+	return backend->name;
+}
+
+/* force a backend, returns -1 if the cpu cannot run it */
+int sha256_set_backend( const char *name )
+{
+	unsigned int i;
+
+	for( i = 0; i < BACKENDS; i++ )
+		if( ! strcmp( backends[i].name, name ) && backends[i].available() )
+		{
+			backend = backends + i;
+			return 0;
+		}
+	return -1;
 }
 
 void sha256_update( sha256_context *ctx, const uint8_t *input, size_t length )
@@ -202,17 +577,17 @@ void sha256_update( sha256_context *ctx, const uint8_t *input, size_t length )
 	if( left && length >= fill )
 	{
 		memcpy( ctx->buffer + left, input, fill );
-		sha256_process( ctx, ctx->buffer );
+		sha256_blocks( ctx->state, ctx->buffer, 1 );
 		length -= fill;
 		input  += fill;
 		left = 0;
 	}
 
-	while( length >= 64 )
+	if( length >= 64 )
 	{
-		sha256_process( ctx, input );
-		length -= 64;
-		input  += 64;
+		sha256_blocks( ctx->state, input, length / 64 );
+		input  += length & ~(size_t) 63;
+		length &= 63;
 	}
 
 	if( length )
@@ -221,6 +596,48 @@ void sha256_update( sha256_context *ctx, const uint8_t *input, size_t length )
 	}
 }
 
+/* same as sha256_update on length zero bytes.
+ * the zero-fill of the segments is big, we don't want to copy it around.
+ */
+void sha256_update_zeros( sha256_context *ctx, size_t length )
+{
+	static const uint8_t zeros[SHA256_ZERO_BLOCKS * 64];
+	size_t left, fill, blocks;
+
+	if( ! length ) return;
+
+	left = ctx->total[0] & 0x3F;
+	fill = 64 - left;
+
+	ctx->total[0] += length;
+	ctx->total[0] &= 0xFFFFFFFF;
+
+	if( ctx->total[0] < length )
+		ctx->total[1]++;
+
+	if( left && length >= fill )
+	{
+		memset( ctx->buffer + left, 0, fill );
+		sha256_blocks( ctx->state, ctx->buffer, 1 );
+		length -= fill;
+		left = 0;
+	}
+
+	while( length >= 64 )
+	{
+		blocks = length / 64;
+		if( blocks > SHA256_ZERO_BLOCKS )
+			blocks = SHA256_ZERO_BLOCKS;
+		sha256_blocks( ctx->state, zeros, blocks );
+		length -= blocks * 64;
+	}
+
+	if( length )
+	{
+		memset( ctx->buffer + left, 0, length );
+	}
+}
+
 static uint8_t sha256_padding[64] =
 {
  0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -262,6 +679,7 @@ void sha256_finish( sha256_context *ctx, sha256_digest_t digest )
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 
 /*
  * those are the standard FIPS-180-2 test vectors
@@ -284,56 +702,149 @@ static char *val[] =
 	"f1809a48a497200e046d39ccc7112cd0"
 };
 
-int main( int argc, char *argv[] )
+/* check the backend in use against the test vectors and the zero-fill */
+static int self_test( void )
 {
-	FILE *f;
 	int i, j;
 	char output[65];
 	sha256_context ctx;
 	unsigned char buf[1000];
 	unsigned char sha256sum[32];
 
-	if( argc < 2 )
+	for( i = 0; i < 3; i++ )
 	{
-		printf( "\n SHA-256 Validation Tests:\n\n" );
+		printf( " Test %d ", i + 1 );
+		
+		sha256_starts( &ctx );
 		
-		for( i = 0; i < 3; i++ )
+		if( i < 2 )
 		{
-			printf( " Test %d ", i + 1 );
-			
-			sha256_starts( &ctx );
+			sha256_update( &ctx, (uint8_t *) msg[i],
+				strlen( msg[i] ) );
+		}
+		else
+		{
+			memset( buf, 'a', 1000 );
 			
-			if( i < 2 )
-			{
-				sha256_update( &ctx, (uint8_t *) msg[i],
-					strlen( msg[i] ) );
-			}
-			else
+			for( j = 0; j < 1000; j++ )
 			{
-				memset( buf, 'a', 1000 );
-				
-				for( j = 0; j < 1000; j++ )
-				{
-					sha256_update( &ctx, (uint8_t *) buf, 1000 );
-				}
+				sha256_update( &ctx, (uint8_t *) buf, 1000 );
 			}
-			
-			sha256_finish( &ctx, sha256sum );
-			
-			for( j = 0; j < 32; j++ )
+		}
+		
+		sha256_finish( &ctx, sha256sum );
+		
+		for( j = 0; j < 32; j++ )
+		{
+			sprintf( output + j * 2, "%02x", sha256sum[j] );
+		}
+		
+		if( memcmp( output, val[i], 64 ) )
+		{
+			printf( "failed!\n" );
+			return( 1 );
+		}
+		
+		printf( "passed.\n" );
+	}
+
+	printf( " Test zeros " );
+	memset( buf, 0, 1000 );
+	sha256_starts( &ctx );
+	sha256_update( &ctx, (uint8_t *) "x", 1 );
+	for( j = 0; j < 1000; j++ )
+		sha256_update( &ctx, (uint8_t *) buf, 1000 );
+	sha256_finish( &ctx, (uint8_t *) output );
+	sha256_starts( &ctx );
+	sha256_update( &ctx, (uint8_t *) "x", 1 );
+	for( j = 0; j < 142; j++ )
+		sha256_update_zeros( &ctx, 7000 );
+	sha256_update_zeros( &ctx, 6000 );
+	sha256_finish( &ctx, sha256sum );
+	if( memcmp( output, sha256sum, 32 ) )
+	{
+		printf( "failed!\n" );
+		return( 1 );
+	}
+	printf( "passed.\n" );
+	return( 0 );
+}
+
+/* hash data in uneven pieces with the backend in use */
+static void hash_pieces( const uint8_t *data, size_t len, sha256_digest_t digest )
+{
+	sha256_context ctx;
+	size_t piece, step;
+
+	sha256_starts( &ctx );
+	for( step = 1; len; step = step * 7 % 1021 + 1 )
+	{
+		piece = ( step < len ? step : len );
+		sha256_update( &ctx, data, piece );
+		data += piece;
+		len -= piece;
+	}
+	sha256_finish( &ctx, digest );
+}
+
+#define BENCH_SIZE ( 1 << 20 )
+#define BENCH_ROUNDS 64
+
+int main( int argc, char *argv[] )
+{
+	FILE *f;
+	int i, j;
+	unsigned int b;
+	sha256_context ctx;
+	unsigned char buf[1000];
+	unsigned char sha256sum[32], reference[32];
+	uint8_t *data;
+	struct timespec start, end;
+	double secs;
+
+	if( argc < 2 )
+	{
+		if( ! ( data = malloc( BENCH_SIZE + 1 ) ) )
+		{
+			perror( "malloc" );
+			return( 1 );
+		}
+		srand( 1 );
+		for( i = 0; i <= BENCH_SIZE; i++ )
+			data[i] = rand();
+		sha256_set_backend( "generic" );
+		hash_pieces( data + 1, BENCH_SIZE, reference );
+
+		for( b = 0; b < BACKENDS; b++ )
+		{
+			if( sha256_set_backend( backends[b].name ) )
 			{
-				sprintf( output + j * 2, "%02x", sha256sum[j] );
+				printf( "\n %s: not supported by this cpu\n", backends[b].name );
+				continue;
 			}
-			
-			if( memcmp( output, val[i], 64 ) )
+			printf( "\n %s:\n", backends[b].name );
+			if( self_test() )
+				return( 1 );
+			// unaligned and split, it must match the generic code
+			printf( " Test random " );
+			hash_pieces( data + 1, BENCH_SIZE, sha256sum );
+			if( memcmp( sha256sum, reference, 32 ) )
 			{
 				printf( "failed!\n" );
 				return( 1 );
 			}
-			
 			printf( "passed.\n" );
-		}
 
+			clock_gettime( CLOCK_MONOTONIC, &start );
+			sha256_starts( &ctx );
+			for( j = 0; j < BENCH_ROUNDS; j++ )
+				sha256_update( &ctx, data, BENCH_SIZE );
+			sha256_finish( &ctx, sha256sum );
+			clock_gettime( CLOCK_MONOTONIC, &end );
+			secs = ( end.tv_sec - start.tv_sec ) + ( end.tv_nsec - start.tv_nsec ) / 1e9;
+			printf( " %.1f MB/s\n", BENCH_ROUNDS * ( BENCH_SIZE / 1048576.0 ) / secs );
+		}
+		free( data );
 		printf( "\n" );
 	}
 	else
@@ -358,7 +869,7 @@ int main( int argc, char *argv[] )
 			printf( "%02x", sha256sum[j] );
 		}
 		
-		printf( "  %s\n", argv[1] );
+		printf( "  %s ( %s )\n", argv[1], sha256_backend() );
 	}
 	
 	return( 0 );
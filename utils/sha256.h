@@ -14,9 +14,15 @@ sha256_context;
 
 typedef uint8_t sha256_digest_t[32];
 
+// sha256_update_zeros hashes this many zero blocks per call to the backend
+#define SHA256_ZERO_BLOCKS 64
+
 void sha256_starts( sha256_context *ctx );
 void sha256_update( sha256_context *ctx, const uint8_t *input, size_t length );
+void sha256_update_zeros( sha256_context *ctx, size_t length );
 void sha256_finish( sha256_context *ctx, sha256_digest_t digest );
+const char *sha256_backend( void );
+int sha256_set_backend( const char *name );
 
 
 #endif /* SHA256_H */
@@ -0,0 +1,33 @@
+# vector code for ARM, see kernel_chooser/bmp.c and sha256.c
+# include this after CC and CFLAGS are set.
+# NEON=1 builds the NEON converters and SHA-256 schedule, for ARMv7 cpus with NEON like Tegra 3.
+# the whole binary needs NEON then. (defaults to 1 if CC builds for 32 bit ARM)
+# ARMV8_CRYPTO=1 also builds the SHA-256 of the ARMv8 crypto extensions,
+# the binary runs only on ARMv8 cpus that have them. (defaults to 0)
+CC_MACHINE:=$(shell $(CC) -dumpmachine 2>/dev/null)
+
+ifneq ($(filter arm%,$(CC_MACHINE)),)
+    NEON?=1
+else
+    NEON?=0
+endif
+
+# NEON registers can't go through the soft float calling convention of gnueabi
+ifeq ($(filter %hf,$(CC_MACHINE)),)
+    ARM_FLOAT_ABI=-mfloat-abi=softfp
+endif
+
+ARMV8_CRYPTO?=0
+
+ifneq ($(filter arm%,$(CC_MACHINE)),)
+    ifeq ($(ARMV8_CRYPTO), 1)
+        CFLAGS+=-march=armv8-a+crypto -mfpu=crypto-neon-fp-armv8 $(ARM_FLOAT_ABI)
+    else ifeq ($(NEON), 1)
+        CFLAGS+=-march=armv7-a -mfpu=neon $(ARM_FLOAT_ABI)
+    endif
+else ifneq ($(filter aarch64%,$(CC_MACHINE)),)
+    # NEON is always there
+    ifeq ($(ARMV8_CRYPTO), 1)
+        CFLAGS+=-march=armv8-a+crypto
+    endif
+endif
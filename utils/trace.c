@@ -0,0 +1,196 @@
+/* a boot timeline for kernel_chooser, root_chooser and android_chooser.
+ * each program records the begin and the end of its phases in memory
+ * and appends them once to TRACE_FILE as chrome trace events.
+ * timestamps are CLOCK_BOOTTIME microseconds, the same clock of
+ * /proc/uptime, so we don't need /proc mounted to read it.
+ * the stages that run after kexec are shifted by the uptime that
+ * kernel_chooser wrote in its TRACE_KEXEC event,
+ * so the whole chain lines up on one timeline.
+ * spans are phases measured by someone else, like the critical path
+ * of the startup tasks, they go on a track of their own.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+struct trace_event
+{
+	const char *name;
+	unsigned long long begin,
+										 end; // 0 until trace_end
+	pid_t tid; // 0 for spans
+	char phase; // 'X' for phases, 'i' for instants
+};
+
+static struct trace_event events[TRACE_MAX_EVENTS];
+static int nr_events;
+
+static unsigned long long uptime_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_BOOTTIME,&now);
+	return (unsigned long long)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static int new_event(const char *name, char phase)
+{
+	struct trace_event *e;
+	int id;
+
+	// workers record their phases too
+	if((id = __sync_fetch_and_add(&nr_events,1)) >= TRACE_MAX_EVENTS)
+		return -1;
+	e = events + id;
+	e->name = name;
+	e->phase = phase;
+	e->tid = syscall(SYS_gettid);
+	e->end = 0;
+	e->begin = uptime_us();
+	return id;
+}
+
+/** the time used by the events, for trace_span */
+unsigned long long trace_now(void)
+{
+	return uptime_us();
+}
+
+/** a phase starts now
+ * @name: must live until trace_dump, use string literals.
+ * returns the id to give to trace_end, -1 if the buffer is full.
+ */
+int trace_begin(const char *name)
+{
+	return new_event(name,'X');
+}
+
+/** the phase id returned by trace_begin ends now */
+void trace_end(int id)
+{
+	if(id >= 0 && id < TRACE_MAX_EVENTS)
+		events[id].end = uptime_us();
+}
+
+/** record something that has no length, like TRACE_KEXEC */
+void trace_instant(const char *name)
+{
+	int id;
+
+	if((id = new_event(name,'i')) >= 0)
+		events[id].end = events[id].begin;
+}
+
+/** record a phase that someone else measured
+ * @begin, @end: from trace_now
+ */
+void trace_span(const char *name, unsigned long long begin, unsigned long long end)
+{
+	int id;
+
+	if((id = new_event(name,'X')) >= 0)
+	{
+		events[id].tid = 0;
+		events[id].begin = begin;
+		events[id].end = (end > begin ? end : begin + 1);
+	}
+}
+
+/** open the trace file, if tracing is enabled.
+ * call it while the data partition is mounted where you expect,
+ * the events can be dumped later.
+ * @flags: TRACE_NEW_TIMELINE or 0
+ * returns the fd to give to trace_dump, -1 if there is no trace file.
+ */
+int trace_open(const char *file, int flags)
+{
+	// never create it, it's the switch that enables tracing
+	return open(file,O_RDWR|O_APPEND|O_CLOEXEC|((flags & TRACE_NEW_TIMELINE) ? O_TRUNC : 0));
+}
+
+/** look at what the previous stages wrote in the trace file
+ * @base: set to the uptime of the last TRACE_KEXEC event, where our clock starts
+ * @stage: set to the number of processes already in the file
+ */
+static void read_previous_stages(int fd, unsigned long long *base, int *stage)
+{
+	struct stat st;
+	char *buf,*pos,*kexec;
+	ssize_t len;
+
+	*base = 0;
+	*stage = 0;
+	if(fstat(fd,&st) || st.st_size <= 0 || !(buf = malloc(st.st_size + 1)))
+		return;
+	if((len = pread(fd,buf,st.st_size,0)) > 0)
+	{
+		buf[len] = '\0';
+		for(pos=buf;(pos = strstr(pos,"\"process_name\""));pos++)
+			(*stage)++;
+		kexec = NULL;
+		for(pos=buf;(pos = strstr(pos,"\"name\":\"" TRACE_KEXEC "\""));pos++)
+			kexec = pos;
+		if(kexec && (pos = strstr(kexec,"\"ts\":")))
+			*base = strtoull(pos + 5,NULL,10);
+	}
+	free(buf);
+}
+
+/** append our events to the trace file and close it
+ * @fd: from trace_open
+ * @process: the name of this boot stage
+ * returns 0 on success, -1 on error.
+ */
+int trace_dump(int fd, const char *process)
+{
+	FILE *fp;
+	struct trace_event *e;
+	unsigned long long base;
+	int i,n,stage,err,spans;
+
+	read_previous_stages(fd,&base,&stage);
+	if(!(fp = fdopen(fd,"a")))
+	{
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	// the closing ']' is optional, every stage can just append
+	if(!stage)
+		fprintf(fp,"[\n");
+	stage++;
+	fprintf(fp,"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"%s\"}},\n",stage,process);
+	n = (nr_events < TRACE_MAX_EVENTS ? nr_events : TRACE_MAX_EVENTS);
+	for(spans=i=0;i<n;i++)
+	{
+		e = events + i;
+		if(!e->tid && !spans++)
+			fprintf(fp,"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"critical path\"}},\n",stage);
+		if(e->phase == 'i')
+			fprintf(fp,"{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"g\",\"pid\":%d,\"tid\":%d,\"ts\":%llu},\n",
+				e->name,stage,(int)e->tid,base + e->begin);
+		else if(e->end)
+			fprintf(fp,"{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%llu,\"dur\":%llu},\n",
+				e->name,stage,(int)e->tid,base + e->begin,e->end - e->begin);
+		else // it never ended ( we are exiting on error ), let it run to the end
+			fprintf(fp,"{\"name\":\"%s\",\"ph\":\"B\",\"pid\":%d,\"tid\":%d,\"ts\":%llu},\n",
+				e->name,stage,(int)e->tid,base + e->begin);
+	}
+	if(nr_events > TRACE_MAX_EVENTS)
+		fprintf(fp,"{\"name\":\"%d events dropped\",\"ph\":\"i\",\"s\":\"p\",\"pid\":%d,\"tid\":0,\"ts\":%llu},\n",
+			nr_events - TRACE_MAX_EVENTS,stage,base + uptime_us());
+	i = ferror(fp);
+	if(fclose(fp) || i)
+		return -1;
+	return 0;
+}
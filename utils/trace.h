@@ -0,0 +1,26 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// phases recorded by a single program, the others are dropped
+#define TRACE_MAX_EVENTS 128
+/* all the boot stages append their phases to this file,
+ * in the root of the data partition. tracing is enabled by creating it:
+ * "touch /data/boot_trace.json", then open it with chrome://tracing
+ * or ui.perfetto.dev
+ */
+#define TRACE_FILE "boot_trace.json"
+// the instant event that kernel_chooser records just before kexec
+#define TRACE_KEXEC "kexec"
+
+// flags for trace_open
+#define TRACE_NEW_TIMELINE 1 /* drop what the previous boot wrote */
+
+unsigned long long trace_now(void);
+int trace_begin(const char *);
+void trace_end(int);
+void trace_instant(const char *);
+void trace_span(const char *, unsigned long long, unsigned long long);
+int trace_open(const char *, int);
+int trace_dump(int, const char *);
+
+#endif /* TRACE_H */
@@ -0,0 +1,205 @@
+/* wait for devices listening to the kernel uevents.
+ * this replace the old "mdev -s ; sleep 1" loops:
+ * we only create the node that we are waiting for,
+ * as soon as the kernel tell us that it's there.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sysmacros.h>
+#include <linux/netlink.h>
+
+#include "uevent.h"
+
+/** open a socket that receive kernel uevents
+ * returns the socket file descriptor, -1 on error.
+ */
+int uevent_open(void)
+{
+	struct sockaddr_nl addr;
+	int fd;
+
+	if((fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT)) < 0)
+		return -1;
+	memset(&addr,0,sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = 0; // let the kernel choose
+	addr.nl_groups = 1; // kernel broadcast group
+	if(bind(fd,(struct sockaddr *)&addr,sizeof(addr)))
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/** read an uevent from fd and parse it into ev.
+ * @buf: where we store the message, MUST be at least UEVENT_MSG_LEN+1 long.
+ *       ev fields point into it.
+ * returns 0 on success, -1 if the message is not a valid uevent.
+ */
+int uevent_read(int fd, char *buf, struct uevent *ev)
+{
+	ssize_t len;
+	char *pos,*end;
+
+	memset(ev,0,sizeof(struct uevent));
+	ev->major = ev->minor = -1;
+
+	if((len = recv(fd,buf,UEVENT_MSG_LEN,0)) <= 0)
+		return -1;
+	buf[len] = '\0';
+	end = buf + len;
+	// message is "action@devpath\0KEY=VALUE\0KEY=VALUE\0..."
+	for(pos=buf;pos<end;pos+=strlen(pos)+1)
+	{
+		if(!strncmp(pos,"ACTION=",7))
+			ev->action = pos + 7;
+		else if(!strncmp(pos,"SUBSYSTEM=",10))
+			ev->subsystem = pos + 10;
+		else if(!strncmp(pos,"DEVNAME=",8))
+			ev->devname = pos + 8;
+		else if(!strncmp(pos,"MAJOR=",6))
+			ev->major = atoi(pos + 6);
+		else if(!strncmp(pos,"MINOR=",6))
+			ev->minor = atoi(pos + 6);
+	}
+	if(!ev->action || !ev->subsystem)
+		return -1;
+	return 0;
+}
+
+/** create a device node, and its parent directory if needed.
+ * @path: the node to create
+ * @block: 1 if it's a block device, 0 if it's a char one.
+ */
+int uevent_mknod(const char *path, int block, int major, int minor)
+{
+	char dir[256],*pos;
+
+	if(major < 0 || minor < 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	strncpy(dir,path,sizeof(dir)-1);
+	dir[sizeof(dir)-1] = '\0';
+	if((pos = strrchr(dir,'/')) && pos != dir)
+	{
+		*pos = '\0';
+		mkdir(dir,0755); // ignore errors, mknod will tell us if something is wrong
+	}
+	if(mknod(path,(block ? S_IFBLK : S_IFCHR) | 0660, makedev(major,minor)) && errno != EEXIST)
+		return -1;
+	return 0;
+}
+
+/** create the node for a device that the kernel already knows.
+ * looks for the "major:minor" pair in sysfs.
+ * @sysfs: where sysfs is mounted
+ * @path: the device node we want
+ * returns 0 if path has been created, -1 otherwise.
+ */
+int uevent_coldplug(const char *sysfs, const char *path)
+{
+	const char *classes[] = UEVENT_CLASSES,*name;
+	char buffer[256];
+	int i,fd,len,major,minor;
+
+	if((name = strrchr(path,'/')))
+		name++;
+	else
+		name = path;
+
+	for(i=0;classes[i];i++)
+	{
+		snprintf(buffer,sizeof(buffer),"%s/class/%s/%s/dev",sysfs,classes[i],name);
+		if((fd = open(buffer,O_RDONLY)) < 0)
+			continue;
+		len = read(fd,buffer,sizeof(buffer)-1);
+		close(fd);
+		if(len <= 0)
+			continue;
+		buffer[len] = '\0';
+		if(sscanf(buffer,"%d:%d",&major,&minor) != 2)
+			continue;
+		return uevent_mknod(path,!strcmp(classes[i],"block"),major,minor);
+	}
+	errno = ENOENT;
+	return -1;
+}
+
+/** check if ev is the "add" event of the device path.
+ * returns 1 if it is, 0 otherwise.
+ */
+int uevent_match(const char *path, struct uevent *ev)
+{
+	int len,name_len;
+
+	if(!ev->action || strcmp(ev->action,"add") || !ev->devname)
+		return 0;
+	len = strlen(path);
+	name_len = strlen(ev->devname);
+	if(name_len > len || strcmp(path + len - name_len,ev->devname))
+		return 0;
+	// path must be "devname" or ".../devname"
+	return (name_len == len || path[len - name_len - 1] == '/');
+}
+
+/** wait until path is available, for at most timeout seconds.
+ * @sysfs: where sysfs is mounted
+ * @path: the device node to wait for
+ * @timeout: upper bound in seconds
+ * returns 0 on success, -1 on error or timeout ( errno = ETIMEDOUT ).
+ */
+int uevent_wait_for_device(const char *sysfs, const char *path, int timeout)
+{
+	char buffer[UEVENT_MSG_LEN+1];
+	struct uevent ev;
+	struct pollfd pfd;
+	time_t deadline;
+	int fd,ret;
+
+	if(!access(path,R_OK))
+		return 0;
+	// open the socket before looking into sysfs, or we can lose the event
+	fd = uevent_open();
+	if(!uevent_coldplug(sysfs,path))
+	{
+		if(fd >= 0)
+			close(fd);
+		return 0;
+	}
+	if(fd < 0)
+		return -1;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	deadline = time(NULL) + timeout;
+	while(time(NULL) < deadline)
+	{
+		ret = poll(&pfd,1,(deadline - time(NULL)) * 1000);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+			break;
+		if(uevent_read(fd,buffer,&ev) || !uevent_match(path,&ev))
+			continue;
+		if(!uevent_mknod(path,!strcmp(ev.subsystem,"block"),ev.major,ev.minor))
+		{
+			close(fd);
+			return 0;
+		}
+	}
+	close(fd);
+	errno = ETIMEDOUT;
+	return -1;
+}
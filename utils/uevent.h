@@ -0,0 +1,25 @@
+#ifndef UEVENT_H
+#define UEVENT_H
+
+// size of a single netlink uevent message ( kernel sends at most 2048 bytes )
+#define UEVENT_MSG_LEN 2048
+// classes where we look for a "dev" file when the node is already known to the kernel
+#define UEVENT_CLASSES { "block", "tty", "graphics", "misc", "input", NULL }
+
+struct uevent
+{
+	const char *action,
+				*subsystem,
+				*devname;
+	int major,
+			minor;
+};
+
+int uevent_open(void);
+int uevent_read(int, char *, struct uevent *);
+int uevent_mknod(const char *, int, int, int);
+int uevent_coldplug(const char *, const char *);
+int uevent_match(const char *, struct uevent *);
+int uevent_wait_for_device(const char *, const char *, int);
+
+#endif /* UEVENT_H */
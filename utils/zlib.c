@@ -9,81 +9,289 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <zlib.h>
 
-char *zlib_decompress_file(const char *filename, off_t *r_size)
+#include "gzfile.h"
+
+/* gzip decoder working on a mmap'd file.
+ * we inflate raw deflate streams straight into the caller buffer,
+ * without the gzFile buffering and without copying the input.
+ */
+
+static uLong get_le32(const unsigned char *p)
 {
-	gzFile fp;
-	//int errnum;
-	//const char *msg;
-	char *buf,*tmp;
-	off_t size, allocated;
-	ssize_t result;
+	return ((uLong)p[3] << 24) | ((uLong)p[2] << 16) | ((uLong)p[1] << 8) | p[0];
+}
 
-	if (!filename) {
-		*r_size = 0;
+/* parse the member header at zf->pos and get ready to inflate its data */
+static int read_header(ZFILE *zf)
+{
+	unsigned char *p,*end;
+	int flags;
+
+	p = zf->map + zf->pos;
+	end = zf->map + zf->len;
+	if(end - p < GZ_HEADER_LEN || p[0] != 0x1f || p[1] != 0x8b || p[2] != Z_DEFLATED)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	flags = p[3];
+	p += GZ_HEADER_LEN;
+	if((flags & GZ_FEXTRA) && end - p >= 2)
+		p += 2 + (p[0] | (p[1] << 8));
+	if(flags & GZ_FNAME)
+	{
+		while(p < end && *p)
+			p++;
+		p++;
+	}
+	if(flags & GZ_FCOMMENT)
+	{
+		while(p < end && *p)
+			p++;
+		p++;
+	}
+	if(flags & GZ_FHCRC)
+		p += 2;
+	if(p > end)
+	{
+		errno = EIO; // truncated
+		return -1;
+	}
+	zf->pos = p - zf->map;
+	zf->crc = crc32(0L, Z_NULL, 0);
+	zf->isize = 0;
+	if(inflateReset(&(zf->strm)) != Z_OK)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/* check the trailer of the member we just inflated and look for another one */
+static int end_member(ZFILE *zf)
+{
+	unsigned char *p;
+
+	if(zf->len - zf->pos < GZ_TRAILER_LEN)
+	{
+		errno = EIO;
+		return -1;
+	}
+	p = zf->map + zf->pos;
+	if(get_le32(p) != zf->crc || get_le32(p+4) != (zf->isize & 0xffffffffUL))
+	{
+		errno = EIO;
+		return -1;
+	}
+	zf->pos += GZ_TRAILER_LEN;
+	// anything that is not another member is padding
+	if(zf->len - zf->pos < 2 || zf->map[zf->pos] != 0x1f || zf->map[zf->pos+1] != 0x8b)
+	{
+		zf->end = 1;
 		return 0;
 	}
-	fp = gzopen(filename, "rb");
-	if (fp == 0) {
-		/*msg = gzerror(fp, &errnum);
-		if (errnum == Z_ERRNO) {
-			msg = strerror(errno);
-		}
-		ERROR("cannot open \"%s\" - %s\n", filename, msg);*/
+	return read_header(zf);
+}
+
+/** open a gzip file for reading
+ * @fd: the file descriptor, it can be closed after this call.
+ * returns NULL on error or if fd is not a gzip file ( errno = EINVAL ).
+ */
+ZFILE *zlib_dopen(int fd)
+{
+	ZFILE *zf;
+	struct stat st;
+	void *map;
+
+	if(fstat(fd,&st))
+		return NULL;
+	if(!S_ISREG(st.st_mode) || st.st_size < GZ_HEADER_LEN + GZ_TRAILER_LEN)
+	{
+		errno = EINVAL;
 		return NULL;
 	}
-	size = 0;
-	allocated = 65536;
+	if((map = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0)) == MAP_FAILED)
+		return NULL;
+	madvise(map,st.st_size,MADV_SEQUENTIAL);
+	if(!(zf = malloc(sizeof(ZFILE))))
+	{
+		munmap(map,st.st_size);
+		return NULL;
+	}
+	memset(zf,0,sizeof(ZFILE));
+	zf->map = map;
+	zf->len = st.st_size;
+	// raw deflate, we handle gzip headers by ourselves
+	if(inflateInit2(&(zf->strm),-MAX_WBITS) != Z_OK)
+	{
+		munmap(map,st.st_size);
+		free(zf);
+		errno = ENOMEM;
+		return NULL;
+	}
+	if(read_header(zf))
+	{
+		zlib_close(zf);
+		errno = EINVAL;
+		return NULL;
+	}
+	return zf;
+}
+
+ZFILE *zlib_open(const char *filename)
+{
+	ZFILE *zf;
+	int fd,err;
+
+	if((fd = open(filename,O_RDONLY)) < 0)
+		return NULL;
+	zf = zlib_dopen(fd);
+	err = errno;
+	close(fd);
+	errno = err;
+	return zf;
+}
+
+/** decompress up to len bytes into buf
+ * returns the number of bytes decompressed, 0 at the end, -1 on error.
+ */
+ssize_t zlib_read(ZFILE *zf, void *buf, size_t len)
+{
+	size_t done,n;
+	int ret;
+
+	for(done=0;done < len && !zf->end;)
+	{
+		zf->strm.next_in = zf->map + zf->pos;
+		zf->strm.avail_in = zf->len - zf->pos;
+		zf->strm.next_out = (unsigned char *)buf + done;
+		zf->strm.avail_out = len - done;
+		ret = inflate(&(zf->strm),Z_NO_FLUSH);
+		n = (len - done) - zf->strm.avail_out;
+		zf->crc = crc32(zf->crc,(unsigned char *)buf + done,n);
+		zf->isize += n;
+		done += n;
+		zf->pos = zf->strm.next_in - zf->map;
+		if(ret == Z_STREAM_END)
+		{
+			if(end_member(zf))
+				return -1;
+		}
+		else if(ret == Z_BUF_ERROR && zf->strm.avail_out)
+		{
+			errno = EIO; // no more input
+			return -1;
+		}
+		else if(ret != Z_OK && ret != Z_BUF_ERROR)
+		{
+			errno = (ret == Z_MEM_ERROR ? ENOMEM : EINVAL);
+			return -1;
+		}
+	}
+	return done;
+}
+
+/** guess the decompressed size from the ISIZE of the last member.
+ * we don't walk the members, finding where one ends means inflating it:
+ * with more than one the guess is the size of the last one only,
+ * the buffer starts from it and grows by doubling.
+ * returns 0 if it cannot be trusted ( trailing padding, ... )
+ */
+size_t zlib_expected_size(ZFILE *zf)
+{
+	size_t isize,compressed;
+
+	isize = get_le32(zf->map + zf->len - 4);
+	compressed = zf->len - GZ_HEADER_LEN - GZ_TRAILER_LEN;
+	// stored blocks add 5 bytes every 64KB, nothing can be bigger than that
+	if(isize + (isize >> 10) + 64 < compressed || isize / GZ_MAX_RATIO > compressed)
+		return 0;
+	return isize;
+}
+
+void zlib_close(ZFILE *zf)
+{
+	inflateEnd(&(zf->strm));
+	munmap(zf->map,zf->len);
+	free(zf);
+}
+
+/** decompress a whole gzip file.
+ * the buffer is allocated once using the ISIZE trailer,
+ * it grows only if the trailer lies or the file has more members.
+ * @fd: the gzip file, it's not closed.
+ * returns NULL if fd is not a gzip file.
+ */
+char *zlib_decompress_fd(int fd, off_t *r_size)
+{
+	ZFILE *zf;
+	char *buf,*tmp;
+	size_t size, allocated;
+	ssize_t result;
+	int err;
+
+	if(!(zf = zlib_dopen(fd)))
+		return NULL;
+	// one more byte, so we see the end of the stream without growing
+	if((allocated = zlib_expected_size(zf)))
+		allocated++;
+	else
+		allocated = GZ_MIN_ALLOC;
 	buf = malloc(allocated);
 	if(!buf)
 	{
-		//FATAL("malloc - %s\n",strerror(errno));
-		gzclose(fp);
+		zlib_close(zf);
 		return NULL;
 	}
-	do {
-		if (size == allocated) {
-			allocated <<= 1;
-			tmp = realloc(buf, allocated);
-			if(!tmp)
-			{
-				free(buf);
-				gzclose(fp);
-				//FATAL("realloc - %s\n",strerror(errno));
-				return NULL;
-			}
-			buf = tmp;
-		}
-		result = gzread(fp, buf + size, allocated - size);
-		if (result < 0) {
-			if ((errno == EINTR) || (errno == EAGAIN))
-				continue;
-			/*
-			msg = gzerror(fp, &errnum);
-			if (errnum == Z_ERRNO) {
-				msg = strerror(errno);
-			}
-			ERROR ("read on %s of %ld bytes failed: %s\n",
-				filename, (allocated - size) + 0UL, msg);*/
+	size = 0;
+	for(;;)
+	{
+		if((result = zlib_read(zf, buf + size, allocated - size)) < 0)
+		{
+			err = errno;
 			free(buf);
-			gzclose(fp);
+			zlib_close(zf);
+			errno = err;
 			return NULL;
 		}
 		size += result;
-	} while(result > 0);
-	result = gzclose(fp);
-	if (result != Z_OK) {
-		/*
-		msg = gzerror(fp, &errnum);
-		if (errnum == Z_ERRNO) {
-			msg = strerror(errno);
+		if(size < allocated || zf->end)
+			break;
+		allocated <<= 1;
+		tmp = realloc(buf, allocated);
+		if(!tmp)
+		{
+			free(buf);
+			zlib_close(zf);
+			return NULL;
 		}
-		ERROR ("close of %s failed: %s\n", filename, msg);*/
-		free(buf);
-		return NULL;
+		buf = tmp;
+	}
+	zlib_close(zf);
+	*r_size = size;
+	return buf;
+}
+
+char *zlib_decompress_file(const char *filename, off_t *r_size)
+{
+	char *buf;
+	int fd,err;
+
+	if (!filename) {
+		*r_size = 0;
+		return 0;
 	}
-	*r_size =  size;
+	if((fd = open(filename,O_RDONLY)) < 0)
+		return NULL;
+	buf = zlib_decompress_fd(fd, r_size);
+	err = errno;
+	close(fd);
+	errno = err;
 	return buf;
 }
 